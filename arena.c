@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_BLOCK 8192
+#define ARENA_ALIGN 16
+
+void arena_init(arena_t *arena) {
+    arena->head = NULL;
+    arena->cur = NULL;
+}
+
+static arena_block_t *new_block(size_t size) {
+    arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+    if (!block) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    // NULL only if malloc fails
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    // later blocks survive a reset, use them before asking malloc
+    while (arena->cur && arena->cur->used + size > arena->cur->size && arena->cur->next) {
+        arena->cur = arena->cur->next;
+    }
+
+    arena_block_t *block = arena->cur;
+    if (!block || block->used + size > block->size) {
+        size_t want = block ? block->size * 2 : ARENA_BLOCK;
+        while (want < size) {
+            want *= 2;
+        }
+        arena_block_t *fresh = new_block(want);
+        if (!fresh) {
+            return NULL;
+        }
+        if (block) {
+            block->next = fresh;
+        } else {
+            arena->head = fresh;
+        }
+        arena->cur = block = fresh;
+    }
+
+    void *p = block->data + block->used;
+    block->used += size;
+    return p;
+}
+
+char *arena_strndup(arena_t *arena, const char *s, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+    if (copy) {
+        memcpy(copy, s, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+void arena_reset(arena_t *arena) {
+    // rewind every block, nothing is freed
+    for (arena_block_t *b = arena->head; b; b = b->next) {
+        b->used = 0;
+    }
+    arena->cur = arena->head;
+}
+
+arena_mark_t arena_mark(const arena_t *arena) {
+    arena_mark_t mark = { arena->cur, arena->cur ? arena->cur->used : 0 };
+    return mark;
+}
+
+void arena_release(arena_t *arena, arena_mark_t mark) {
+    // back to where arena_mark was taken
+    if (!mark.block) {
+        arena_reset(arena);
+        return;
+    }
+    for (arena_block_t *b = mark.block->next; b; b = b->next) {
+        b->used = 0;
+    }
+    mark.block->used = mark.used;
+    arena->cur = mark.block;
+}
+
+void arena_free(arena_t *arena) {
+    arena_block_t *next;
+    for (arena_block_t *b = arena->head; b; b = next) {
+        next = b->next;
+        free(b);
+    }
+    arena->head = arena->cur = NULL;
+}
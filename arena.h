@@ -0,0 +1,35 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// bump allocator for per-line data, everything is released at once by arena_reset
+// blocks are kept across resets so a steady state line allocates nothing
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_block_t;
+
+typedef struct {
+    arena_block_t *head;
+    arena_block_t *cur;
+} arena_t;
+
+// a point to roll back to, everything allocated after it goes at once
+typedef struct {
+    arena_block_t *block;   // NULL if the arena had nothing yet
+    size_t used;
+} arena_mark_t;
+
+void arena_init(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+char *arena_strndup(arena_t *arena, const char *s, size_t len);
+void arena_reset(arena_t *arena);
+arena_mark_t arena_mark(const arena_t *arena);
+void arena_release(arena_t *arena, arena_mark_t mark);
+void arena_free(arena_t *arena);
+
+#endif
@@ -0,0 +1,99 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "../wildcard.h"
+
+// pathname expansion over one huge directory, yash's engine next to glob(3)
+// usage: glob_bench [dir] [files]
+// fills dir with files empty files (half .gz, half .log) if it isn't there yet,
+// then expands each pattern a few times and keeps the best run
+// prints one key=value line per pattern so runs can be compared by scripts
+
+static const char *patterns[] = { "*.gz", "*7.gz", "f00001*", "f*[13579].log", "*.none" };
+
+#define NPATTERNS (sizeof(patterns) / sizeof(patterns[0]))
+#define RUNS 3
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int populate(const char *dir, long files) {
+    if (mkdir(dir, 0755) < 0) {
+        perror(dir);
+        return -1;
+    }
+    int dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (dirfd < 0) {
+        perror(dir);
+        return -1;
+    }
+    fprintf(stderr, "creating %ld files in %s\n", files, dir);
+    for (long i = 0; i < files; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "f%07ld.%s", i, (i & 1) ? "gz" : "log");
+        int fd = openat(dirfd, name, O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            perror(name);
+            close(dirfd);
+            return -1;
+        }
+        close(fd);
+    }
+    close(dirfd);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : "/tmp/yash_glob_bench";
+    long files = argc > 2 ? atol(argv[2]) : 1000000;
+    struct stat st;
+    if (stat(dir, &st) < 0 && populate(dir, files) < 0) {
+        return 1;
+    }
+    if (chdir(dir) < 0) {
+        perror(dir);
+        return 1;
+    }
+
+    arena_t arena;
+    arena_init(&arena);
+    wildcard_t w = { 0 };
+    for (size_t p = 0; p < NPATTERNS; p++) {
+        double best_yash = 0, best_glob = 0;
+        size_t n_yash = 0, n_glob = 0;
+        for (int r = 0; r < RUNS; r++) {
+            arena_reset(&arena);
+            double t0 = now_us();
+            if (wildcard_expand(&arena, patterns[p], &w) < 0) {
+                fprintf(stderr, "wildcard_expand: out of memory\n");
+                return 1;
+            }
+            double t = now_us() - t0;
+            best_yash = (r == 0 || t < best_yash) ? t : best_yash;
+            n_yash = w.n;
+
+            glob_t g;
+            t0 = now_us();
+            int err = glob(patterns[p], 0, NULL, &g);
+            t = now_us() - t0;
+            best_glob = (r == 0 || t < best_glob) ? t : best_glob;
+            n_glob = (err == 0) ? g.gl_pathc : 0;
+            globfree(&g);
+        }
+        printf("pattern=%s matches=%zu yash_ms=%.1f glob3_matches=%zu glob3_ms=%.1f\n",
+               patterns[p], n_yash, best_yash / 1e3, n_glob, best_glob / 1e3);
+        fflush(stdout);
+    }
+    wildcard_free(&w);
+    arena_free(&arena);
+    return 0;
+}
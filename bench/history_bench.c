@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "../history.h"
+
+// history microbenchmark over a large history file
+// usage: history_bench [file] [entries]
+// builds file with entries synthetic commands if it isn't there yet, then times
+// startup with and without an index, and ctrl-r searches step by step
+// (the largest step is what a keystroke can wait for)
+// prints one key=value line per result so runs can be compared by scripts
+
+static const char *words[] = {
+    "git", "status", "make", "-j8", "ls", "-la", "cd", "src", "grep", "-rn",
+    "vim", "main.c", "ssh", "build01", "kubectl", "get", "pods", "docker", "ps", "cat"
+};
+
+#define NWORDS (sizeof(words) / sizeof(words[0]))
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int generate(const char *path, long entries) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    unsigned long x = 88172645463325252UL;
+    for (long i = 0; i < entries; i++) {
+        int n = 2 + i % 4;
+        for (int w = 0; w < n; w++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            fprintf(f, "%s%s", w ? " " : "", words[x % NWORDS]);
+        }
+        fprintf(f, " #%ld;\n", i);   // unique, searchable
+    }
+    return fclose(f);
+}
+
+static void time_startup(const char *label) {
+    // in a child, history_init only runs once per process
+    pid_t pid = fork();
+    if (pid == 0) {
+        double t0 = now_us();
+        history_init();
+        printf("startup index=%s entries=%ld ms=%.3f\n", label, history_count(), (now_us() - t0) / 1e3);
+        fflush(stdout);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void time_search(const char *query) {
+    history_search_t s;
+    history_search_start(&s, query, strlen(query), history_count());
+    int steps = 0, cap = 1024, r;
+    double *step_us = malloc(cap * sizeof(double));
+    double t0 = now_us();
+    do {
+        double t = now_us();
+        r = history_search_step(&s);
+        if (steps == cap) {
+            cap *= 2;
+            step_us = realloc(step_us, cap * sizeof(double));
+        }
+        step_us[steps++] = now_us() - t;
+    } while (r < 0);
+    double total = now_us() - t0;
+
+    qsort(step_us, steps, sizeof(double), compare_double);
+    printf("search query=\"%s\" found=%ld steps=%d p50_step_us=%.1f p99_step_us=%.1f max_step_us=%.1f total_ms=%.3f\n",
+           query, r ? s.match + 1 : 0L, steps, step_us[steps / 2], step_us[(int)(steps * 0.99)],
+           step_us[steps - 1], total / 1e3);
+    free(step_us);
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "/tmp/yash_history_bench";
+    long entries = argc > 2 ? atol(argv[2]) : 5000000;
+
+    char index_path[4096];
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        double t0 = now_us();
+        if (generate(path, entries) < 0) {
+            return 1;
+        }
+        unlink(index_path);
+        printf("generate entries=%ld s=%.1f\n", entries, (now_us() - t0) / 1e6);
+    }
+    setenv("HISTFILE", path, 1);
+    fflush(stdout);
+
+    unlink(index_path);
+    time_startup("none");
+    time_startup("current");
+
+    history_init();
+    long n = history_count();
+
+    // the last few entries, one near the start, and nothing at all
+    char recent[64], oldest[64];
+    snprintf(recent, sizeof(recent), "#%ld;", n - 10);
+    snprintf(oldest, sizeof(oldest), "#%ld;", 10L);
+    time_search(recent);
+    time_search(oldest);
+    time_search("no such command");
+
+    // 'history 1000'
+    double t0 = now_us();
+    size_t bytes = 0;
+    for (long i = n - 1000; i < n; i++) {
+        size_t len;
+        if (history_get(i, &len)) {
+            bytes += len;
+        }
+    }
+    printf("last entries=1000 us=%.1f bytes=%zu\n", now_us() - t0, bytes);
+    return 0;
+}
@@ -0,0 +1,88 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../arena.h"
+#include "../parse.h"
+
+// parser microbenchmark: parses every line of a corpus many times
+// usage: parse_bench [corpus] [rounds]
+// prints one key=value line so runs can be compared by scripts
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "bench/parse_corpus.txt";
+    long rounds = argc > 2 ? atol(argv[2]) : 20000;
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+
+    char **lines = NULL;
+    size_t nlines = 0, cap = 0, bytes = 0;
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t n;
+    while ((n = getline(&line, &len, f)) > 0) {
+        if (line[n-1] == '\n') {
+            line[--n] = '\0';
+        }
+        if (nlines == cap) {
+            cap = cap ? cap * 2 : 64;
+            lines = realloc(lines, cap * sizeof(char *));
+        }
+        lines[nlines++] = strdup(line);
+        bytes += n;
+    }
+    free(line);
+    fclose(f);
+    if (nlines == 0) {
+        fprintf(stderr, "%s: empty corpus\n", path);
+        return 1;
+    }
+
+    arena_t arena;
+    arena_init(&arena);
+
+    // make sure the corpus parses before timing it
+    for (size_t i = 0; i < nlines; i++) {
+        code_t *code;
+        function_def_t *defs;
+        arena_reset(&arena);
+        if (parse_line(&arena, lines[i], NULL, &code, &defs) < 0) {
+            fprintf(stderr, "%s:%zu: does not parse\n", path, i + 1);
+            return 1;
+        }
+        parse_release(defs);
+    }
+
+    struct timespec start, end;
+    size_t pipelines = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < nlines; i++) {
+            code_t *code;
+            function_def_t *defs;
+            arena_reset(&arena);
+            if (parse_line(&arena, lines[i], NULL, &code, &defs) == 0) {
+                pipelines += (code != NULL);
+                parse_release(defs);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    double total = (double)rounds * nlines;
+    printf("parse lines=%zu rounds=%ld ns_per_line=%.1f mb_per_s=%.1f checksum=%zu\n",
+           nlines, rounds, ns / total, (bytes * (double)rounds) / (ns / 1e9) / 1e6, pipelines);
+
+    arena_free(&arena);
+    for (size_t i = 0; i < nlines; i++) {
+        free(lines[i]);
+    }
+    free(lines);
+    return 0;
+}
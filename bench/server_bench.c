@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "../server.h"
+
+// per command latency of a fresh 'yash -c' against a request to 'yash --server'
+// usage: server_bench [requests] [yash]
+// the server is started first, then each command is run requests times, one at
+// a time: exec'ing 'yash -c CMD', exec'ing 'yash --client SOCKET CMD', and
+// client_call() from this process, like an orchestrator speaking the protocol
+// prints one key=value line per result so runs can be compared by scripts
+
+extern char **environ;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static FILE *results;   // stdout as it was, the commands' output goes to /dev/null
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *how, const char *cmd, double *us, int n) {
+    qsort(us, n, sizeof(double), compare_double);
+    fprintf(results, "server how=%s cmd=\"%s\" p50_us=%.1f p99_us=%.1f\n",
+            how, cmd, us[n / 2], us[(int)(n * 0.99)]);
+    fflush(results);
+}
+
+static void time_exec(const char *how, char *const *argv, const char *cmd, int requests) {
+    double *us = malloc(requests * sizeof(double));
+    for (int i = 0; i < requests; i++) {
+        double t0 = now_us();
+        pid_t pid;
+        if (posix_spawn(&pid, argv[0], NULL, NULL, argv, environ) != 0) {
+            perror(argv[0]);
+            exit(1);
+        }
+        waitpid(pid, NULL, 0);
+        us[i] = now_us() - t0;
+    }
+    report(how, cmd, us, requests);
+    free(us);
+}
+
+static void time_call(const char *path, const char *cmd, int requests) {
+    double *us = malloc(requests * sizeof(double));
+    for (int i = 0; i < requests; i++) {
+        double t0 = now_us();
+        if (client_call(path, cmd, NULL) < 0) {
+            perror(path);
+            exit(1);
+        }
+        us[i] = now_us() - t0;
+    }
+    report("client_call", cmd, us, requests);
+    free(us);
+}
+
+int main(int argc, char **argv) {
+    int requests = argc > 1 ? atoi(argv[1]) : 2000;
+    char *yash = argc > 2 ? argv[2] : "./yash";
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/yash-server-bench.%d", getpid());
+
+    pid_t server;
+    char *server_argv[] = { yash, "--server", path, NULL };
+    if (posix_spawn(&server, yash, NULL, NULL, server_argv, environ) != 0) {
+        perror(yash);
+        return 1;
+    }
+    // wait for the socket to show up
+    for (int i = 0; i < 1000 && access(path, F_OK) < 0; i++) {
+        usleep(1000);
+    }
+
+    // commands write to /dev/null, like an orchestrator that only wants statuses
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+
+    static char *const cmds[] = { ":", "/bin/true", "echo a | cat" };
+    for (size_t c = 0; c < sizeof(cmds) / sizeof(cmds[0]); c++) {
+        char *cmd = cmds[c];
+        char *direct[] = { yash, "-c", cmd, NULL };
+        char *client[] = { yash, "--client", path, cmd, NULL };
+        time_exec("yash -c", direct, cmd, requests);
+        time_exec("yash --client", client, cmd, requests);
+        time_call(path, cmd, requests);
+    }
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    unlink(path);
+    return 0;
+}
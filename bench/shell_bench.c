@@ -0,0 +1,370 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+// end-to-end shell benchmarks driven through a pseudo-terminal
+// usage: shell_bench [-s scale] shell...
+// every workload runs under each shell given, one JSON object per line:
+//   startup     fork to first prompt
+//   spawn       '/bin/true' to the next prompt
+//   pipeline    bytes through an N-stage cat pipeline
+//   bg_churn    '/bin/true &' per job, then 'jobs'
+//   stop_fg     ctrl-z on a foreground cat, 'fg', until cat answers again
+// a shell that is missing or never shows a prompt is reported as skipped
+
+#define PROMPT "# "
+#define TIMEOUT_MS 20000
+#define BUF_SIZE 65536
+#define PIPE_STAGES 5
+#define PIPE_BYTES (64L << 20)
+
+typedef struct {
+    const char *name;   // as given on the command line
+    char path[4096];
+    pid_t pid;
+    int fd;             // pty master
+    char buf[BUF_SIZE]; // output since the last clear_output
+    size_t len;
+} shell_t;
+
+static int scale = 1;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int resolve(shell_t *sh) {
+    // find sh->name on PATH unless it has a '/'
+    if (strchr(sh->name, '/')) {
+        snprintf(sh->path, sizeof(sh->path), "%s", sh->name);
+        return access(sh->path, X_OK);
+    }
+    const char *path = getenv("PATH");
+    while (path && *path) {
+        const char *colon = strchrnul(path, ':');
+        snprintf(sh->path, sizeof(sh->path), "%.*s/%s", (int)(colon - path), path, sh->name);
+        if (access(sh->path, X_OK) == 0) {
+            return 0;
+        }
+        path = *colon ? colon + 1 : colon;
+    }
+    return -1;
+}
+
+static void clear_output(shell_t *sh) {
+    sh->len = 0;
+}
+
+static int read_some(shell_t *sh, int timeout_ms) {
+    // append whatever the shell wrote, keeping the newest bytes if the buffer fills
+    struct pollfd pfd = { .fd = sh->fd, .events = POLLIN };
+    int r = poll(&pfd, 1, timeout_ms);
+    if (r <= 0) {
+        return -1;
+    }
+    if (sh->len > BUF_SIZE / 2) {
+        memmove(sh->buf, sh->buf + sh->len - BUF_SIZE / 4, BUF_SIZE / 4);
+        sh->len = BUF_SIZE / 4;
+    }
+    ssize_t n = read(sh->fd, sh->buf + sh->len, BUF_SIZE - sh->len - 1);
+    if (n <= 0) {
+        return -1;
+    }
+    sh->len += n;
+    sh->buf[sh->len] = '\0';
+    return 0;
+}
+
+static int wait_prompt(shell_t *sh) {
+    // until the output ends in the prompt
+    size_t plen = strlen(PROMPT);
+    double deadline = now_us() + TIMEOUT_MS * 1000.0;
+    while (sh->len < plen || memcmp(sh->buf + sh->len - plen, PROMPT, plen) != 0) {
+        int left = (int)((deadline - now_us()) / 1000);
+        if (left <= 0 || read_some(sh, left) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int wait_count(shell_t *sh, const char *s, int count) {
+    // until s appeared count times since the last clear_output
+    double deadline = now_us() + TIMEOUT_MS * 1000.0;
+    for (;;) {
+        int seen = 0;
+        for (const char *p = sh->buf; (p = strstr(p, s)) != NULL; p += strlen(s)) {
+            seen++;
+        }
+        if (seen >= count) {
+            return 0;
+        }
+        int left = (int)((deadline - now_us()) / 1000);
+        if (left <= 0 || read_some(sh, left) < 0) {
+            return -1;
+        }
+    }
+}
+
+static void send(shell_t *sh, const char *s) {
+    size_t len = strlen(s);
+    while (len > 0) {
+        ssize_t n = write(sh->fd, s, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        s += n;
+        len -= n;
+    }
+}
+
+static int run(shell_t *sh, const char *line) {
+    // send one command line and wait for the prompt after it
+    clear_output(sh);
+    send(sh, line);
+    return wait_prompt(sh);
+}
+
+static int start(shell_t *sh) {
+    // interactive shell on a new pty, returns once the first prompt is up
+    struct winsize ws = { .ws_row = 50, .ws_col = 200 };
+    sh->len = 0;
+    sh->pid = forkpty(&sh->fd, NULL, NULL, &ws);
+    if (sh->pid < 0) {
+        return -1;
+    }
+    if (sh->pid == 0) {
+        setenv("PS1", PROMPT, 1);
+        setenv("PS2", "", 1);
+        setenv("TERM", "dumb", 1);
+        setenv("HISTFILE", "/dev/null", 1);
+        const char *base = strrchr(sh->path, '/');
+        base = base ? base + 1 : sh->path;
+        if (strcmp(base, "bash") == 0) {
+            execl(sh->path, sh->path, "--norc", "--noprofile", "--noediting", "-i", (char *)NULL);
+        } else {
+            execl(sh->path, sh->path, "-i", (char *)NULL);
+        }
+        _exit(127);
+    }
+    return wait_prompt(sh);
+}
+
+static void stop(shell_t *sh) {
+    send(sh, "exit\n");
+    for (int i = 0; i < 100; i++) {
+        if (waitpid(sh->pid, NULL, WNOHANG) == sh->pid) {
+            close(sh->fd);
+            return;
+        }
+        usleep(10000);
+    }
+    kill(sh->pid, SIGKILL);
+    waitpid(sh->pid, NULL, 0);
+    close(sh->fd);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double *v, int n, double p) {
+    // v must be sorted
+    int i = (int)(p * (n - 1) + 0.5);
+    return v[i];
+}
+
+static void report_latency(const shell_t *sh, const char *bench, double *v, int n) {
+    qsort(v, n, sizeof(double), compare_double);
+    printf("{\"shell\":\"%s\",\"bench\":\"%s\",\"n\":%d,\"p50_us\":%.1f,\"p99_us\":%.1f,\"min_us\":%.1f}\n",
+           sh->name, bench, n, percentile(v, n, 0.5), percentile(v, n, 0.99), v[0]);
+    fflush(stdout);
+}
+
+static void report_failure(const shell_t *sh, const char *bench) {
+    printf("{\"shell\":\"%s\",\"bench\":\"%s\",\"error\":\"timed out\"}\n", sh->name, bench);
+    fflush(stdout);
+}
+
+static int bench_startup(shell_t *sh) {
+    int n = 50 * scale;
+    double *v = malloc(n * sizeof(double));
+    for (int i = 0; i < n; i++) {
+        double t0 = now_us();
+        if (start(sh) < 0) {
+            report_failure(sh, "startup");
+            free(v);
+            return -1;
+        }
+        v[i] = now_us() - t0;
+        stop(sh);
+    }
+    report_latency(sh, "startup", v, n);
+    free(v);
+    return 0;
+}
+
+static void bench_spawn(shell_t *sh) {
+    int n = 500 * scale;
+    double *v = malloc(n * sizeof(double));
+    for (int i = 0; i < 20; i++) {
+        run(sh, "/bin/true\n");    // warm up caches
+    }
+    for (int i = 0; i < n; i++) {
+        double t0 = now_us();
+        if (run(sh, "/bin/true\n") < 0) {
+            report_failure(sh, "spawn");
+            free(v);
+            return;
+        }
+        v[i] = now_us() - t0;
+    }
+    report_latency(sh, "spawn", v, n);
+    free(v);
+}
+
+static void bench_pipeline(shell_t *sh) {
+    // head | cat | ... | cat > /dev/null, best of a few runs
+    char line[512];
+    int len = snprintf(line, sizeof(line), "head -c %ld /dev/zero", PIPE_BYTES);
+    for (int i = 1; i < PIPE_STAGES; i++) {
+        len += snprintf(line + len, sizeof(line) - len, " | cat");
+    }
+    snprintf(line + len, sizeof(line) - len, " > /dev/null\n");
+
+    int runs = 3 * scale;
+    double best = 0;
+    for (int i = 0; i < runs; i++) {
+        double t0 = now_us();
+        if (run(sh, line) < 0) {
+            report_failure(sh, "pipeline");
+            return;
+        }
+        double us = now_us() - t0;
+        if (best == 0 || us < best) {
+            best = us;
+        }
+    }
+    printf("{\"shell\":\"%s\",\"bench\":\"pipeline\",\"stages\":%d,\"bytes\":%ld,\"runs\":%d,\"best_us\":%.1f,\"mb_per_s\":%.1f}\n",
+           sh->name, PIPE_STAGES, PIPE_BYTES, runs, best, PIPE_BYTES / best);
+    fflush(stdout);
+}
+
+static void bench_bg_churn(shell_t *sh) {
+    // launch and reap background jobs, then list what is left
+    int n = 200 * scale;
+    double t0 = now_us();
+    for (int i = 0; i < n; i++) {
+        if (run(sh, "/bin/true &\n") < 0) {
+            report_failure(sh, "bg_churn");
+            return;
+        }
+    }
+    if (run(sh, "jobs\n") < 0) {
+        report_failure(sh, "bg_churn");
+        return;
+    }
+    double us = now_us() - t0;
+    printf("{\"shell\":\"%s\",\"bench\":\"bg_churn\",\"jobs\":%d,\"total_us\":%.1f,\"us_per_job\":%.1f}\n",
+           sh->name, n, us, us / n);
+    fflush(stdout);
+}
+
+static void bench_stop_fg(shell_t *sh) {
+    // ctrl-z a foreground reader, fg it, and time until it reads again
+    // a line typed at cat shows up twice: the tty's echo and cat's copy
+    int n = 50 * scale;
+    double *v = malloc(n * sizeof(double));
+    for (int i = 0; i < n; i++) {
+        clear_output(sh);
+        send(sh, "cat\n");
+        send(sh, "ping\n");
+        if (wait_count(sh, "ping\r\n", 2) < 0) {
+            goto fail;
+        }
+
+        double t0 = now_us();
+        clear_output(sh);
+        send(sh, "\x1a");
+        if (wait_prompt(sh) < 0) {
+            goto fail;
+        }
+        clear_output(sh);
+        send(sh, "fg\n");
+        send(sh, "pong\n");
+        if (wait_count(sh, "pong\r\n", 2) < 0) {
+            goto fail;
+        }
+        v[i] = now_us() - t0;
+
+        clear_output(sh);
+        send(sh, "\x04");   // EOF ends cat
+        if (wait_prompt(sh) < 0) {
+            goto fail;
+        }
+    }
+    report_latency(sh, "stop_fg", v, n);
+    free(v);
+    return;
+
+fail:
+    report_failure(sh, "stop_fg");
+    free(v);
+}
+
+int main(int argc, char **argv) {
+    int argi = 1;
+    if (argi + 1 < argc && strcmp(argv[argi], "-s") == 0) {
+        scale = atoi(argv[argi + 1]);
+        if (scale < 1) {
+            scale = 1;
+        }
+        argi += 2;
+    }
+    if (argi >= argc) {
+        fprintf(stderr, "usage: shell_bench [-s scale] shell...\n");
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    for (; argi < argc; argi++) {
+        shell_t *sh = calloc(1, sizeof(shell_t));
+        sh->name = argv[argi];
+        if (resolve(sh) < 0) {
+            printf("{\"shell\":\"%s\",\"skipped\":\"not found\"}\n", sh->name);
+            free(sh);
+            continue;
+        }
+
+        if (bench_startup(sh) < 0) {
+            free(sh);
+            continue;
+        }
+        if (start(sh) < 0) {
+            report_failure(sh, "start");
+            free(sh);
+            continue;
+        }
+        bench_spawn(sh);
+        bench_pipeline(sh);
+        bench_bg_churn(sh);
+        bench_stop_fg(sh);
+        stop(sh);
+        free(sh);
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "../spawn.h"
+#include "../zygote.h"
+#include "../fdtable.h"
+
+// spawn latency against shell size, for each launch path
+// usage: spawn_bench [max_mb] [spawns]
+// the spawn server is started first, like the shell does, then the process is
+// grown by touching heap in steps up to max_mb and /bin/true is launched
+// spawns times per path at each size, waiting for each child
+// prints one key=value line per result so runs can be compared by scripts
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void time_spawns(const char *label, long mb, int spawns) {
+    static char *const argv[] = { "true", NULL };
+    sigset_t mask;
+    sigemptyset(&mask);
+    double *us = malloc(spawns * sizeof(double));
+
+    for (int i = 0; i < spawns; i++) {
+        spawn_req_t req;
+        spawn_req_init(&req, argv, -1, 0, &mask);
+        req.path = "/bin/true";
+        double t0 = now_us();
+        pid_t pid = spawn_start(&req);
+        us[i] = now_us() - t0;
+        if (pid < 0) {
+            perror(label);
+            exit(1);
+        }
+        waitpid(pid, NULL, 0);
+        spawn_req_free(&req);
+    }
+
+    qsort(us, spawns, sizeof(double), compare_double);
+    printf("spawn mode=%s heap_mb=%ld p50_us=%.1f p99_us=%.1f\n",
+           label, mb, us[spawns / 2], us[(int)(spawns * 0.99)]);
+    fflush(stdout);
+    free(us);
+}
+
+int main(int argc, char **argv) {
+    long max_mb = argc > 1 ? atol(argv[1]) : 1024;
+    int spawns = argc > 2 ? atoi(argv[2]) : 200;
+
+    // the spawn server passes children the fds 0-9 the table says are open
+    fdtable_init();
+    if (zygote_start() < 0) {
+        perror("spawn server");
+        return 1;
+    }
+
+    static const struct {
+        const char *label;
+        spawn_mode_t mode;
+    } modes[] = {
+        { "spawn", SPAWN_MODE_SPAWN },
+        { "fork", SPAWN_MODE_FORK },
+        { "zygote", SPAWN_MODE_ZYGOTE },
+    };
+
+    long mb = 0;
+    while (1) {
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            spawn_mode = modes[m].mode;
+            time_spawns(modes[m].label, mb, spawns);
+        }
+        if (mb >= max_mb) {
+            break;
+        }
+        // grow to the next size, touched so the pages are really there
+        long next = mb ? mb * 4 : 16;
+        if (next > max_mb) {
+            next = max_mb;
+        }
+        size_t bytes = (next - mb) << 20;
+        char *ballast = malloc(bytes);
+        if (!ballast) {
+            perror("malloc");
+            return 1;
+        }
+        memset(ballast, 1, bytes);
+        mb = next;
+    }
+    return 0;
+}
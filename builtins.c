@@ -0,0 +1,998 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "builtins.h"
+#include "jobs.h"
+#include "cmdhash.h"
+#include "parallel.h"
+#include "events.h"
+#include "trace.h"
+#include "stats.h"
+#include "history.h"
+#include "zygote.h"
+#include "rlimits.h"
+#include "vars.h"
+#include "code.h"
+
+typedef struct {
+    const char *name;
+    builtin_fn_t fn;
+} builtin_t;
+
+static int builtin_true(char **args) {
+    (void)args;
+    return 0;
+}
+
+static int builtin_false(char **args) {
+    (void)args;
+    return 1;
+}
+
+static int builtin_jobs(char **args) {
+    // 'jobs -l' adds per process usage
+    run_jobs(args[1] && strcmp(args[1], "-l") == 0);
+    return 0;
+}
+
+static int builtin_fg(char **args) {
+    // parse if user typed fg with a number
+    int job_id = 0;
+    if (args[1]) {
+        job_id = atoi(args[1]);  // convert to integer
+    }
+    return run_fg(job_id);
+}
+
+static int builtin_bg(char **args) {
+    int job_id = 0;
+    if (args[1]) {
+        job_id = atoi(args[1]);
+    }
+    return run_bg(job_id);
+}
+
+static int builtin_cd(char **args) {
+    // cd [dir], no dir goes to $HOME, '-' to $OLDPWD
+    const char *dir = args[1];
+    int print = 0;
+
+    if (!dir) {
+        dir = var_get("HOME");
+        if (!dir) {
+            fprintf(stderr, "cd: HOME not set\n");
+            return 1;
+        }
+    } else if (strcmp(dir, "-") == 0) {
+        dir = var_get("OLDPWD");
+        if (!dir) {
+            fprintf(stderr, "cd: OLDPWD not set\n");
+            return 1;
+        }
+        print = 1;
+    }
+
+    if (chdir(dir) < 0) {
+        fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+
+    const char *old = var_get("PWD");
+    if (old) {
+        var_set("OLDPWD", old);
+    }
+    char *cwd = getcwd(NULL, 0);
+    if (cwd) {
+        var_set("PWD", cwd);
+        if (print) {
+            printf("%s\n", cwd);
+        }
+        free(cwd);
+    }
+    return 0;
+}
+
+static int builtin_pwd(char **args) {
+    // $PWD if it still names the current directory (-L, the default), else the real path (-P)
+    int physical = args[1] && strcmp(args[1], "-P") == 0;
+
+    const char *pwd = var_get("PWD");
+    struct stat pwd_st, dot_st;
+    if (!physical && pwd && pwd[0] == '/' && stat(pwd, &pwd_st) == 0 && stat(".", &dot_st) == 0 &&
+        pwd_st.st_dev == dot_st.st_dev && pwd_st.st_ino == dot_st.st_ino) {
+        printf("%s\n", pwd);
+        return 0;
+    }
+
+    char *cwd = getcwd(NULL, 0);
+    if (!cwd) {
+        fprintf(stderr, "pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    printf("%s\n", cwd);
+    free(cwd);
+    return 0;
+}
+
+static const char *escape(const char *p, char *out, int in_format, int *stop) {
+    // decode the backslash escape at p (just past the '\'), returns where it ends
+    // octal is \NNN in a printf format and \0NNN in echo -e / %b
+    // \c sets *stop: no more output at all
+    int max_digits = 3;
+    switch (*p) {
+        case 'a': *out = '\a'; return p + 1;
+        case 'b': *out = '\b'; return p + 1;
+        case 'f': *out = '\f'; return p + 1;
+        case 'n': *out = '\n'; return p + 1;
+        case 'r': *out = '\r'; return p + 1;
+        case 't': *out = '\t'; return p + 1;
+        case 'v': *out = '\v'; return p + 1;
+        case '\\': *out = '\\'; return p + 1;
+        case 'c':
+            if (!in_format) {
+                *stop = 1;
+                *out = '\0';
+                return p + 1;
+            }
+            break;
+        case '0':
+            if (!in_format) {
+                p++;    // \0NNN
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (*p >= '0' && *p <= '7') {
+        int v = 0;
+        for (int i = 0; i < max_digits && *p >= '0' && *p <= '7'; i++) {
+            v = v * 8 + (*p++ - '0');
+        }
+        *out = (char)v;
+        return p;
+    }
+    if (!in_format && p[-1] == '0') {
+        *out = '\0';    // bare \0
+        return p;
+    }
+
+    // unknown escape, keep the backslash
+    *out = '\\';
+    return p;
+}
+
+static int print_escaped(const char *s) {
+    // echo -e / %b, returns 1 if \c stopped output
+    int stop = 0;
+    while (*s && !stop) {
+        if (*s == '\\' && s[1]) {
+            char c;
+            s = escape(s + 1, &c, 0, &stop);
+            if (!stop) {
+                putchar(c);
+            }
+        } else {
+            putchar(*s++);
+        }
+    }
+    return stop;
+}
+
+int exec_keeps_redirections;
+
+static int builtin_exec(char **args) {
+    // exec [cmd args...]: replace the shell with cmd
+    // without one the command's redirections stay on the shell's fds (run_builtin)
+    if (!args[1]) {
+        exec_keeps_redirections = 1;
+        return 0;
+    }
+    fflush(stdout);
+
+    // cmd starts with the signals a spawned child would get, the shell's come back if it fails
+    static const int reset[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE };
+    enum { NRESET = sizeof(reset) / sizeof(reset[0]) };
+    struct sigaction dfl = { .sa_handler = SIG_DFL }, old[NRESET];
+    sigset_t old_mask;
+    for (int i = 0; i < NRESET; i++) {
+        sigaction(reset[i], &dfl, &old[i]);
+    }
+    sigprocmask(SIG_SETMASK, events_child_mask(), &old_mask);
+
+    const char *path = cmdhash_lookup(args[1]);
+    if (path) {
+        execv(path, args + 1);
+    } else {
+        errno = ENOENT;
+    }
+    int err = errno;
+
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    for (int i = 0; i < NRESET; i++) {
+        sigaction(reset[i], &old[i], NULL);
+    }
+    if (err == ENOENT) {
+        fprintf(stderr, "Command not found: %s\n", args[1]);
+        return 127;
+    }
+    fprintf(stderr, "exec: %s: %s\n", args[1], strerror(err));
+    return 126;
+}
+
+static int builtin_echo(char **args) {
+    // echo [-neE] args..., like bash: -n no newline, -e interpret escapes
+    int newline = 1, escapes = 0;
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        const char *o = args[i] + 1;
+        if (strspn(o, "neE") != strlen(o)) {
+            break;  // not an option, print it
+        }
+        for (; *o; o++) {
+            if (*o == 'n') {
+                newline = 0;
+            } else {
+                escapes = (*o == 'e');
+            }
+        }
+    }
+
+    for (int first = 1; args[i]; i++, first = 0) {
+        if (!first) {
+            putchar(' ');
+        }
+        if (escapes) {
+            if (print_escaped(args[i])) {
+                return 0;
+            }
+        } else {
+            fputs(args[i], stdout);
+        }
+    }
+    if (newline) {
+        putchar('\n');
+    }
+    return ferror(stdout) ? 1 : 0;
+}
+
+static int printf_number(const char *arg, long long *v) {
+    // printf numeric argument, 'c and "c give the character's value
+    if (arg[0] == '\'' || arg[0] == '"') {
+        *v = (unsigned char)arg[1];
+        return 0;
+    }
+    char *end;
+    errno = 0;
+    *v = strtoll(arg, &end, 0);
+    if (end == arg || *end || errno) {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
+static int builtin_printf(char **args) {
+    // printf format [args...], the format is reused until the arguments run out
+    if (!args[1]) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    const char *format = args[1];
+    char **argp = &args[2];
+    int status = 0;
+    int stop = 0;
+
+    do {
+        char **start = argp;
+        for (const char *p = format; *p && !stop; ) {
+            if (*p == '\\' && p[1]) {
+                char c;
+                p = escape(p + 1, &c, 1, &stop);
+                putchar(c);
+                continue;
+            }
+            if (*p != '%') {
+                putchar(*p++);
+                continue;
+            }
+            if (p[1] == '%') {
+                putchar('%');
+                p += 2;
+                continue;
+            }
+
+            // %[flags][width][.precision]conversion, '*' takes the value from the arguments
+            char spec[64];
+            size_t n = 0;
+            spec[n++] = *p++;
+            while (*p && strchr("-+ #0", *p) && n < 40) {
+                spec[n++] = *p++;
+            }
+            for (int part = 0; part < 2; part++) {
+                if (part == 1) {
+                    if (*p != '.') {
+                        break;
+                    }
+                    spec[n++] = *p++;
+                }
+                if (*p == '*') {
+                    long long v = 0;
+                    if (*argp && printf_number(*argp++, &v) < 0) {
+                        status = 1;
+                    }
+                    n += snprintf(spec + n, sizeof(spec) - n - 4, "%d", (int)v);
+                    p++;
+                } else {
+                    while (*p >= '0' && *p <= '9' && n < 50) {
+                        spec[n++] = *p++;
+                    }
+                }
+            }
+
+            char conv = *p;
+            if (!conv) {
+                fprintf(stderr, "printf: %s: missing conversion\n", format);
+                return 1;
+            }
+            p++;
+            const char *arg = *argp ? *argp++ : NULL;
+
+            switch (conv) {
+                case 's':
+                    spec[n++] = 's';
+                    spec[n] = '\0';
+                    printf(spec, arg ? arg : "");
+                    break;
+                case 'b':
+                    // argument with escapes, width and precision are not supported here
+                    if (arg && print_escaped(arg)) {
+                        stop = 1;
+                    }
+                    break;
+                case 'c':
+                    spec[n++] = 'c';
+                    spec[n] = '\0';
+                    printf(spec, arg ? arg[0] : '\0');
+                    break;
+                case 'd':
+                case 'i':
+                case 'o':
+                case 'u':
+                case 'x':
+                case 'X': {
+                    long long v = 0;
+                    if (arg && printf_number(arg, &v) < 0) {
+                        status = 1;
+                    }
+                    spec[n++] = 'l';
+                    spec[n++] = 'l';
+                    spec[n++] = conv;
+                    spec[n] = '\0';
+                    if (conv == 'd' || conv == 'i') {
+                        printf(spec, v);
+                    } else {
+                        printf(spec, (unsigned long long)v);
+                    }
+                    break;
+                }
+                case 'e':
+                case 'E':
+                case 'f':
+                case 'F':
+                case 'g':
+                case 'G':
+                case 'a':
+                case 'A': {
+                    double v = 0;
+                    if (arg) {
+                        char *end;
+                        v = strtod(arg, &end);
+                        if (end == arg || *end) {
+                            fprintf(stderr, "printf: %s: invalid number\n", arg);
+                            status = 1;
+                        }
+                    }
+                    spec[n++] = conv;
+                    spec[n] = '\0';
+                    printf(spec, v);
+                    break;
+                }
+                default:
+                    fprintf(stderr, "printf: %%%c: invalid conversion\n", conv);
+                    return 1;
+            }
+        }
+        // format used no arguments, don't loop forever
+        if (argp == start) {
+            break;
+        }
+    } while (*argp && !stop);
+
+    if (ferror(stdout)) {
+        return 1;
+    }
+    return status;
+}
+
+// test / [
+
+static int test_error;  // set on a usage or number error, test then returns 2
+
+static int is_binary_op(const char *s) {
+    static const char *ops[] = { "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le",
+                                 "-gt", "-ge", "-nt", "-ot", "-ef", NULL };
+    for (int i = 0; ops[i]; i++) {
+        if (strcmp(s, ops[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int is_unary_op(const char *s) {
+    return s[0] == '-' && s[1] && !s[2] && strchr("bcdefghknprsStuwxzLO", s[1]);
+}
+
+static long long test_integer(const char *s) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    while (*end == ' ' || *end == '\t') {
+        end++;
+    }
+    if (end == s || *end || errno) {
+        fprintf(stderr, "test: %s: integer expression expected\n", s);
+        test_error = 1;
+    }
+    return v;
+}
+
+static int test_unary(const char *op, const char *arg) {
+    struct stat st;
+    switch (op[1]) {
+        case 'n': return arg[0] != '\0';
+        case 'z': return arg[0] == '\0';
+        case 't': return isatty(atoi(arg));
+        case 'r': return access(arg, R_OK) == 0;
+        case 'w': return access(arg, W_OK) == 0;
+        case 'x': return access(arg, X_OK) == 0;
+        case 'h':
+        case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(arg, &st) < 0) {
+        return 0;
+    }
+    switch (op[1]) {
+        case 'e': return 1;
+        case 'f': return S_ISREG(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 'S': return S_ISSOCK(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'g': return (st.st_mode & S_ISGID) != 0;
+        case 'u': return (st.st_mode & S_ISUID) != 0;
+        case 'k': return (st.st_mode & S_ISVTX) != 0;
+        case 'O': return st.st_uid == geteuid();
+        case 'G': return st.st_gid == getegid();
+    }
+    return 0;
+}
+
+static int test_binary(const char *a, const char *op, const char *b) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+        return strcmp(a, b) == 0;
+    }
+    if (strcmp(op, "!=") == 0) {
+        return strcmp(a, b) != 0;
+    }
+    if (strcmp(op, "<") == 0) {
+        return strcmp(a, b) < 0;
+    }
+    if (strcmp(op, ">") == 0) {
+        return strcmp(a, b) > 0;
+    }
+    if (op[1] == 'n' || op[1] == 'o' || (op[1] == 'e' && op[2] == 'f')) {
+        // file comparisons, a missing file is older than any other
+        struct stat sa, sb;
+        int ha = stat(a, &sa) == 0, hb = stat(b, &sb) == 0;
+        if (op[1] == 'e') {
+            return ha && hb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+        }
+        if (op[1] == 'n') {
+            return ha && (!hb || sa.st_mtim.tv_sec > sb.st_mtim.tv_sec ||
+                          (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec));
+        }
+        return hb && (!ha || sa.st_mtim.tv_sec < sb.st_mtim.tv_sec ||
+                      (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec));
+    }
+
+    long long x = test_integer(a), y = test_integer(b);
+    if (strcmp(op, "-eq") == 0) return x == y;
+    if (strcmp(op, "-ne") == 0) return x != y;
+    if (strcmp(op, "-lt") == 0) return x < y;
+    if (strcmp(op, "-le") == 0) return x <= y;
+    if (strcmp(op, "-gt") == 0) return x > y;
+    return x >= y;
+}
+
+static int test_or(char **args, int *pos, int end);
+
+static int test_primary(char **args, int *pos, int end) {
+    // ! expr, ( expr ), unary, binary or a plain string
+    int left = end - *pos;
+    if (left <= 0) {
+        fprintf(stderr, "test: argument expected\n");
+        test_error = 1;
+        return 0;
+    }
+    char **a = args + *pos;
+
+    // a binary operator in second place wins, so '! = x' compares strings
+    if (left >= 3 && is_binary_op(a[1])) {
+        *pos += 3;
+        return test_binary(a[0], a[1], a[2]);
+    }
+    if (strcmp(a[0], "!") == 0) {
+        (*pos)++;
+        return !test_primary(args, pos, end);
+    }
+    if (strcmp(a[0], "(") == 0 && left >= 2) {
+        (*pos)++;
+        int v = test_or(args, pos, end);
+        if (*pos >= end || strcmp(args[*pos], ")") != 0) {
+            fprintf(stderr, "test: ')' expected\n");
+            test_error = 1;
+            return 0;
+        }
+        (*pos)++;
+        return v;
+    }
+    if (left >= 2 && is_unary_op(a[0])) {
+        *pos += 2;
+        return test_unary(a[0], a[1]);
+    }
+    (*pos)++;
+    return a[0][0] != '\0';
+}
+
+static int test_and(char **args, int *pos, int end) {
+    int v = test_primary(args, pos, end);
+    while (*pos < end && strcmp(args[*pos], "-a") == 0) {
+        (*pos)++;
+        int rhs = test_primary(args, pos, end);
+        v = v && rhs;
+    }
+    return v;
+}
+
+static int test_or(char **args, int *pos, int end) {
+    int v = test_and(args, pos, end);
+    while (*pos < end && strcmp(args[*pos], "-o") == 0) {
+        (*pos)++;
+        int rhs = test_and(args, pos, end);
+        v = v || rhs;
+    }
+    return v;
+}
+
+static int builtin_test(char **args) {
+    // test expr / [ expr ], 0 true, 1 false, 2 on error
+    int end = 0;
+    while (args[end]) {
+        end++;
+    }
+    if (strcmp(args[0], "[") == 0) {
+        if (strcmp(args[end - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        end--;
+    }
+
+    if (end == 1) {
+        return 1;   // no expression is false
+    }
+
+    test_error = 0;
+    int pos = 1;
+    int v = test_or(args, &pos, end);
+    if (!test_error && pos < end) {
+        fprintf(stderr, "test: %s: unexpected argument\n", args[pos]);
+        test_error = 1;
+    }
+    if (test_error) {
+        return 2;
+    }
+    return v ? 0 : 1;
+}
+
+static int builtin_set(char **args) {
+    // set -o              list options
+    // set -o trace=FILE   write a Chrome trace of every command to FILE
+    // set +o trace        stop tracing
+    if (!args[1] || (strcmp(args[1], "-o") == 0 && !args[2])) {
+        const char *path = trace_path();
+        printf("trace\t%s\n", path ? path : "off");
+        return 0;
+    }
+    if (!args[2]) {
+        fprintf(stderr, "set: usage: set -o trace=FILE | set +o trace\n");
+        return 2;
+    }
+
+    if (strcmp(args[1], "-o") == 0 && strncmp(args[2], "trace=", 6) == 0 && args[2][6]) {
+        return trace_open(args[2] + 6) < 0 ? 1 : 0;
+    }
+    if (strcmp(args[1], "+o") == 0 && strcmp(args[2], "trace") == 0) {
+        trace_close();
+        return 0;
+    }
+    fprintf(stderr, "set: %s: invalid option\n", args[2]);
+    return 2;
+}
+
+static int builtin_shstats(char **args) {
+    // shstats           counters and latency percentiles
+    // shstats -p        the same in Prometheus text format
+    // shstats -o FILE   write the Prometheus format to FILE on exit and on SIGUSR1
+    // shstats +o        stop writing FILE
+    // shstats -r        reset the counters
+    if (!args[1]) {
+        stats_print(stdout);
+        const char *path = stats_path();
+        if (path) {
+            printf("file\t\t%s\n", path);
+        }
+        return 0;
+    }
+    if (strcmp(args[1], "-p") == 0 && !args[2]) {
+        stats_prometheus(stdout);
+        return 0;
+    }
+    if (strcmp(args[1], "-o") == 0 && args[2] && !args[3]) {
+        return stats_open(args[2]) < 0 ? 1 : 0;
+    }
+    if (strcmp(args[1], "+o") == 0 && !args[2]) {
+        stats_close();
+        return 0;
+    }
+    if (strcmp(args[1], "-r") == 0 && !args[2]) {
+        stats_reset();
+        return 0;
+    }
+    fprintf(stderr, "shstats: usage: shstats [-p | -r | -o FILE | +o]\n");
+    return 2;
+}
+
+static int group_members(pid_t pgid, pid_t **pids) {
+    // every process in process group pgid, from /proc, so a job's grandchildren count too
+    DIR *dir = opendir("/proc");
+    if (!dir) {
+        return -1;
+    }
+    int n = 0, cap = 0;
+    *pids = NULL;
+    struct dirent *e;
+    while ((e = readdir(dir))) {
+        if (e->d_name[0] < '1' || e->d_name[0] > '9') {
+            continue;
+        }
+        char path[64], stat[512];
+        snprintf(path, sizeof(path), "/proc/%.20s/stat", e->d_name);    // a pid, never longer
+        FILE *f = fopen(path, "re");
+        if (!f) {
+            continue;   // already gone
+        }
+        size_t len = fread(stat, 1, sizeof(stat) - 1, f);
+        fclose(f);
+        stat[len] = '\0';
+        // "pid (comm) state ppid pgrp ...", comm may contain anything
+        char *p = strrchr(stat, ')');
+        int ppid, pgrp;
+        if (!p || sscanf(p + 1, " %*c %d %d", &ppid, &pgrp) != 2 || pgrp != pgid) {
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : 16;
+            pid_t *grown = realloc(*pids, cap * sizeof(pid_t));
+            if (!grown) {
+                break;
+            }
+            *pids = grown;
+        }
+        (*pids)[n++] = atoi(e->d_name);
+    }
+    closedir(dir);
+    return n;
+}
+
+static int builtin_limit(char **args) {
+    // limit %job|PID          show cpu/as/nofile/nproc of each process
+    // limit %job|PID SPEC     change them with prlimit, SPEC as for 'rlimit' (rlimits.h)
+    // a job is every process in its process group, or its stages without job control
+    if (!args[1] || (args[2] && args[3])) {
+        fprintf(stderr, "limit: usage: limit %%job|PID [name=value,...]\n");
+        return 2;
+    }
+    rlimits_t limits;
+    if (args[2] && rlimits_parse(args[2], &limits, "limit") < 0) {
+        return 2;
+    }
+
+    pid_t *pids = NULL;
+    int n = 0;
+    if (args[1][0] == '%') {
+        job_t *job = find_job_spec(args[1]);
+        if (!job || job->state == DONE) {
+            fprintf(stderr, "limit: %s: no such job\n", args[1]);
+            return 1;
+        }
+        if (job_control && job->pgid > 0) {
+            n = group_members(job->pgid, &pids);
+        } else if ((pids = malloc(job->nprocs * sizeof(pid_t)))) {
+            for (int i = 0; i < job->nprocs; i++) {
+                if (job->procs[i].state != DONE) {
+                    pids[n++] = job->procs[i].pid;
+                }
+            }
+        } else {
+            n = -1;
+        }
+    } else {
+        char *end;
+        long pid = strtol(args[1], &end, 10);
+        if (*end || pid <= 0) {
+            fprintf(stderr, "limit: %s: expected %%job or a process ID\n", args[1]);
+            return 2;
+        }
+        if (kill(pid, 0) < 0 && errno == ESRCH) {
+            fprintf(stderr, "limit: %ld: no such process\n", pid);
+            return 1;
+        }
+        if ((pids = malloc(sizeof(pid_t)))) {
+            pids[n++] = pid;
+        } else {
+            n = -1;
+        }
+    }
+    if (n < 0) {
+        perror("limit");
+        free(pids);
+        return 1;
+    }
+
+    int status = 0;
+    for (int i = 0; i < n; i++) {
+        if (args[2]) {
+            status |= rlimits_set_pid(pids[i], &limits) < 0;
+        } else {
+            rlimits_show_pid(pids[i]);
+        }
+    }
+    free(pids);
+    return status;
+}
+
+static int builtin_unset(char **args) {
+    // unset -f NAME... forgets functions, anything else is for variables
+    if (args[1] && strcmp(args[1], "-f") == 0) {
+        return unset_functions(args + 2);
+    }
+    return run_unset(args);
+}
+
+static char *read_line(int fd, size_t *len) {
+    // one line from fd without its newline, NULL at end of input with nothing read
+    // never reads past the line so the next command gets the rest: a seekable fd
+    // is read in chunks and seeked back to just after the newline, a pipe byte by byte
+    int seekable = lseek(fd, 0, SEEK_CUR) >= 0;
+    size_t cap = 256, n = 0;
+    char *buf = malloc(cap);
+    int newline = 0;
+    while (buf && !newline) {
+        if (cap - n < 2) {
+            char *grown = realloc(buf, cap * 2);
+            if (!grown) {
+                break;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        ssize_t r = read(fd, buf + n, seekable ? cap - n - 1 : 1);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            break;
+        }
+        char *nl = memchr(buf + n, '\n', r);
+        if (nl) {
+            newline = 1;
+            if (seekable) {
+                lseek(fd, -(off_t)(buf + n + r - (nl + 1)), SEEK_CUR);
+            }
+            r = nl - (buf + n);
+        }
+        n += r;
+    }
+    if (buf && n == 0 && !newline) {
+        free(buf);
+        return NULL;
+    }
+    if (buf) {
+        buf[n] = '\0';
+        *len = n;
+    }
+    return buf;
+}
+
+static int builtin_read(char **args) {
+    // read [-r] NAME...   one line split on blanks, the last NAME gets the rest
+    // without -r a backslash keeps the next character as it is and a line
+    // ending in one goes on with the next
+    int raw = args[1] && strcmp(args[1], "-r") == 0;
+    char **names = args + 1 + raw;
+    if (!names[0]) {
+        fprintf(stderr, "read: usage: read [-r] NAME...\n");
+        return 2;
+    }
+    for (char **name = names; *name; name++) {
+        if (var_name_len(*name) != strlen(*name)) {
+            fprintf(stderr, "read: %s: not a valid name\n", *name);
+            return 2;
+        }
+    }
+
+    // the logical line, with a mark on each character a backslash protects from splitting
+    char *text = NULL, *quoted = NULL;
+    size_t n = 0;
+    int status = 1;
+    for (;;) {
+        size_t len;
+        char *line = read_line(STDIN_FILENO, &len);
+        if (!line) {
+            break;
+        }
+        status = 0;
+        char *grown_text = realloc(text, n + len + 1);
+        text = grown_text ? grown_text : text;
+        char *grown_quoted = grown_text ? realloc(quoted, n + len + 1) : NULL;
+        quoted = grown_quoted ? grown_quoted : quoted;
+        if (!grown_quoted) {
+            free(line);
+            status = -1;
+            break;
+        }
+        int joined = 0;
+        for (size_t i = 0; i < len; i++) {
+            int escaped = !raw && line[i] == '\\';
+            if (escaped && ++i == len) {
+                joined = 1;
+                break;
+            }
+            quoted[n] = escaped;
+            text[n++] = line[i];
+        }
+        free(line);
+        if (!joined) {
+            break;
+        }
+    }
+    if (status < 0) {
+        fprintf(stderr, "read: out of memory\n");
+        free(text);
+        free(quoted);
+        return 1;
+    }
+
+    size_t i = 0;
+    for (char **name = names; *name; name++) {
+        while (i < n && !quoted[i] && (text[i] == ' ' || text[i] == '\t')) {
+            i++;
+        }
+        size_t start = i, end = i;
+        if (!name[1]) {
+            // the rest of the line, less trailing blanks
+            for (end = n; end > start && !quoted[end - 1] && (text[end - 1] == ' ' || text[end - 1] == '\t'); end--) {
+            }
+            i = n;
+        } else {
+            while (i < n && (quoted[i] || (text[i] != ' ' && text[i] != '\t'))) {
+                i++;
+            }
+            end = i;
+        }
+        char saved = text ? text[end] : 0;
+        if (text) {
+            text[end] = '\0';
+        }
+        if (var_set(*name, text ? text + start : "") < 0) {
+            fprintf(stderr, "read: %s: out of memory\n", *name);
+            status = 1;
+        }
+        if (text) {
+            text[end] = saved;
+        }
+    }
+    free(text);
+    free(quoted);
+    return status;
+}
+
+// sorted by name for bsearch
+static const builtin_t builtins[] = {
+    { ":",        builtin_true },
+    { "[",        builtin_test },
+    { "bg",       builtin_bg },
+    { "break",    run_break },
+    { "cd",       builtin_cd },
+    { "continue", run_break },
+    { "echo",     builtin_echo },
+    { "exec",     builtin_exec },
+    { "exit",     run_exit },
+    { "export",   run_export },
+    { "false",    builtin_false },
+    { "fg",       builtin_fg },
+    { "hash",     run_hash },
+    { "history",  run_history },
+    { "jobs",     builtin_jobs },
+    { "limit",    builtin_limit },
+    { "parallel", run_parallel },
+    { "printf",   builtin_printf },
+    { "pwd",      builtin_pwd },
+    { "read",     builtin_read },
+    { "return",   run_return },
+    { "set",      builtin_set },
+    { "shift",    run_shift },
+    { "shstats",  builtin_shstats },
+    { "test",     builtin_test },
+    { "true",     builtin_true },
+    { "ulimit",   run_ulimit },
+    { "unset",    builtin_unset },
+    { "wait",     run_wait },
+};
+
+static int compare_builtin(const void *key, const void *elem) {
+    return strcmp(key, ((const builtin_t *)elem)->name);
+}
+
+builtin_fn_t find_builtin(const char *name) {
+    // NULL if name is not a builtin, a shell function comes first
+    if (find_function(name)) {
+        return run_function;
+    }
+    const builtin_t *b = bsearch(name, builtins, sizeof(builtins) / sizeof(builtins[0]),
+                                 sizeof(builtin_t), compare_builtin);
+    return b ? b->fn : NULL;
+}
+
+void enter_subshell(void) {
+    // in a forked child of the shell that runs shell code rather than exec'ing
+    // the child has no job control and its own event loop for anything it starts itself
+    job_control = 0;
+    trace_enabled = 0;  // the trace and stats file belong to the parent
+    stats_forget();
+    jobs_forget_fds();
+    events_reset();
+    zygote_forget();
+}
+
+int run_builtin_child(char **args) {
+    // entry point in a forked child, for a builtin inside a pipeline or in the background
+    enter_subshell();
+
+    builtin_fn_t fn = find_builtin(args[0]);
+    int status = fn ? fn(args) : 127;
+    fflush(stdout);
+    return status;
+}
@@ -0,0 +1,16 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+// commands run by the shell itself instead of forking and exec'ing a binary
+// each takes the command's argv and returns its exit status
+
+typedef int (*builtin_fn_t)(char **args);
+
+builtin_fn_t find_builtin(const char *name);
+int run_builtin_child(char **args);
+void enter_subshell(void);
+
+// set by a lone 'exec', the redirections of the command running it are kept
+extern int exec_keeps_redirections;
+
+#endif
@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "server.h"
+
+static int send_request(int sock, const char *text, size_t len, const int *fds) {
+    union {
+        struct cmsghdr hdr;
+        char space[CMSG_SPACE(SERVER_NFDS * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = { (void *)text, len };
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.space, .msg_controllen = sizeof(control.space)
+    };
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(SERVER_NFDS * sizeof(int));
+    memcpy(CMSG_DATA(c), fds, SERVER_NFDS * sizeof(int));
+
+    ssize_t n;
+    while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+    }
+    return n < 0 ? -1 : 0;
+}
+
+int client_call(const char *path, const char *text, struct rusage *usage) {
+    // run text on the server at path with our stdin/out/err and cwd
+    // returns its status, -1 with errno set if it could not be asked or didn't answer
+    size_t len = strlen(text) + 1;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (len > SERVER_MAX_MSG) {
+        errno = E2BIG;
+        return -1;
+    }
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    int size = len + 4096;
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    // a closed stdin/out/err goes over as /dev/null
+    int fds[SERVER_NFDS];
+    int null_fd = -1;
+    for (int fd = 0; fd <= STDERR_FILENO; fd++) {
+        fds[fd] = fd;
+        if (fcntl(fd, F_GETFD) < 0) {
+            if (null_fd < 0) {
+                null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+            }
+            fds[fd] = null_fd;
+        }
+    }
+    fds[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+    int status = -1;
+    if (fds[3] >= 0 && connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+        send_request(sock, text, len, fds) == 0) {
+        server_reply_t reply;
+        ssize_t n;
+        while ((n = recv(sock, &reply, sizeof(reply), 0)) < 0 && errno == EINTR) {
+        }
+        if (n == sizeof(reply)) {
+            status = reply.status;
+            if (usage) {
+                *usage = reply.usage;
+            }
+        } else if (n >= 0) {
+            errno = ECONNRESET;     // the server went away before the job was done
+        }
+    }
+    int saved = errno;
+    if (fds[3] >= 0) {
+        close(fds[3]);
+    }
+    if (null_fd >= 0) {
+        close(null_fd);
+    }
+    close(sock);
+    errno = saved;
+    return status;
+}
+
+static void print_time(const char *label, long sec, long usec) {
+    fprintf(stderr, "%s\t%ldm%ld.%03lds\n", label, sec / 60, sec % 60, usec / 1000);
+}
+
+int client_main(int argc, char **argv) {
+    // yash --client SOCKET [-t] CMDS, argv starts at SOCKET
+    int timed = argc == 3 && strcmp(argv[1], "-t") == 0;
+    if (argc != 2 + timed) {
+        fprintf(stderr, "yash: usage: yash --client SOCKET [-t] COMMANDS\n");
+        return 2;
+    }
+
+    struct timespec start, end;
+    struct rusage usage;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int status = client_call(argv[0], argv[1 + timed], &usage);
+    if (status < 0) {
+        fprintf(stderr, "yash: %s: %s\n", argv[0], strerror(errno));
+        return 2;
+    }
+    if (timed) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        long sec = end.tv_sec - start.tv_sec;
+        long nsec = end.tv_nsec - start.tv_nsec;
+        if (nsec < 0) {
+            sec--;
+            nsec += 1000000000;
+        }
+        fprintf(stderr, "\n");
+        print_time("real", sec, nsec / 1000);
+        print_time("user", usage.ru_utime.tv_sec, usage.ru_utime.tv_usec);
+        print_time("sys", usage.ru_stime.tv_sec, usage.ru_stime.tv_usec);
+    }
+    return status;
+}
@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cmdhash.h"
+#include "vars.h"
+
+#define INITIAL_BUCKETS 64
+
+// one remembered command, path is NULL when it wasn't found on PATH
+typedef struct cmd_entry {
+    struct cmd_entry *next;
+    char *name;
+    char *path;
+    int hits;
+    int pinned;     // added with 'hash -p', kept until 'hash -r'
+    int dir;        // PATH directory it was found in, the last one if it wasn't found
+} cmd_entry_t;
+
+// a PATH directory and the mtime it had when entries were cached
+typedef struct {
+    char *dir;
+    struct timespec mtime;
+    unsigned checked;   // generation its mtime was last compared in
+} path_dir_t;
+
+static cmd_entry_t **buckets = NULL;
+static size_t nbuckets = 0;
+static size_t nentries = 0;
+
+static char *cached_path = NULL;    // PATH value the table was built for
+static path_dir_t *dirs = NULL;
+static int ndirs = 0;
+static unsigned generation = 1;     // bumped by cmdhash_expire(), once per command line
+
+static size_t hash_name(const char *name) {
+    // FNV-1a
+    size_t h = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void free_entry(cmd_entry_t *e) {
+    free(e->name);
+    free(e->path);
+    free(e);
+}
+
+static void flush_entries(int keep_pinned, int from_dir) {
+    // drop cached entries found in PATH directory from_dir or later (or not found),
+    // optionally keeping the ones added with -p
+    for (size_t b = 0; b < nbuckets; b++) {
+        cmd_entry_t **link = &buckets[b];
+        while (*link) {
+            cmd_entry_t *e = *link;
+            if ((keep_pinned && e->pinned) || (!e->pinned && e->dir < from_dir)) {
+                link = &e->next;
+                continue;
+            }
+            *link = e->next;
+            free_entry(e);
+            nentries--;
+        }
+    }
+}
+
+static void dir_mtime(const char *dir, struct timespec *mtime) {
+    struct stat st;
+    if (stat(*dir ? dir : ".", &st) == 0) {
+        *mtime = st.st_mtim;
+    } else {
+        mtime->tv_sec = -1;     // missing directory
+        mtime->tv_nsec = 0;
+    }
+}
+
+static void free_dirs(void) {
+    for (int i = 0; i < ndirs; i++) {
+        free(dirs[i].dir);
+    }
+    free(dirs);
+    dirs = NULL;
+    ndirs = 0;
+}
+
+static void load_path(const char *path) {
+    // split PATH into directories and snapshot their mtimes
+    free_dirs();
+    free(cached_path);
+    cached_path = strdup(path);
+
+    int count = 1;
+    for (const char *p = path; *p; p++) {
+        if (*p == ':') {
+            count++;
+        }
+    }
+    dirs = calloc(count, sizeof(path_dir_t));
+    if (!dirs) {
+        return;
+    }
+
+    const char *start = path;
+    for (;;) {
+        const char *end = strchrnul(start, ':');
+        dirs[ndirs].dir = strndup(start, end - start);    // empty entry means cwd
+        dir_mtime(dirs[ndirs].dir, &dirs[ndirs].mtime);
+        dirs[ndirs].checked = generation;
+        ndirs++;
+        if (*end == '\0') {
+            break;
+        }
+        start = end + 1;
+    }
+}
+
+static void validate(void) {
+    // drop the cache if PATH changed
+    const char *path = var_get("PATH");
+    if (!path) {
+        path = "/usr/local/bin:/usr/bin:/bin";
+    }
+
+    if (!cached_path || strcmp(cached_path, path) != 0) {
+        flush_entries(1, 0);
+        load_path(path);
+    }
+}
+
+static void check_dirs(int upto) {
+    // a file added to or removed from a directory changes its mtime; only directories
+    // up to the one a command was found in can shadow it, each is stat'ed at most
+    // once per command line, and a change drops the entries from that directory on
+    for (int i = 0; i <= upto && i < ndirs; i++) {
+        if (dirs[i].checked == generation) {
+            continue;
+        }
+        dirs[i].checked = generation;
+        struct timespec now;
+        dir_mtime(dirs[i].dir, &now);
+        if (now.tv_sec != dirs[i].mtime.tv_sec || now.tv_nsec != dirs[i].mtime.tv_nsec) {
+            dirs[i].mtime = now;
+            flush_entries(1, i);
+        }
+    }
+}
+
+static char *search_path(const char *name, int *dir) {
+    // first executable regular file called name on PATH, NULL if none
+    // *dir is the index of its directory, the last one if there is none
+    *dir = ndirs - 1;
+    size_t name_len = strlen(name);
+    for (int i = 0; i < ndirs; i++) {
+        size_t dir_len = strlen(dirs[i].dir);
+        char *full = malloc(dir_len + name_len + 2);
+        if (!full) {
+            return NULL;
+        }
+        if (dir_len == 0) {
+            memcpy(full, name, name_len + 1);
+        } else {
+            memcpy(full, dirs[i].dir, dir_len);
+            full[dir_len] = '/';
+            memcpy(full + dir_len + 1, name, name_len + 1);
+        }
+
+        struct stat st;
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) {
+            *dir = i;
+            return full;
+        }
+        free(full);
+    }
+    return NULL;
+}
+
+static cmd_entry_t *find_entry(const char *name, size_t h) {
+    if (!nbuckets) {
+        return NULL;
+    }
+    for (cmd_entry_t *e = buckets[h & (nbuckets - 1)]; e; e = e->next) {
+        if (strcmp(e->name, name) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static cmd_entry_t *find_valid_entry(const char *name, size_t h) {
+    // a cached entry that no directory change since it was made can have touched
+    cmd_entry_t *e = find_entry(name, h);
+    if (e && !e->pinned) {
+        check_dirs(e->dir);
+        e = find_entry(name, h);
+    }
+    return e;
+}
+
+static void grow_table(void) {
+    size_t new_n = nbuckets ? nbuckets * 2 : INITIAL_BUCKETS;
+    cmd_entry_t **new_b = calloc(new_n, sizeof(cmd_entry_t *));
+    if (!new_b) {
+        return;
+    }
+    for (size_t b = 0; b < nbuckets; b++) {
+        cmd_entry_t *e = buckets[b];
+        while (e) {
+            cmd_entry_t *next = e->next;
+            size_t slot = hash_name(e->name) & (new_n - 1);
+            e->next = new_b[slot];
+            new_b[slot] = e;
+            e = next;
+        }
+    }
+    free(buckets);
+    buckets = new_b;
+    nbuckets = new_n;
+}
+
+static cmd_entry_t *insert_entry(const char *name, char *path, int dir, size_t h) {
+    // takes ownership of path
+    if (nentries + 1 > nbuckets) {
+        grow_table();
+    }
+    cmd_entry_t *e = calloc(1, sizeof(cmd_entry_t));
+    if (!e || !nbuckets || !(e->name = strdup(name))) {
+        free(e);
+        free(path);
+        return NULL;
+    }
+    e->path = path;
+    e->dir = dir;
+    size_t slot = h & (nbuckets - 1);
+    e->next = buckets[slot];
+    buckets[slot] = e;
+    nentries++;
+    return e;
+}
+
+const char *cmdhash_lookup(const char *name) {
+    // resolve a command name without walking PATH when it was seen before
+    // names with a '/' are used as given, NULL means not found
+    if (strchr(name, '/')) {
+        return name;
+    }
+
+    validate();
+
+    size_t h = hash_name(name);
+    cmd_entry_t *e = find_valid_entry(name, h);
+    if (!e) {
+        // negative results are cached too; the walk below sees every directory as
+        // it is now, so their mtimes are taken now as well
+        check_dirs(ndirs - 1);
+        int dir;
+        char *path = search_path(name, &dir);
+        e = insert_entry(name, path, dir, h);
+        if (!e) {
+            return NULL;
+        }
+    }
+    if (e->path) {
+        e->hits++;
+    }
+    return e->path;
+}
+
+void cmdhash_forget(const char *name) {
+    size_t h = hash_name(name);
+    if (!nbuckets) {
+        return;
+    }
+    cmd_entry_t **link = &buckets[h & (nbuckets - 1)];
+    for (; *link; link = &(*link)->next) {
+        if (strcmp((*link)->name, name) == 0) {
+            cmd_entry_t *e = *link;
+            *link = e->next;
+            free_entry(e);
+            nentries--;
+            return;
+        }
+    }
+}
+
+void cmdhash_reset(void) {
+    flush_entries(0, 0);
+}
+
+void cmdhash_expire(void) {
+    // lookups from here on recheck the PATH directory mtimes, called once per command line
+    generation++;
+}
+
+int run_hash(char **args) {
+    // user runs 'hash'
+    // hash              list remembered commands
+    // hash -r           forget everything
+    // hash -d name...   forget names
+    // hash -p path name remember name as path
+    // hash -t name...   print the remembered path
+    // hash name...      look names up and remember them
+    int status = 0;
+
+    if (!args[1]) {
+        int printed = 0;
+        for (size_t b = 0; b < nbuckets; b++) {
+            for (cmd_entry_t *e = buckets[b]; e; e = e->next) {
+                if (!e->path) {
+                    continue;   // negative entries are internal
+                }
+                if (!printed++) {
+                    printf("hits\tcommand\n");
+                }
+                printf("%4d\t%s\n", e->hits, e->path);
+            }
+        }
+        if (!printed) {
+            printf("hash: hash table empty\n");
+        }
+        return 0;
+    }
+
+    if (strcmp(args[1], "-r") == 0) {
+        cmdhash_reset();
+        return 0;
+    }
+
+    if (strcmp(args[1], "-p") == 0) {
+        if (!args[2] || !args[3]) {
+            fprintf(stderr, "hash: usage: hash -p path name\n");
+            return 1;
+        }
+        validate();
+        cmdhash_forget(args[3]);
+        cmd_entry_t *e = insert_entry(args[3], strdup(args[2]), -1, hash_name(args[3]));
+        if (e) {
+            e->pinned = 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(args[1], "-d") == 0 || strcmp(args[1], "-t") == 0) {
+        int forget = (args[1][1] == 'd');
+        validate();
+        for (int i = 2; args[i]; i++) {
+            cmd_entry_t *e = find_valid_entry(args[i], hash_name(args[i]));
+            if (!e || !e->path) {
+                fprintf(stderr, "hash: %s: not found\n", args[i]);
+                status = 1;
+            } else if (forget) {
+                cmdhash_forget(args[i]);
+            } else {
+                printf("%s\n", e->path);
+            }
+        }
+        return status;
+    }
+
+    for (int i = 1; args[i]; i++) {
+        if (strchr(args[i], '/')) {
+            continue;
+        }
+        // search again even if it was cached, a lookup from here isn't a hit
+        cmdhash_forget(args[i]);
+        const char *path = cmdhash_lookup(args[i]);
+        if (!path) {
+            fprintf(stderr, "hash: %s: not found\n", args[i]);
+            status = 1;
+        } else {
+            find_entry(args[i], hash_name(args[i]))->hits = 0;
+        }
+    }
+    return status;
+}
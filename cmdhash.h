@@ -0,0 +1,12 @@
+#ifndef CMDHASH_H
+#define CMDHASH_H
+
+// remembered PATH lookups, command name -> resolved path
+
+const char *cmdhash_lookup(const char *name);
+void cmdhash_forget(const char *name);
+void cmdhash_reset(void);
+void cmdhash_expire(void);
+int run_hash(char **args);
+
+#endif
@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include "code.h"
+#include "expand.h"
+#include "events.h"
+#include "jobs.h"
+#include "vars.h"
+#include "wildcard.h"
+
+#define FUNCTION_BUCKETS 64     // power of two, chains stay short for any script's functions
+#define MAX_CALL_DEPTH 1000     // well before the C stack runs out
+#define POLL_EVERY 256          // loop iterations between looks for ctrl-c when nothing else waits
+
+// what is unwinding the code being run
+typedef enum {
+    SKIP_NONE,
+    SKIP_BREAK,
+    SKIP_CONTINUE,
+    SKIP_RETURN,
+    SKIP_EXIT,          // 'exit', everything stops and the shell or subshell ends
+    SKIP_INTERRUPT      // ctrl-c, everything up to the prompt stops
+} skip_t;
+
+// a loop or case of the code being run
+typedef struct {
+    char **words;       // for: the expanded words
+    int n;
+    int i;
+    const char *word;   // case: the expanded word
+    int status;         // loops: status of the last body, 0 if it never ran
+    arena_mark_t mark;  // scratch before the loop's own data
+    arena_mark_t body;  // scratch a body run leaves behind, dropped every iteration
+} slot_t;
+
+typedef struct function {
+    struct function *next;
+    function_def_t *def;
+} function_t;
+
+static arena_t scratch;     // expansions of the code being run, given back as it goes
+static skip_t skip = SKIP_NONE;
+static int skip_count;      // loops still to leave for break and continue
+static int exit_status;     // for exit
+static int loop_depth;      // loops running in the current function
+static int call_depth;
+static int nesting;         // code_run calls in progress
+static unsigned polls;
+
+static function_t *functions[FUNCTION_BUCKETS];
+static int nfunctions;
+
+static unsigned bucket(const char *name) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (; *name; name++) {
+        h ^= (unsigned char)*name;
+        h *= 16777619u;
+    }
+    return h & (FUNCTION_BUCKETS - 1);
+}
+
+static function_t **find(const char *name) {
+    // the link that holds name, or the NULL one at the end of its chain
+    function_t **p = &functions[bucket(name)];
+    while (*p && strcmp((*p)->def->name, name) != 0) {
+        p = &(*p)->next;
+    }
+    return p;
+}
+
+function_def_t *find_function(const char *name) {
+    if (!nfunctions) {
+        return NULL;
+    }
+    function_t *f = *find(name);
+    return f ? f->def : NULL;
+}
+
+static int define(function_def_t *fn) {
+    function_t **p = find(fn->name);
+    fn->refs++;
+    if (*p) {
+        function_release((*p)->def);
+        (*p)->def = fn;
+        return 0;
+    }
+    function_t *f = malloc(sizeof(function_t));
+    if (!f) {
+        function_release(fn);
+        fprintf(stderr, "yash: %s: out of memory\n", fn->name);
+        return 1;
+    }
+    f->next = NULL;
+    f->def = fn;
+    *p = f;
+    nfunctions++;
+    return 0;
+}
+
+int unset_functions(char **names) {
+    // unset -f NAME..., an unknown name is not an error
+    for (; *names; names++) {
+        function_t **p = find(*names);
+        function_t *f = *p;
+        if (f) {
+            *p = f->next;
+            function_release(f->def);
+            free(f);
+            nfunctions--;
+        }
+    }
+    return 0;
+}
+
+int run_function(char **args) {
+    // call a function, its arguments are $1... until it returns
+    function_def_t *fn = find_function(args[0]);
+    if (!fn) {
+        return 127;
+    }
+    if (call_depth >= MAX_CALL_DEPTH) {
+        fprintf(stderr, "yash: %s: functions nested too deeply\n", args[0]);
+        return 2;
+    }
+    // redefining or unsetting it while it runs leaves this call alone
+    fn->refs++;
+    char **saved_args = shell_args;
+    int saved_nargs = shell_nargs;
+    int saved_loops = loop_depth;
+    shell_args = args + 1;
+    for (shell_nargs = 0; shell_args[shell_nargs]; shell_nargs++) {
+    }
+    loop_depth = 0;
+    call_depth++;
+
+    int status = execute_pipeline(&scratch, fn->pl, NULL);
+
+    call_depth--;
+    loop_depth = saved_loops;
+    shell_args = saved_args;
+    shell_nargs = saved_nargs;
+    if (skip == SKIP_RETURN) {
+        skip = SKIP_NONE;
+    }
+    function_release(fn);
+    return status;
+}
+
+int run_break(char **args) {
+    // break [N] and continue [N]
+    int n = 1;
+    if (args[1]) {
+        n = atoi(args[1]);
+        if (n < 1) {
+            fprintf(stderr, "%s: %s: loop count out of range\n", args[0], args[1]);
+            return 1;
+        }
+    }
+    if (loop_depth == 0) {
+        fprintf(stderr, "%s: only meaningful in a loop\n", args[0]);
+        return 0;
+    }
+    skip = strcmp(args[0], "break") == 0 ? SKIP_BREAK : SKIP_CONTINUE;
+    skip_count = n < loop_depth ? n : loop_depth;
+    return 0;
+}
+
+int run_return(char **args) {
+    // return [N]
+    if (call_depth == 0) {
+        fprintf(stderr, "return: can only be used in a function\n");
+        return 1;
+    }
+    skip = SKIP_RETURN;
+    return args[1] ? atoi(args[1]) & 255 : shell_status;
+}
+
+int run_exit(char **args) {
+    // exit [N], N defaults to $?
+    int status = shell_status;
+    if (args[1]) {
+        char *end;
+        long n = strtol(args[1], &end, 10);
+        if (*end || end == args[1]) {
+            fprintf(stderr, "exit: %s: numeric argument required\n", args[1]);
+            n = 2;
+        } else if (args[2]) {
+            fprintf(stderr, "exit: too many arguments\n");
+            return 1;
+        }
+        status = n & 255;
+    }
+    skip = SKIP_EXIT;
+    exit_status = status;
+    return status;
+}
+
+int code_exiting(void) {
+    // whether 'exit' ran, the caller ends the shell with the status code_run returned
+    return skip == SKIP_EXIT;
+}
+
+static int interrupted(int status) {
+    // a foreground job killed by ctrl-c stops an interactive shell's loops too
+    return job_control && status == 128 + SIGINT;
+}
+
+static int run_pipeline_op(const pipeline_t *pl) {
+    arena_mark_t mark = arena_mark(&scratch);
+    int status = pl->timed ? run_time(&scratch, pl) : execute_pipeline(&scratch, pl, NULL);
+    arena_release(&scratch, mark);
+    return status;
+}
+
+static int match_patterns(const words_t *patterns, const char *word) {
+    // whether word matches one of a case item's patterns
+    arena_mark_t mark = arena_mark(&scratch);
+    int hit = 0;
+    for (int i = 0; i < patterns->n && !hit; i++) {
+        int status;
+        const char *p = patterns->raw && patterns->raw[i]
+                        ? expand_string(&scratch, patterns->words[i], 1, &status) : patterns->words[i];
+        if (!p) {
+            shell_status = status;
+            skip = interrupted(status) ? SKIP_INTERRUPT : skip;
+            break;
+        }
+        hit = wildcard_match(p, word) > 0;
+    }
+    arena_release(&scratch, mark);
+    return hit;
+}
+
+int code_run(const code_t *code) {
+    // run compiled code, returns $? at its end
+    // break, continue, return and ctrl-c unwind through here: this code's own
+    // loops take what is meant for them, the rest goes on to the caller
+    slot_t small_slots[8];
+    int small_open[8];
+    slot_t *slots = small_slots;
+    int *open = small_open;     // the OP_LOOP/OP_FOR of each loop running, innermost last
+    if (code->nslots > 8) {
+        slots = malloc(code->nslots * sizeof(slot_t));
+        open = malloc(code->nslots * sizeof(int));
+        if (!slots || !open) {
+            free(slots);
+            free(open);
+            fprintf(stderr, "yash: out of memory\n");
+            return shell_status = 1;
+        }
+    }
+    arena_mark_t entry = arena_mark(&scratch);
+    int depth = 0;
+    int pc = 0;
+    nesting++;
+
+    while (pc < code->nops) {
+        const instr_t *ins = &code->ops[pc++];
+        slot_t *slot = &slots[ins->slot];
+        int status;
+        switch (ins->op) {
+            case OP_RUN:
+                shell_status = run_pipeline_op(ins->pl);
+                if (interrupted(shell_status)) {
+                    skip = SKIP_INTERRUPT;
+                }
+                break;
+            case OP_NOT:
+                shell_status = !shell_status;
+                break;
+            case OP_STATUS:
+                shell_status = ins->arg;
+                break;
+            case OP_JUMP:
+                pc = ins->target;
+                break;
+            case OP_JUMP_FALSE:
+                if (shell_status != 0) {
+                    pc = ins->target;
+                }
+                break;
+            case OP_JUMP_TRUE:
+                if (shell_status == 0) {
+                    pc = ins->target;
+                }
+                break;
+            case OP_LOOP:
+                slot->status = 0;
+                slot->mark = slot->body = arena_mark(&scratch);
+                open[depth++] = pc - 1;
+                loop_depth++;
+                break;
+            case OP_TEST:
+                if ((shell_status == 0) == (ins->arg != 0)) {
+                    shell_status = slot->status;
+                    pc = ins->target;
+                }
+                break;
+            case OP_FOR:
+                slot->status = 0;
+                slot->i = 0;
+                slot->mark = arena_mark(&scratch);
+                slot->words = expand_words(&scratch, ins->words->words, ins->words->raw, ins->words->n,
+                                           &slot->n, &status);
+                slot->body = arena_mark(&scratch);
+                open[depth++] = pc - 1;
+                loop_depth++;
+                if (!slot->words) {
+                    // nothing to go over, the loop fails like its expansion did
+                    slot->n = 0;
+                    slot->status = status;
+                    skip = interrupted(status) ? SKIP_INTERRUPT : skip;
+                }
+                break;
+            case OP_FOR_NEXT:
+                if (slot->i == slot->n) {
+                    shell_status = slot->status;
+                    pc = ins->target;
+                } else if (var_set(ins->words->var, slot->words[slot->i++]) < 0) {
+                    fprintf(stderr, "yash: %s: out of memory\n", ins->words->var);
+                    shell_status = 1;
+                    pc = ins->target;
+                }
+                break;
+            case OP_NEXT:
+                slot->status = shell_status;
+                arena_release(&scratch, slot->body);
+                pc = ins->target;
+                if (job_control && ++polls % POLL_EVERY == 0 && events_poll() < 0) {
+                    skip = SKIP_INTERRUPT;
+                }
+                break;
+            case OP_DONE:
+                depth--;
+                loop_depth--;
+                arena_release(&scratch, slots[code->ops[open[depth]].slot].mark);
+                break;
+            case OP_CASE:
+                slot->word = ins->words->raw ? expand_string(&scratch, ins->words->words[0], 0, &status)
+                                             : ins->words->words[0];
+                if (!slot->word) {
+                    shell_status = status;
+                    skip = interrupted(status) ? SKIP_INTERRUPT : skip;
+                    pc = ins->target;
+                } else {
+                    shell_status = 0;
+                }
+                break;
+            case OP_MATCH:
+                if (!match_patterns(ins->words, slot->word)) {
+                    pc = ins->target;
+                }
+                break;
+            case OP_FUNCTION:
+                shell_status = define(ins->fn);
+                break;
+        }
+        if (skip == SKIP_NONE) {
+            continue;
+        }
+
+        // unwinding: loops of this code that are left for good
+        int loop_skip = (skip == SKIP_BREAK || skip == SKIP_CONTINUE);
+        int here = loop_skip && skip_count <= depth;
+        int leave = here ? skip_count - 1 : depth;
+        for (int i = 0; i < leave; i++) {
+            depth--;
+            loop_depth--;
+            arena_release(&scratch, slots[code->ops[open[depth]].slot].mark);
+        }
+        if (!here) {
+            skip_count -= loop_skip ? leave : 0;
+            break;
+        }
+        // break goes to the loop's OP_DONE, continue to its OP_NEXT
+        const instr_t *loop = &code->ops[open[depth - 1]];
+        pc = (skip == SKIP_BREAK) ? loop->target : loop->arg;
+        skip = SKIP_NONE;
+    }
+
+    arena_release(&scratch, entry);
+    if (skip == SKIP_EXIT) {
+        shell_status = exit_status;
+    }
+    if (--nesting == 0 && skip != SKIP_EXIT) {
+        // whatever unwound this far stops at the prompt, exit goes on to main
+        skip = SKIP_NONE;
+    }
+    if (slots != small_slots) {
+        free(slots);
+        free(open);
+    }
+    return shell_status;
+}
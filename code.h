@@ -0,0 +1,30 @@
+#ifndef CODE_H
+#define CODE_H
+
+#include <sys/resource.h>
+#include "arena.h"
+#include "parse.h"
+
+// runs what parse_line compiled: the control flow here, every pipeline through
+// execute_pipeline, and the shell functions the code defines
+//   break [N], continue [N]     leave or go on with the Nth enclosing loop
+//   return [N]                  leave the running function, N defaults to $?
+//   exit [N]                    leave everything, the shell or the subshell ends with N
+//   unset -f NAME...            forget functions
+// a function is called like a command and wins over a builtin of the same name,
+// its arguments are $1... while it runs
+
+int code_run(const code_t *code);
+function_def_t *find_function(const char *name);
+int run_function(char **args);
+int unset_functions(char **names);
+int run_break(char **args);
+int run_return(char **args);
+int run_exit(char **args);
+int code_exiting(void);
+
+// run one pipeline, with 'time' (yash.c)
+int execute_pipeline(arena_t *arena, const pipeline_t *pl, struct rusage *usage);
+int run_time(arena_t *arena, const pipeline_t *pl);
+
+#endif
@@ -0,0 +1,592 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include "edit.h"
+#include "history.h"
+#include "events.h"
+#include "trace.h"
+
+#define CTRL_KEY(c) ((c) & 0x1f)
+#define QUERY_MAX 256
+#define ESC_TIMEOUT_MS 50   // a lone ESC if nothing follows within this
+
+// keys beyond single bytes, from escape sequences
+enum {
+    KEY_INTR = -2,      // SIGINT while waiting
+    KEY_EOF = -1,
+    KEY_NONE = 256,     // nothing, or a sequence we don't handle
+    KEY_UP,
+    KEY_DOWN,
+    KEY_LEFT,
+    KEY_RIGHT,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE,
+    KEY_ESC
+};
+
+static struct termios saved_termios;
+
+// the line being edited, always NUL terminated
+static char *buf = NULL;
+static size_t len = 0;
+static size_t cap = 0;
+static size_t cursor = 0;
+
+// what was typed before browsing into the history
+static char *scratch = NULL;
+static size_t scratch_len = 0;
+static size_t scratch_cap = 0;
+
+static long browse;         // entry shown, history_count() is the line being typed
+static const char *prompt;
+static int pending_key = KEY_NONE;  // ended a search, handled as if typed next
+
+// a redraw is assembled here and written at once
+static char *out = NULL;
+static size_t out_len = 0;
+static size_t out_cap = 0;
+
+int edit_supported(int fd) {
+    // a terminal that takes ANSI escapes
+    const char *term = getenv("TERM");
+    return isatty(fd) && term && *term && strcmp(term, "dumb") != 0;
+}
+
+static int reserve(char **p, size_t *capp, size_t need) {
+    if (need <= *capp) {
+        return 0;
+    }
+    size_t n = *capp ? *capp : 256;
+    while (n < need) {
+        n *= 2;
+    }
+    char *bigger = realloc(*p, n);
+    if (!bigger) {
+        return -1;
+    }
+    *p = bigger;
+    *capp = n;
+    return 0;
+}
+
+static void out_add(const char *s, size_t n) {
+    if (reserve(&out, &out_cap, out_len + n) == 0) {
+        memcpy(out + out_len, s, n);
+        out_len += n;
+    }
+}
+
+static void out_str(const char *s) {
+    out_add(s, strlen(s));
+}
+
+static void out_flush(void) {
+    size_t done = 0;
+    while (done < out_len) {
+        ssize_t n = write(STDOUT_FILENO, out + done, out_len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    out_len = 0;
+}
+
+static size_t columns(const char *s, size_t n) {
+    // terminal columns of n bytes of UTF-8, one per character
+    size_t cols = 0;
+    for (size_t i = 0; i < n; i++) {
+        if ((s[i] & 0xc0) != 0x80) {
+            cols++;
+        }
+    }
+    return cols;
+}
+
+static size_t skip_columns(const char *s, size_t n, size_t cols) {
+    // bytes of s that make up its first cols columns
+    size_t i = 0;
+    while (i < n) {
+        if ((s[i] & 0xc0) != 0x80) {
+            if (cols == 0) {
+                break;
+            }
+            cols--;
+        }
+        i++;
+    }
+    return i;
+}
+
+static size_t term_width(void) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) {
+        return ws.ws_col;
+    }
+    return 80;
+}
+
+static void move_to_column(size_t col) {
+    char seq[32];
+    out_str("\r");
+    if (col > 0) {
+        snprintf(seq, sizeof(seq), "\x1b[%zuC", col);
+        out_str(seq);
+    }
+}
+
+static void refresh(void) {
+    // redraw prompt and line, scrolled sideways to keep the cursor on screen
+    size_t plen = columns(prompt, strlen(prompt));
+    size_t width = term_width();
+    width = (width > plen + 1) ? width - plen - 1 : 1;
+
+    size_t cursor_col = columns(buf, cursor);
+    size_t first_col = (cursor_col >= width) ? cursor_col - width + 1 : 0;
+    size_t start = skip_columns(buf, len, first_col);
+    size_t shown = skip_columns(buf + start, len - start, width);
+
+    out_str("\r");
+    out_str(prompt);
+    out_add(buf + start, shown);
+    out_str("\x1b[K");
+    move_to_column(plen + cursor_col - first_col);
+    out_flush();
+}
+
+static void refresh_search(const char *query, size_t qlen, long match, int failed) {
+    // (reverse-i-search)`query': matched entry, cursor on the match
+    const char *text = buf;
+    size_t text_len = len;
+    if (match >= 0) {
+        text = history_get(match, &text_len);
+    }
+
+    const char *title = failed ? "(failed reverse-i-search)`" : "(reverse-i-search)`";
+    out_str("\r");
+    out_str(title);
+    out_add(query, qlen);
+    out_str("': ");
+    size_t label = strlen(title) + columns(query, qlen) + 3;
+
+    size_t width = term_width();
+    width = (width > label + 1) ? width - label - 1 : 1;
+    size_t shown = skip_columns(text, text_len, width);
+    out_add(text, shown);
+    out_str("\x1b[K");
+
+    const char *at = (qlen > 0) ? memmem(text, shown, query, qlen) : NULL;
+    move_to_column(label + (at ? columns(text, at - text) : columns(text, shown)));
+    out_flush();
+}
+
+static int input_pending(int fd) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+static int read_byte(int fd, int wait) {
+    // next byte from the terminal, children are reaped while waiting
+    // without wait gives up after ESC_TIMEOUT_MS, for the rest of an escape sequence
+    unsigned char c;
+    for (;;) {
+        if (wait) {
+            if (events_wait(fd) < 0) {
+                return KEY_INTR;
+            }
+        } else {
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            if (poll(&pfd, 1, ESC_TIMEOUT_MS) <= 0) {
+                return KEY_NONE;
+            }
+        }
+        ssize_t n = read(fd, &c, 1);
+        if (n == 1) {
+            return c;
+        }
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        return KEY_EOF;
+    }
+}
+
+static int next_key(int fd) {
+    // one byte at a time, so nothing typed ahead for the next command is swallowed
+    if (pending_key != KEY_NONE) {
+        int key = pending_key;
+        pending_key = KEY_NONE;
+        return key;
+    }
+
+    int c = read_byte(fd, 1);
+    if (c != 27) {
+        return c;
+    }
+    int c1 = read_byte(fd, 0);
+    if (c1 == KEY_NONE) {
+        return KEY_ESC;
+    }
+    if (c1 != '[' && c1 != 'O') {
+        return KEY_NONE;    // meta-key, not bound
+    }
+
+    // CSI: optional numeric parameters, then a final byte
+    // modifiers after a ';' are ignored, only the key itself matters
+    int param = 0, first = 1;
+    int c2;
+    while ((c2 = read_byte(fd, 0)) != KEY_NONE && ((c2 >= '0' && c2 <= '9') || c2 == ';')) {
+        if (c2 == ';') {
+            first = 0;
+        } else if (first) {
+            param = param * 10 + (c2 - '0');
+        }
+    }
+    switch (c2) {
+        case 'A':
+            return KEY_UP;
+        case 'B':
+            return KEY_DOWN;
+        case 'C':
+            return KEY_RIGHT;
+        case 'D':
+            return KEY_LEFT;
+        case 'H':
+            return KEY_HOME;
+        case 'F':
+            return KEY_END;
+        case '~':
+            if (param == 1 || param == 7) {
+                return KEY_HOME;
+            }
+            if (param == 4 || param == 8) {
+                return KEY_END;
+            }
+            if (param == 3) {
+                return KEY_DELETE;
+            }
+            return KEY_NONE;
+        default:
+            return KEY_NONE;
+    }
+}
+
+static void set_text(const char *s, size_t n) {
+    if (reserve(&buf, &cap, n + 1) < 0) {
+        return;
+    }
+    memmove(buf, s, n);
+    len = cursor = n;
+    buf[len] = '\0';
+}
+
+static void insert_byte(char c) {
+    if (reserve(&buf, &cap, len + 2) < 0) {
+        return;
+    }
+    memmove(buf + cursor + 1, buf + cursor, len - cursor);
+    buf[cursor++] = c;
+    buf[++len] = '\0';
+}
+
+static void delete_range(size_t from, size_t to) {
+    memmove(buf + from, buf + to, len - to);
+    len -= to - from;
+    buf[len] = '\0';
+    if (cursor > to) {
+        cursor -= to - from;
+    } else if (cursor > from) {
+        cursor = from;
+    }
+}
+
+static size_t char_before(size_t pos) {
+    // start of the character before pos
+    if (pos == 0) {
+        return 0;
+    }
+    pos--;
+    while (pos > 0 && (buf[pos] & 0xc0) == 0x80) {
+        pos--;
+    }
+    return pos;
+}
+
+static size_t char_after(size_t pos) {
+    // start of the character after the one at pos
+    if (pos >= len) {
+        return len;
+    }
+    pos++;
+    while (pos < len && (buf[pos] & 0xc0) == 0x80) {
+        pos++;
+    }
+    return pos;
+}
+
+static void browse_to(long i) {
+    // show history entry i in the line, history_count() brings back what was typed
+    long n = history_count();
+    if (i < 0 || i > n || i == browse) {
+        return;
+    }
+    if (browse >= n) {
+        if (reserve(&scratch, &scratch_cap, len + 1) < 0) {
+            return;
+        }
+        memcpy(scratch, buf, len);
+        scratch_len = len;
+    }
+    browse = i;
+    if (i == n) {
+        set_text(scratch, scratch_len);
+    } else {
+        size_t elen;
+        const char *e = history_get(i, &elen);
+        set_text(e, elen);
+    }
+}
+
+static int reverse_search(int fd) {
+    // ctrl-r, returns 1 to run the line, 0 to keep editing it, -1 if interrupted
+    // the search runs in steps between keystrokes so typing never waits on it
+    char query[QUERY_MAX] = "";
+    size_t qlen = 0;
+    history_search_t s;
+    long from = browse;     // older than the entry on screen
+    long match = -1;
+    int failed = 0, searching = 0;
+
+    char *orig = strndup(buf, len);
+    if (!orig) {
+        return 0;
+    }
+    refresh_search(query, qlen, match, failed);
+
+    for (;;) {
+        if (searching) {
+            int r = history_search_step(&s);
+            if (r < 0 && !input_pending(fd)) {
+                continue;
+            }
+            if (r >= 0) {
+                searching = 0;
+                if (r) {
+                    match = s.match;
+                    failed = 0;
+                } else {
+                    failed = 1;
+                }
+                refresh_search(query, qlen, match, failed);
+                continue;
+            }
+        }
+
+        int key = next_key(fd);
+        if (key == KEY_INTR || key == KEY_EOF) {
+            free(orig);
+            return -1;
+        }
+        if (key == CTRL_KEY('R')) {
+            // the next older match
+            if (qlen > 0 && match >= 0) {
+                history_search_start(&s, query, qlen, match);
+                searching = 1;
+            }
+        } else if (key == 127 || key == CTRL_KEY('H')) {
+            if (qlen > 0) {
+                qlen--;
+                failed = 0;
+                searching = 0;
+                if (qlen > 0) {
+                    history_search_start(&s, query, qlen, from);
+                    searching = 1;
+                }
+            }
+        } else if (key >= 0x20 && key < 256) {
+            // a longer query can only match where the shorter one did, or older
+            if (qlen < QUERY_MAX) {
+                query[qlen++] = key;
+                if (!failed || searching) {
+                    history_search_start(&s, query, qlen, match >= 0 ? match + 1 : from);
+                    searching = 1;
+                }
+            }
+        } else if (key == CTRL_KEY('G') || key == CTRL_KEY('C')) {
+            set_text(orig, strlen(orig));
+            free(orig);
+            return 0;
+        } else {
+            // anything else takes the match into the line, enter also runs it
+            if (match >= 0) {
+                browse_to(match);
+            }
+            free(orig);
+            if (key == '\r' || key == '\n') {
+                return 1;
+            }
+            if (key != KEY_ESC) {
+                pending_key = key;
+            }
+            return 0;
+        }
+        if (!searching && !input_pending(fd)) {
+            refresh_search(query, qlen, match, failed);
+        }
+    }
+}
+
+int edit_getline(int fd, const char *p, char **line) {
+    // read a line in raw mode, returns 1 for a line, 0 on ctrl-d at an empty line
+    // or EOF, -1 on ctrl-c (the line is dropped)
+    if (tcgetattr(fd, &saved_termios) < 0) {
+        return 0;
+    }
+    struct termios raw = saved_termios;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cflag |= CS8;
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    // TCSADRAIN, not TCSAFLUSH, so typeahead is kept
+    tcsetattr(fd, TCSADRAIN, &raw);
+
+    prompt = p;
+    if (reserve(&buf, &cap, 1) < 0) {
+        tcsetattr(fd, TCSADRAIN, &saved_termios);
+        return 0;
+    }
+    len = cursor = 0;
+    buf[0] = '\0';
+    browse = history_count();
+    pending_key = KEY_NONE;
+    refresh();
+
+    // nothing is running the shell's way, a good time to write out the trace
+    trace_idle(1);
+
+    int status = 1;
+    for (;;) {
+        int key = next_key(fd);
+        if (key == KEY_INTR) {
+            status = -1;
+            break;
+        }
+        if (key == KEY_EOF) {
+            status = len ? 1 : 0;
+            break;
+        }
+        if (key == '\r' || key == '\n') {
+            break;
+        }
+        if (key == CTRL_KEY('C')) {
+            cursor = len;
+            refresh();
+            out_str("^C");
+            out_flush();
+            status = -1;
+            break;
+        }
+        if (key == CTRL_KEY('D') && len == 0) {
+            status = 0;
+            break;
+        }
+        if (key == CTRL_KEY('R')) {
+            int r = reverse_search(fd);
+            if (r < 0) {
+                status = -1;
+                break;
+            }
+            refresh();
+            if (r) {
+                break;
+            }
+            continue;
+        }
+
+        switch (key) {
+            case CTRL_KEY('A'):
+            case KEY_HOME:
+                cursor = 0;
+                break;
+            case CTRL_KEY('E'):
+            case KEY_END:
+                cursor = len;
+                break;
+            case CTRL_KEY('B'):
+            case KEY_LEFT:
+                cursor = char_before(cursor);
+                break;
+            case CTRL_KEY('F'):
+            case KEY_RIGHT:
+                cursor = char_after(cursor);
+                break;
+            case CTRL_KEY('P'):
+            case KEY_UP:
+                browse_to(browse - 1);
+                break;
+            case CTRL_KEY('N'):
+            case KEY_DOWN:
+                browse_to(browse + 1);
+                break;
+            case 127:
+            case CTRL_KEY('H'):
+                delete_range(char_before(cursor), cursor);
+                break;
+            case CTRL_KEY('D'):
+            case KEY_DELETE:
+                delete_range(cursor, char_after(cursor));
+                break;
+            case CTRL_KEY('K'):
+                delete_range(cursor, len);
+                break;
+            case CTRL_KEY('U'):
+                delete_range(0, cursor);
+                break;
+            case CTRL_KEY('W'): {
+                // the word before the cursor and the blanks after it
+                size_t start = cursor;
+                while (start > 0 && buf[start - 1] == ' ') {
+                    start--;
+                }
+                while (start > 0 && buf[start - 1] != ' ') {
+                    start--;
+                }
+                delete_range(start, cursor);
+                break;
+            }
+            case CTRL_KEY('L'):
+                out_str("\x1b[H\x1b[2J");
+                break;
+            default:
+                if (key >= 0x20 && key < 256 && key != 127) {
+                    insert_byte(key);
+                }
+                break;
+        }
+        // a paste is drawn once at the end, not per byte
+        if (!input_pending(fd)) {
+            refresh();
+        }
+    }
+
+    if (status == 1) {
+        cursor = len;
+        refresh();
+        out_str("\n");
+        out_flush();
+    }
+    tcsetattr(fd, TCSADRAIN, &saved_termios);
+    *line = buf;
+    return status;
+}
@@ -0,0 +1,11 @@
+#ifndef EDIT_H
+#define EDIT_H
+
+// raw-mode line editor for an interactive terminal: cursor movement, kill
+// commands, history browsing and reverse incremental search (ctrl-r)
+// needs a terminal that understands ANSI escapes, TERM=dumb keeps the plain reader
+
+int edit_supported(int fd);
+int edit_getline(int fd, const char *prompt, char **line);
+
+#endif
@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include "events.h"
+#include "fdtable.h"
+#include "jobs.h"
+#include "stats.h"
+
+#define MAX_EVENTS 64
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static int input_fd = -1;       // fd currently registered for events_wait
+static int input_pollable = 1;
+static sigset_t child_mask;     // mask the shell started with, children exec with it
+
+int events_init(int interactive) {
+    // route SIGCHLD, and SIGINT/SIGTSTP for an interactive shell, through a signalfd
+    // a script keeps the default SIGINT/SIGTSTP so ctrl-c stops it like any other program
+    // SIGUSR1 writes out the stats file
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGUSR1);
+    if (interactive) {
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTSTP);
+    }
+    if (sigprocmask(SIG_BLOCK, &mask, &child_mask) < 0) {
+        perror("sigprocmask");
+        return -1;
+    }
+
+    signal_fd = fd_shell(signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC));
+    if (signal_fd < 0) {
+        perror("signalfd");
+        return -1;
+    }
+
+    epoll_fd = fd_shell(epoll_create1(EPOLL_CLOEXEC));
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = signal_fd };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+void events_reset(void) {
+    // a forked child of the shell must not share the parent's epoll set or signalfd
+    // the child has already closed them with its other close-on-exec fds
+    epoll_fd = signal_fd = input_fd = -1;
+    input_pollable = 1;
+    events_init(0);
+}
+
+const sigset_t *events_child_mask(void) {
+    return &child_mask;
+}
+
+int events_pidfd_open(pid_t pid) {
+    // pidfd that becomes readable when pid exits, -1 if unsupported or out of fds
+    // the signalfd still sees every child, so a job without one only loses the direct wakeup
+#ifdef SYS_pidfd_open
+    int fd = fd_shell(syscall(SYS_pidfd_open, pid, 0));
+    if (fd < 0) {
+        return -1;
+    }
+    // pidfds are close-on-exec already
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
+void events_pidfd_close(int fd) {
+    // drop it from the epoll set first, a close alone leaves it there while
+    // another reference to the file is alive, and an exited pid stays readable
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+}
+
+int events_hangup_watch(int fd) {
+    // wake the event loop once when the other end of socket fd goes away (server.c)
+    struct epoll_event ev = { .events = EPOLLRDHUP | EPOLLONESHOT, .data.fd = fd };
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void events_hangup_close(int fd) {
+    events_pidfd_close(fd);
+}
+
+static int read_signals(void) {
+    // drain the signalfd, returns 1 if SIGINT was among them
+    struct signalfd_siginfo info[16];
+    int interrupted = 0;
+    int child = 0;
+
+    for (;;) {
+        ssize_t n = read(signal_fd, info, sizeof(info));
+        if (n <= 0) {
+            break;
+        }
+        for (size_t i = 0; i < n / sizeof(info[0]); i++) {
+            switch (info[i].ssi_signo) {
+                case SIGCHLD:
+                    child = 1;  // several exits may share one SIGCHLD, reap them all below
+                    break;
+                case SIGTSTP:
+                    handle_sigtstp();
+                    break;
+                case SIGINT:
+                    interrupted = 1;
+                    break;
+                case SIGUSR1:
+                    stats_dump();
+                    break;
+            }
+        }
+    }
+
+    if (child) {
+        handle_sigchld();
+    }
+    return interrupted;
+}
+
+static void watch_input(int fd) {
+    // (re)arm fd for one readiness report
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT, .data.fd = fd };
+
+    if (fd != input_fd) {
+        if (input_fd >= 0 && input_pollable) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, input_fd, NULL);
+        }
+        input_fd = fd;
+        // regular files can't be polled, they are always readable
+        input_pollable = (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0);
+        return;
+    }
+    if (input_pollable) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    }
+}
+
+int events_poll(void) {
+    // handle whatever is pending without blocking
+    // returns -1 if SIGINT arrived
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 0);
+    int child = 0, interrupted = 0;
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.fd == signal_fd) {
+            interrupted |= read_signals();
+        } else if (events[i].data.fd != input_fd) {
+            child = 1;
+        }
+    }
+    if (child) {
+        handle_sigchld();
+    }
+    return interrupted ? -1 : 0;
+}
+
+static int wait_round(int fd, int *ready) {
+    // block for one batch of events, children are reaped from it
+    // *ready is set if fd became readable, returns -1 if SIGINT arrived
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+        if (errno != EINTR) {
+            perror("epoll_wait");
+            *ready = 1;     // don't spin on it, let the caller go on
+        }
+        return 0;
+    }
+
+    int interrupted = 0, child = 0;
+    for (int i = 0; i < n; i++) {
+        int efd = events[i].data.fd;
+        if (efd == signal_fd) {
+            interrupted |= read_signals();
+        } else if (efd == input_fd) {
+            *ready |= (efd == fd);  // a stale one-shot report is just dropped
+        } else {
+            child = 1;  // a job's pidfd, its last stage exited, or a hangup
+        }
+    }
+    if (child) {
+        handle_sigchld();
+    }
+    return interrupted ? -1 : 0;
+}
+
+int events_wait(int fd) {
+    // handle events until fd is readable, or for one round if fd < 0
+    // returns -1 if SIGINT arrived while waiting
+    if (fd >= 0) {
+        watch_input(fd);
+        if (!input_pollable) {
+            return 0;
+        }
+    }
+
+    for (;;) {
+        int ready = 0;
+        int interrupted = wait_round(fd, &ready);
+        if (fd < 0 || ready) {
+            return fd < 0 ? interrupted : 0;
+        }
+        if (interrupted) {
+            return -1;
+        }
+    }
+}
+
+int events_wait_any(int fd) {
+    // one round of events with fd watched as well, for a loop that has jobs
+    // to look after besides its input: 1 if fd is readable, -1 if SIGINT arrived
+    int ready = 0;
+    watch_input(fd);
+    if (!input_pollable) {
+        return 1;
+    }
+    int interrupted = wait_round(fd, &ready);
+    return ready ? 1 : interrupted;
+}
@@ -0,0 +1,22 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <signal.h>
+#include <sys/types.h>
+
+// the shell's single event loop: stdin, a signalfd for SIGCHLD/SIGINT/SIGTSTP
+// and one pidfd per job, all job state changes happen from here
+// a server (server.c) watches its listening socket and its clients' hangups too
+
+int events_init(int interactive);
+void events_reset(void);
+const sigset_t *events_child_mask(void);
+int events_pidfd_open(pid_t pid);
+void events_pidfd_close(int fd);
+int events_poll(void);
+int events_wait(int fd);
+int events_wait_any(int fd);
+int events_hangup_watch(int fd);
+void events_hangup_close(int fd);
+
+#endif
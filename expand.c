@@ -0,0 +1,690 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "expand.h"
+#include "spawn.h"
+#include "events.h"
+#include "builtins.h"
+#include "wildcard.h"
+#include "vars.h"
+
+#define CAPTURE_CHUNK (64 * 1024)       // first buffer, and the size of every read
+#define CAPTURE_SPILL (1024 * 1024)     // past this the output goes to a memfd instead
+
+// output of one substitution, a malloc'd buffer or a mapped memfd
+typedef struct {
+    char *data;
+    size_t len;
+    size_t map_len;     // nonzero if data is a mapping
+} capture_t;
+
+// fields of the command being expanded
+typedef struct {
+    arena_t *arena;
+    char *buf;          // field being built, scratch
+    size_t len;
+    size_t cap;
+    int in_field;       // something (even "") started the current field
+    int split;          // unquoted substitutions are split into fields, and fields are globbed
+    char *pat;          // the current field as a glob pattern, quoted characters escaped
+    size_t pat_len;
+    size_t pat_cap;
+    int glob;           // the current field has an unquoted *, ? or [
+    int assign;         // a lone command of only assignments, they are made as they expand
+    int pattern;        // fields are kept as patterns, for case
+    wildcard_t matches;
+    char **fields;
+    int nfields;
+    int fields_cap;
+    int status;         // exit status to report if expansion fails
+    int subst_status;   // exit status of the last command substitution, 0 if none ran
+} expander_t;
+
+static int subst_child(char **args) {
+    // forked child of a substitution, runs the text with stdout on the pipe
+    enter_subshell();
+    return run_string(args[0]);
+}
+
+static int read_output(int fd, capture_t *out) {
+    // everything from fd, doubling a buffer up to CAPTURE_SPILL then splicing
+    // the rest into a memfd, so large outputs aren't copied again and again
+    size_t cap = CAPTURE_CHUNK, len = 0;
+    char *buf = malloc(cap);
+    if (!buf) {
+        return -1;
+    }
+    int memfd = -1;
+    loff_t off = 0;
+    int use_splice = 1;
+
+    for (;;) {
+        if (memfd < 0 && len == cap) {
+            if (cap < CAPTURE_SPILL) {
+                char *grown = realloc(buf, cap * 2);
+                if (!grown) {
+                    free(buf);
+                    return -1;
+                }
+                buf = grown;
+                cap *= 2;
+            } else {
+                memfd = memfd_create("yash-subst", MFD_CLOEXEC);
+                if (memfd < 0 || write(memfd, buf, len) != (ssize_t)len) {
+                    if (memfd >= 0) {
+                        close(memfd);
+                    }
+                    free(buf);
+                    return -1;
+                }
+                off = len;
+            }
+        }
+
+        ssize_t n;
+        if (memfd < 0) {
+            n = read(fd, buf + len, cap - len);
+        } else if (use_splice) {
+            n = splice(fd, NULL, memfd, &off, CAPTURE_SPILL, SPLICE_F_MOVE);
+            if (n < 0 && errno == EINVAL) {
+                use_splice = 0;
+                continue;
+            }
+        } else {
+            // no splice into this file, copy through the buffer
+            n = read(fd, buf, cap);
+            if (n > 0 && pwrite(memfd, buf, n, off) != n) {
+                n = -1;
+            } else if (n > 0) {
+                off += n;
+            }
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            perror("yash: command substitution");
+        }
+        if (n <= 0) {
+            break;
+        }
+        if (memfd < 0) {
+            len += n;
+        }
+    }
+
+    if (memfd < 0) {
+        out->data = buf;
+        out->len = len;
+        out->map_len = 0;
+        return 0;
+    }
+    free(buf);
+    void *map = mmap(NULL, off, PROT_READ, MAP_PRIVATE, memfd, 0);
+    close(memfd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    out->data = map;
+    out->len = off;
+    out->map_len = off;
+    return 0;
+}
+
+static int capture(const char *text, capture_t *out, int *status) {
+    // run text in a forked child of the shell and collect its stdout
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) < 0) {
+        perror("yash: pipe");
+        return -1;
+    }
+
+    // the child stays in the shell's process group, like a builtin in a pipeline
+    char *argv[] = { (char *)text, NULL };
+    spawn_req_t req;
+    spawn_req_init(&req, argv, -1, 0, events_child_mask());
+    spawn_add_dup(&req, p[1], STDOUT_FILENO);
+    req.builtin = subst_child;
+    fflush(stdout);
+    pid_t pid = spawn_start(&req);
+    spawn_req_free(&req);
+    close(p[1]);
+    if (pid < 0) {
+        perror("yash: command substitution");
+        close(p[0]);
+        return -1;
+    }
+
+    int got = read_output(p[0], out);
+    close(p[0]);
+
+    // reaped here, the event loop never sees it in the job table
+    int wstatus;
+    pid_t waited;
+    while ((waited = waitpid(pid, &wstatus, 0)) < 0 && errno == EINTR) {
+    }
+    if (waited != pid) {
+        *status = 1;    // lost, don't make up a status for it
+    } else {
+        *status = WIFSIGNALED(wstatus) ? 128 + WTERMSIG(wstatus) : WEXITSTATUS(wstatus);
+    }
+    if (got < 0) {
+        perror("yash: command substitution");
+    }
+    return got;
+}
+
+static void release(capture_t *c) {
+    if (c->map_len) {
+        munmap(c->data, c->map_len);
+    } else {
+        free(c->data);
+    }
+}
+
+static int reserve(char **buf, size_t *cap, size_t need) {
+    if (need > *cap) {
+        size_t grown_cap = *cap ? *cap : 256;
+        while (grown_cap < need) {
+            grown_cap *= 2;
+        }
+        char *grown = realloc(*buf, grown_cap);
+        if (!grown) {
+            return -1;
+        }
+        *buf = grown;
+        *cap = grown_cap;
+    }
+    return 0;
+}
+
+static int add_text(expander_t *ex, const char *s, size_t n, int quoted) {
+    // append to the current field, and to its pattern with quoted
+    // wildcards escaped so they only match themselves
+    if (reserve(&ex->buf, &ex->cap, ex->len + n + 1) < 0 ||
+        reserve(&ex->pat, &ex->pat_cap, ex->pat_len + 2 * n + 1) < 0) {
+        return -1;
+    }
+    memcpy(ex->buf + ex->len, s, n);
+    ex->len += n;
+    for (size_t i = 0; i < n; i++) {
+        if (strchr("*?[\\]", s[i]) && s[i]) {
+            if (quoted || s[i] == '\\') {
+                ex->pat[ex->pat_len++] = '\\';
+            } else if (s[i] != ']') {
+                ex->glob |= ex->split;
+            }
+        }
+        ex->pat[ex->pat_len++] = s[i];
+    }
+    ex->in_field = 1;
+    return 0;
+}
+
+static int add(expander_t *ex, const char *s, size_t n) {
+    // quoted text, or text that is never globbed
+    return add_text(ex, s, n, 1);
+}
+
+static int push_field(expander_t *ex, char *word) {
+    if (ex->nfields == ex->fields_cap) {
+        int cap = ex->fields_cap ? ex->fields_cap * 2 : 16;
+        char **grown = realloc(ex->fields, cap * sizeof(char *));
+        if (!grown) {
+            return -1;
+        }
+        ex->fields = grown;
+        ex->fields_cap = cap;
+    }
+    ex->fields[ex->nfields++] = word;
+    return 0;
+}
+
+static int end_field(expander_t *ex) {
+    // the current field is complete, copy it into the arena, or the paths
+    // it matches if it is a pattern that matches any
+    if (!ex->in_field) {
+        return 0;
+    }
+    int glob = ex->glob;
+    ex->in_field = 0;
+    ex->glob = 0;
+    if (glob) {
+        ex->pat[ex->pat_len] = '\0';
+        ex->pat_len = 0;
+        if (wildcard_expand(ex->arena, ex->pat, &ex->matches) < 0) {
+            return -1;
+        }
+        for (size_t i = 0; i < ex->matches.n; i++) {
+            if (push_field(ex, ex->matches.paths[i]) < 0) {
+                return -1;
+            }
+        }
+        if (ex->matches.n) {
+            ex->len = 0;
+            return 0;
+        }
+    }
+    char *word = ex->pattern ? arena_strndup(ex->arena, ex->pat ? ex->pat : "", ex->pat_len)
+                             : arena_strndup(ex->arena, ex->buf ? ex->buf : "", ex->len);
+    ex->pat_len = 0;
+    ex->len = 0;
+    if (!word) {
+        return -1;
+    }
+    return push_field(ex, word);
+}
+
+static int is_ifs(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+static int add_split(expander_t *ex, const char *s, size_t len) {
+    // unquoted result of an expansion, split into fields at blanks and newlines
+    const char *e = s + len;
+    int err = 0;
+    while (s < e && !err) {
+        if (is_ifs(*s)) {
+            err = end_field(ex);
+            while (s < e && is_ifs(*s)) {
+                s++;
+            }
+        } else {
+            const char *run = s;
+            while (s < e && !is_ifs(*s)) {
+                s++;
+            }
+            err = add_text(ex, run, s - run, 0);
+        }
+    }
+    return err;
+}
+
+static int add_value(expander_t *ex, const char *value, int quoted) {
+    // a parameter's value, split into fields when unquoted and splitting
+    size_t len = strlen(value);
+    if (quoted) {
+        return add(ex, value, len);
+    }
+    if (!ex->split) {
+        return add_text(ex, value, len, 0);    // still a pattern in a case
+    }
+    return add_split(ex, value, len);
+}
+
+static int positional(expander_t *ex, int at, int quoted) {
+    // $@ and $*: one field per parameter, each split again when unquoted; "$*"
+    // and anything not split joins them with blanks instead
+    int err = 0;
+    for (int i = 0; i < shell_nargs && !err; i++) {
+        if (i > 0 && ex->split && (at || !quoted)) {
+            ex->in_field |= quoted;
+            err = end_field(ex);
+        } else if (i > 0) {
+            err = add(ex, " ", 1);
+        }
+        if (!err) {
+            err = add_value(ex, shell_args[i], quoted);
+        }
+    }
+    return err;
+}
+
+static int parameter(expander_t *ex, const char *start, const char *end, int quoted) {
+    // the value of the parameter at [start, end), unset is empty
+    const char *name = start + 1;
+    size_t len = end - name;
+    if (*name == '{') {
+        name++;
+        len -= 2;
+    }
+    char num[24];
+    const char *value;
+    if (*name == '@' || *name == '*') {
+        return positional(ex, *name == '@', quoted);
+    } else if (*name == '?' || *name == '$' || *name == '#') {
+        snprintf(num, sizeof(num), "%d", *name == '?' ? shell_status : *name == '#' ? shell_nargs : (int)shell_pid);
+        value = num;
+    } else if (*name == '!') {
+        // empty until something was started with '&'
+        snprintf(num, sizeof(num), "%d", (int)shell_last_bg);
+        value = shell_last_bg > 0 ? num : NULL;
+    } else if (*name >= '0' && *name <= '9') {
+        long n = strtol(name, NULL, 10);
+        value = (n == 0) ? shell_name : (n <= shell_nargs) ? shell_args[n - 1] : NULL;
+    } else {
+        value = var_getn(name, len);
+    }
+    return add_value(ex, value ? value : "", quoted);
+}
+
+static int substitute(expander_t *ex, const char *start, const char *end, int quoted) {
+    // run the substitution at [start, end) and add its output, split into
+    // fields at blanks and newlines unless quoted
+    char *text;
+    if (*start == '`') {
+        // inside backquotes a backslash only escapes \, ` and $
+        text = malloc(end - start);
+        if (!text) {
+            return -1;
+        }
+        char *t = text;
+        for (const char *s = start + 1; s < end - 1; s++) {
+            if (*s == '\\' && s + 1 < end - 1 && strchr("\\`$", s[1])) {
+                s++;
+            }
+            *t++ = *s;
+        }
+        *t = '\0';
+    } else {
+        text = strndup(start + 2, end - start - 3);
+        if (!text) {
+            return -1;
+        }
+    }
+
+    capture_t out;
+    int status;
+    int got = capture(text, &out, &status);
+    free(text);
+    if (got < 0) {
+        ex->status = 1;
+        return -1;
+    }
+    if (status == 128 + SIGINT) {
+        // ctrl-c in a substitution drops the whole command
+        release(&out);
+        ex->status = status;
+        return -1;
+    }
+    ex->subst_status = status;
+
+    // trailing newlines are not part of the value
+    size_t len = out.len;
+    while (len > 0 && out.data[len - 1] == '\n') {
+        len--;
+    }
+
+    int err;
+    if (quoted || !ex->split) {
+        err = add_text(ex, out.data, len, quoted);
+        ex->in_field = 1;   // "$(true)" is still an (empty) argument
+    } else {
+        err = add_split(ex, out.data, len);
+    }
+    release(&out);
+    if (err) {
+        ex->status = 1;
+    }
+    return err;
+}
+
+static int expand_word(expander_t *ex, const char *w) {
+    // expand one source word into zero or more fields, quotes removed
+    const char *s = w;
+    int err = 0;
+    while (*s && !err) {
+        char c = *s;
+        if (c == '\\') {
+            err = s[1] ? add(ex, s + 1, 1) : 0;
+            s += s[1] ? 2 : 1;
+        } else if (c == '\'') {
+            const char *close = strchr(s + 1, '\'');
+            err = add(ex, s + 1, close - s - 1);
+            s = close + 1;
+        } else if (c == '"' && strncmp(s, "\"$@\"", 4) == 0 && shell_nargs == 0) {
+            s += 4;     // "$@" without parameters is no field at all, not an empty one
+        } else if (c == '"') {
+            ex->in_field = 1;
+            s++;
+            while (*s != '"' && !err) {
+                const char *end;
+                if (*s == '$' && (end = parse_param_end(s))) {
+                    err = parameter(ex, s, end, 1);
+                    s = end;
+                } else if ((*s == '$' && s[1] == '(') || *s == '`') {
+                    const char *end = parse_subst_end(s);
+                    err = substitute(ex, s, end, 1);
+                    s = end;
+                } else {
+                    // inside double quotes backslash only escapes these
+                    if (*s == '\\' && strchr("\\\"$`", s[1])) {
+                        s++;
+                    }
+                    err = add(ex, s, 1);
+                    s++;
+                }
+            }
+            s++;
+        } else if (c == '$' && parse_param_end(s)) {
+            const char *end = parse_param_end(s);
+            err = parameter(ex, s, end, 0);
+            s = end;
+        } else if ((c == '$' && s[1] == '(') || c == '`') {
+            const char *end = parse_subst_end(s);
+            err = substitute(ex, s, end, 0);
+            s = end;
+        } else {
+            err = add_text(ex, s, 1, 0);
+            s++;
+        }
+    }
+    if (!err) {
+        err = end_field(ex);
+    }
+    if (err && !ex->status) {
+        fprintf(stderr, "yash: out of memory\n");
+        ex->status = 1;
+    }
+    return err;
+}
+
+static int expand_heredoc(expander_t *ex, const char *s) {
+    // an unquoted here-doc body, one field: parameters and substitutions expand, a backslash
+    // escapes $, `, \ and newline, quotes are just text
+    int err = 0;
+    while (*s && !err) {
+        if (*s == '\\' && s[1] && strchr("$`\\\n", s[1])) {
+            err = (s[1] != '\n') ? add(ex, s + 1, 1) : 0;   // backslash-newline joins lines
+            s += 2;
+        } else if (*s == '$' && parse_param_end(s)) {
+            const char *end = parse_param_end(s);
+            err = parameter(ex, s, end, 1);
+            s = end;
+        } else if ((*s == '$' && s[1] == '(') || *s == '`') {
+            const char *end = parse_subst_end(s);
+            if (!end) {
+                err = add(ex, s, strlen(s));
+                break;
+            }
+            err = substitute(ex, s, end, 1);
+            s = end;
+        } else {
+            const char *run = s++;
+            s += strcspn(s, "\\$`");
+            err = add(ex, run, s - run);
+        }
+    }
+    ex->in_field = 1;
+    if (!err) {
+        err = end_field(ex);
+    }
+    if (err && !ex->status) {
+        fprintf(stderr, "yash: out of memory\n");
+        ex->status = 1;
+    }
+    return err;
+}
+
+static int expand_command(expander_t *ex, const command_t *cmd, command_t *out) {
+    *out = *cmd;
+    out->raw = NULL;
+    ex->nfields = 0;
+    for (int i = 0; i < cmd->argc; i++) {
+        if (cmd->raw[i] ? expand_word(ex, cmd->argv[i]) < 0 : push_field(ex, cmd->argv[i]) < 0) {
+            return -1;
+        }
+    }
+    int argc = ex->nfields;
+
+    // redirection targets expand to exactly one word
+    redir_t **tail = &out->redirs;
+    for (const redir_t *r = cmd->redirs; r; r = r->next) {
+        redir_t *copy = arena_alloc(ex->arena, sizeof(redir_t));
+        if (!copy) {
+            return -1;
+        }
+        *copy = *r;
+        if (r->raw) {
+            // a here-string is one word, a here-doc body one string
+            int err;
+            if (r->kind == REDIR_HEREDOC) {
+                err = expand_heredoc(ex, r->target);
+            } else {
+                ex->split = (r->kind != REDIR_HERESTRING);
+                err = expand_word(ex, r->target);
+                ex->split = 1;
+            }
+            if (err < 0) {
+                return -1;
+            }
+            if (ex->nfields != argc + 1) {
+                fprintf(stderr, "yash: %s: ambiguous redirect\n", r->target);
+                ex->status = 1;
+                return -1;
+            }
+            copy->target = ex->fields[--ex->nfields];
+            copy->raw = 0;
+        }
+        *tail = copy;
+        tail = &copy->next;
+    }
+    *tail = NULL;
+
+    // assignment values are not split or globbed, each stays one NAME=value word
+    // in a line like 'A=1 B=$A' each is set before the next expands, nothing is left to the caller
+    if (cmd->nassigns) {
+        out->assigns = arena_alloc(ex->arena, (cmd->nassigns + 1) * sizeof(char *));
+        if (!out->assigns) {
+            return -1;
+        }
+        for (int i = 0; i < cmd->nassigns; i++) {
+            out->assigns[i] = cmd->assigns[i];
+            if (cmd->raw[cmd->argc + i]) {
+                ex->split = 0;
+                int err = expand_word(ex, cmd->assigns[i]);
+                ex->split = 1;
+                if (err < 0) {
+                    return -1;
+                }
+                out->assigns[i] = ex->fields[--ex->nfields];
+            }
+            if (ex->assign && vars_assign(&out->assigns[i], 1) < 0) {
+                ex->status = 1;
+                return -1;
+            }
+        }
+        out->assigns[cmd->nassigns] = NULL;
+        if (ex->assign) {
+            out->nassigns = 0;
+        }
+    }
+
+    out->argv = arena_alloc(ex->arena, (argc + 1) * sizeof(char *));
+    if (!out->argv) {
+        return -1;
+    }
+    if (argc > 0) {
+        memcpy(out->argv, ex->fields, argc * sizeof(char *));   // no fields yet means no array
+    }
+    out->argv[argc] = NULL;
+    out->argc = argc;
+    return 0;
+}
+
+static void done(expander_t *ex) {
+    free(ex->buf);
+    free(ex->pat);
+    free(ex->fields);
+    wildcard_free(&ex->matches);
+}
+
+const pipeline_t *expand_pipeline(arena_t *arena, const pipeline_t *pl, int *status) {
+    // pl with every raw word expanded, pl itself if there are none
+    // returns NULL with *status set if an expansion failed, else *status is the
+    // status of the last command substitution, which an assignment-only command returns
+    int i;
+    *status = 0;
+    for (i = 0; i < pl->ncmds && !pl->cmds[i].raw; i++) {
+    }
+    if (i == pl->ncmds) {
+        return pl;
+    }
+
+    pipeline_t *out = arena_alloc(arena, sizeof(pipeline_t));
+    command_t *cmds = arena_alloc(arena, pl->ncmds * sizeof(command_t));
+    expander_t ex = { .arena = arena, .split = 1 };
+    ex.assign = pl->ncmds == 1 && !pl->background && !pl->cpus && !pl->cmds[0].cpus &&
+                !pl->rlimit && pl->cmds[0].argc == 0 && !pl->cmds[0].body;
+    int failed = !out || !cmds;
+    for (i = 0; i < pl->ncmds && !failed; i++) {
+        if (!pl->cmds[i].raw) {
+            cmds[i] = pl->cmds[i];
+        } else if (expand_command(&ex, &pl->cmds[i], &cmds[i]) < 0) {
+            failed = 1;
+        }
+    }
+    done(&ex);
+    if (failed) {
+        *status = ex.status ? ex.status : 1;
+        return NULL;
+    }
+    *out = *pl;
+    out->cmds = cmds;
+    *status = ex.subst_status;
+    return out;
+}
+
+char **expand_words(arena_t *arena, char *const *words, const char *raw, int n, int *count, int *status) {
+    // the words of a for loop as a NULL terminated array, expanded like arguments
+    // returns NULL with *status set if an expansion failed
+    expander_t ex = { .arena = arena, .split = 1 };
+    int failed = 0;
+    for (int i = 0; i < n && !failed; i++) {
+        failed = (raw && raw[i]) ? expand_word(&ex, words[i]) < 0 : push_field(&ex, words[i]) < 0;
+    }
+    char **out = failed ? NULL : arena_alloc(arena, (ex.nfields + 1) * sizeof(char *));
+    if (out) {
+        if (ex.nfields > 0) {
+            memcpy(out, ex.fields, ex.nfields * sizeof(char *));
+        }
+        out[ex.nfields] = NULL;
+        *count = ex.nfields;
+    } else {
+        *status = ex.status ? ex.status : 1;
+    }
+    done(&ex);
+    return out;
+}
+
+const char *expand_string(arena_t *arena, const char *word, int pattern, int *status) {
+    // one word to one string, not split or globbed: a case word, or with pattern
+    // a case pattern with its quoted characters escaped
+    // returns NULL with *status set if an expansion failed
+    expander_t ex = { .arena = arena, .pattern = pattern };
+    const char *out = NULL;
+    if (expand_word(&ex, word) == 0) {
+        out = ex.nfields ? ex.fields[0] : "";
+    } else {
+        *status = ex.status ? ex.status : 1;
+    }
+    done(&ex);
+    return out;
+}
@@ -0,0 +1,17 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include "arena.h"
+#include "parse.h"
+
+// run-time word expansion of the words the parser kept as source text:
+// parameters, command substitution, field splitting, pathname expansion and quote removal
+
+const pipeline_t *expand_pipeline(arena_t *arena, const pipeline_t *pl, int *status);
+char **expand_words(arena_t *arena, char *const *words, const char *raw, int n, int *count, int *status);
+const char *expand_string(arena_t *arena, const char *word, int pattern, int *status);
+
+// parses and runs a line in the current process, returns the last status (yash.c)
+int run_string(const char *line);
+
+#endif
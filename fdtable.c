@@ -0,0 +1,44 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include "fdtable.h"
+
+unsigned fd_script_mask;
+
+void fdtable_init(void) {
+    // whatever the shell was started with in 0-9 is the script's, unless
+    // close-on-exec: a child would not have seen it anyway
+    fd_script_mask = 0;
+    for (int fd = 0; fd <= FD_SCRIPT_MAX; fd++) {
+        int flags = fcntl(fd, F_GETFD);
+        if (flags >= 0 && !(flags & FD_CLOEXEC)) {
+            fd_script_mask |= 1u << fd;
+        }
+    }
+}
+
+int fd_shell(int fd) {
+    // move a fd the shell opened for itself out of the script's range, close-on-exec
+    // returns the fd to use, the old one if it was already high or can't be moved
+    if (fd < 0 || fd >= FD_SHELL_MIN) {
+        return fd;
+    }
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, FD_SHELL_MIN);
+    if (high < 0) {
+        return fd;
+    }
+    close(fd);
+    return high;
+}
+
+void fd_script_opened(int fd) {
+    if (fd >= 0 && fd <= FD_SCRIPT_MAX) {
+        fd_script_mask |= 1u << fd;
+    }
+}
+
+void fd_script_closed(int fd) {
+    if (fd >= 0 && fd <= FD_SCRIPT_MAX) {
+        fd_script_mask &= ~(1u << fd);
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef FDTABLE_H
+#define FDTABLE_H
+
+// fds 0-9 belong to the script: redirections and 'exec N>file' use them and children
+// inherit whatever is open there; the shell keeps its own fds at FD_SHELL_MIN and up,
+// close-on-exec, so 'exec 3>log' can never land on the shell's signalfd or a job's pidfd
+//   exec N<file, N>file, N>>file      open N in the shell itself, for every later command
+//   exec N>&M, N>&-                   dup or close it
+//   cmd >&N, cmd 2>&1                 a dup2 in the child, nothing is opened again
+// fd_script_mask says which of 0-9 are open, so the spawn server (zygote.c), whose
+// children don't inherit the shell's fds, can be sent them without asking the kernel
+
+#define FD_SHELL_MIN 10
+#define FD_SCRIPT_MAX 9
+
+extern unsigned fd_script_mask;     // bit N set if the script's fd N is open
+
+void fdtable_init(void);
+int fd_shell(int fd);
+void fd_script_opened(int fd);
+void fd_script_closed(int fd);
+
+#endif
@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "history.h"
+#include "fdtable.h"
+
+#define INDEX_MAGIC 0x31494859  // "YHI1"
+#define INDEX_MIN_SIZE 65536
+#define SEARCH_CHUNK 65536      // bytes per search step, tens of microseconds
+
+// FILE.idx, shared by every session that uses FILE
+// offsets[i] is where entry i starts, entries end in '\n'
+typedef struct {
+    uint32_t magic;
+    uint32_t pad;
+    uint64_t ino;           // history file the index was built for
+    uint64_t covered;       // bytes of the history file indexed, always at a line start
+    uint64_t count;
+    uint64_t offsets[];
+} history_index_t;
+
+static int hist_fd = -1;
+static int index_fd = -1;
+
+// this session's view, refreshed under the lock by sync_index()
+// other sessions only ever append past it, so it stays valid between syncs
+static const char *data = NULL;     // the history file as of the last sync
+static size_t data_len = 0;
+static history_index_t *index_map = NULL;
+static size_t index_len = 0;
+static long nentries = 0;
+static size_t covered = 0;          // end of the last indexed entry
+
+static int open_files(const char *path) {
+    // O_APPEND makes every entry a single atomic append
+    hist_fd = fd_shell(open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600));
+    if (hist_fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(hist_fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(hist_fd);
+        hist_fd = -1;
+        return -1;
+    }
+
+    size_t len = strlen(path) + 5;
+    char *index_path = malloc(len);
+    if (!index_path) {
+        close(hist_fd);
+        hist_fd = -1;
+        return -1;
+    }
+    snprintf(index_path, len, "%s.idx", path);
+    index_fd = fd_shell(open(index_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600));
+    free(index_path);
+    if (index_fd < 0) {
+        close(hist_fd);
+        hist_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static int open_memory(void) {
+    // HISTFILE isn't a usable file (/dev/null, a directory, no HOME),
+    // keep this session's history in memory files behind the same code
+    hist_fd = fd_shell(memfd_create("yash-history", MFD_CLOEXEC));
+    index_fd = fd_shell(memfd_create("yash-history-index", MFD_CLOEXEC));
+    if (hist_fd < 0 || index_fd < 0) {
+        if (hist_fd >= 0) {
+            close(hist_fd);
+        }
+        hist_fd = index_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static int map_index(size_t len) {
+    // (re)map the index file at len bytes, growing the file if it is shorter
+    struct stat st;
+    if (fstat(index_fd, &st) < 0) {
+        return -1;
+    }
+    if ((size_t)st.st_size < len) {
+        if (ftruncate(index_fd, len) < 0) {
+            return -1;
+        }
+    } else {
+        len = st.st_size;   // another session grew it
+    }
+    if (index_map && len == index_len) {
+        return 0;
+    }
+
+    void *map;
+    if (index_map) {
+        map = mremap(index_map, index_len, len, MREMAP_MAYMOVE);
+    } else {
+        map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, index_fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    index_map = map;
+    index_len = len;
+    return 0;
+}
+
+static int map_data(size_t len) {
+    // map the first len bytes of the history file
+    if (len == data_len) {
+        return 0;
+    }
+    void *map;
+    if (data) {
+        map = mremap((void *)data, data_len, len, MREMAP_MAYMOVE);
+    } else {
+        map = mmap(NULL, len, PROT_READ, MAP_SHARED, hist_fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    data = map;
+    data_len = len;
+    return 0;
+}
+
+static size_t index_capacity(void) {
+    return (index_len - sizeof(history_index_t)) / sizeof(uint64_t);
+}
+
+static int sync_index(void) {
+    // index whatever was appended since the index was last updated, caller holds the lock
+    // a history file that was truncated or replaced is indexed from scratch
+    struct stat st;
+    if (fstat(hist_fd, &st) < 0) {
+        return -1;
+    }
+    if (map_index(INDEX_MIN_SIZE) < 0) {
+        return -1;
+    }
+
+    history_index_t *ix = index_map;
+    size_t size = st.st_size;
+    if (ix->magic != INDEX_MAGIC || ix->ino != (uint64_t)st.st_ino || ix->covered > size ||
+        ix->count > index_capacity()) {
+        ix->magic = INDEX_MAGIC;
+        ix->ino = st.st_ino;
+        ix->covered = 0;
+        ix->count = 0;
+    }
+
+    if (size > 0 && map_data(size) < 0) {
+        return -1;
+    }
+    if (ix->covered > 0 && data[ix->covered - 1] != '\n') {
+        // rewritten in place with different line breaks
+        ix->covered = 0;
+        ix->count = 0;
+    }
+
+    // one offset per complete line, a partial line waits for its newline
+    const char *p = data + ix->covered;
+    const char *end = data + size;
+    const char *nl;
+    while (p < end && (nl = memchr(p, '\n', end - p)) != NULL) {
+        if (ix->count == index_capacity()) {
+            size_t want = sizeof(history_index_t) + index_capacity() * 2 * sizeof(uint64_t);
+            if (map_index(want) < 0) {
+                break;
+            }
+            ix = index_map;
+        }
+        ix->offsets[ix->count++] = p - data;
+        p = nl + 1;
+    }
+    ix->covered = p - data;
+
+    nentries = ix->count;
+    covered = ix->covered;
+    return 0;
+}
+
+int history_init(void) {
+    // open the history and bring its index up to date
+    const char *path = getenv("HISTFILE");
+    char *home_path = NULL;
+    if (!path) {
+        const char *home = getenv("HOME");
+        if (home && *home) {
+            size_t len = strlen(home) + sizeof("/.yash_history");
+            home_path = malloc(len);
+            if (home_path) {
+                snprintf(home_path, len, "%s/.yash_history", home);
+                path = home_path;
+            }
+        }
+    }
+
+    int opened = (path && *path) ? open_files(path) : -1;
+    free(home_path);
+    if (opened < 0 && open_memory() < 0) {
+        return -1;
+    }
+
+    flock(hist_fd, LOCK_EX);
+    int status = sync_index();
+    flock(hist_fd, LOCK_UN);
+    return status;
+}
+
+void history_add(const char *line) {
+    // append line as the newest entry, blank lines are not kept
+    if (hist_fd < 0 || line[strspn(line, " \t")] == '\0') {
+        return;
+    }
+    size_t len = strlen(line);
+    char *entry = malloc(len + 1);
+    if (!entry) {
+        return;
+    }
+    memcpy(entry, line, len);
+    entry[len] = '\n';
+
+    // one write under the lock, so concurrent sessions never interleave
+    // and the index is brought up to date by whoever writes
+    flock(hist_fd, LOCK_EX);
+    ssize_t n = write(hist_fd, entry, len + 1);
+    if (n >= 0 && (size_t)n != len + 1) {
+        // out of space mid-line, don't leave half an entry behind
+        struct stat st;
+        if (fstat(hist_fd, &st) == 0 && ftruncate(hist_fd, st.st_size - n) < 0) {
+            perror("yash: history");
+        }
+    }
+    sync_index();
+    flock(hist_fd, LOCK_UN);
+    free(entry);
+}
+
+long history_count(void) {
+    return nentries;
+}
+
+static size_t entry_end(long i) {
+    // one past the entry's last byte, before its newline
+    size_t next = (i + 1 < nentries) ? index_map->offsets[i + 1] : covered;
+    return next - 1;
+}
+
+const char *history_get(long i, size_t *len) {
+    // entry i, 0 is the oldest, not NUL terminated and only valid until the next history_add
+    if (i < 0 || i >= nentries) {
+        return NULL;
+    }
+    size_t start = index_map->offsets[i];
+    *len = entry_end(i) - start;
+    return data + start;
+}
+
+static long entry_at(size_t pos) {
+    // the entry holding byte pos, binary search over the offsets
+    long lo = 0, hi = nentries - 1;
+    while (lo < hi) {
+        long mid = lo + (hi - lo + 1) / 2;
+        if (index_map->offsets[mid] <= pos) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+void history_search_start(history_search_t *s, const char *query, size_t qlen, long before) {
+    // search entries older than before for query, newest first
+    s->query = query;
+    s->qlen = qlen;
+    s->match = -1;
+    if (before > nentries) {
+        before = nentries;
+    }
+    s->pos = (before <= 0) ? 0 : (before < nentries) ? index_map->offsets[before] : covered;
+}
+
+int history_search_step(history_search_t *s) {
+    // search the next chunk, returns 1 with s->match set, 0 when nothing older
+    // matches, -1 if there is more to search
+    if (s->qlen == 0 || s->pos < s->qlen) {
+        return 0;
+    }
+    // a chunk overlaps the one after it by qlen - 1 bytes so no match is cut in two
+    size_t chunk = SEARCH_CHUNK > 2 * s->qlen ? SEARCH_CHUNK : 2 * s->qlen;
+    size_t lo = s->pos > chunk ? s->pos - chunk : 0;
+
+    // newest occurrence in [lo, pos), entries are newline separated so a match
+    // never spans two of them
+    const char *hit = NULL;
+    const char *p = data + lo;
+    const char *end = data + s->pos;
+    const char *found;
+    while ((found = memmem(p, end - p, s->query, s->qlen)) != NULL) {
+        hit = found;
+        p = found + 1;
+    }
+    if (hit) {
+        s->match = entry_at(hit - data);
+        s->pos = index_map->offsets[s->match];   // the next step continues before it
+        return 1;
+    }
+    if (lo == 0) {
+        s->pos = 0;
+        return 0;
+    }
+    s->pos = lo + s->qlen - 1;
+    return -1;
+}
+
+int run_history(char **args) {
+    // user runs 'history'
+    // history      every entry, numbered from 1
+    // history N    the last N
+    long n = nentries;
+    if (args[1]) {
+        char *end;
+        errno = 0;
+        n = strtol(args[1], &end, 10);
+        if (*end || errno || n < 0 || args[2]) {
+            fprintf(stderr, "history: usage: history [N]\n");
+            return 2;
+        }
+        if (n > nentries) {
+            n = nentries;
+        }
+    }
+    for (long i = nentries - n; i < nentries; i++) {
+        size_t len;
+        const char *e = history_get(i, &len);
+        printf("%5ld  %.*s\n", i + 1, (int)len, e);
+    }
+    return 0;
+}
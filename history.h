@@ -0,0 +1,28 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+// command history kept in an append-only file ($HISTFILE, default ~/.yash_history)
+// shared by every session, with an mmap'd index of line offsets next to it
+// (FILE.idx) so startup only scans what was appended since the index was updated
+// writers serialize on flock() of the history file
+
+// a backward substring search that runs in bounded steps, so an interactive
+// caller can check for keystrokes between them
+typedef struct {
+    const char *query;
+    size_t qlen;
+    size_t pos;     // bytes below this are still to be searched
+    long match;     // entry found by the last step that returned 1
+} history_search_t;
+
+int history_init(void);
+void history_add(const char *line);
+long history_count(void);
+const char *history_get(long i, size_t *len);
+void history_search_start(history_search_t *s, const char *query, size_t qlen, long before);
+int history_search_step(history_search_t *s);
+int run_history(char **args);
+
+#endif
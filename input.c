@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "input.h"
+#include "fdtable.h"
+#include "edit.h"
+#include "events.h"
+#include "trace.h"
+
+#define READ_CHUNK 65536
+
+// read() based source: a tty, pipe or anything that can't be mapped
+static int in_fd = -1;
+static char *buf = NULL;
+static size_t buf_cap = 0;
+static size_t buf_start = 0;    // first unconsumed byte
+static size_t buf_end = 0;      // one past the last byte read
+static int at_eof = 0;
+
+// memory source: an mmap'd script or the -c string
+static const char *mem = NULL;
+static size_t mem_len = 0;
+static size_t mem_pos = 0;
+static int mem_mapped = 0;
+
+// interactive terminal input goes through the line editor
+static int editing = 0;
+static const char *prompt_str = "";
+
+// memory lines are copied here so they can be NUL terminated and tokenized
+static char *line_buf = NULL;
+static size_t line_cap = 0;
+
+static void close_source(void) {
+    if (mem_mapped) {
+        munmap((void *)mem, mem_len);
+    }
+    mem = NULL;
+    mem_len = mem_pos = 0;
+    mem_mapped = 0;
+    in_fd = -1;
+    buf_start = buf_end = 0;
+    at_eof = 0;
+}
+
+void input_init(int fd) {
+    close_source();
+    in_fd = fd;
+}
+
+int input_open_file(const char *path) {
+    // map a regular file in one go, anything else is read through the buffer
+    int fd = fd_shell(open(path, O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        return -1;
+    }
+
+    close_source();
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {
+            close(fd);
+            mem = "";
+            return 0;
+        }
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            mem = map;
+            mem_len = st.st_size;
+            mem_mapped = 1;
+            return 0;
+        }
+    }
+
+    in_fd = fd;
+    return 0;
+}
+
+void input_open_string(const char *str) {
+    close_source();
+    mem = str;
+    mem_len = strlen(str);
+}
+
+int input_use_editor(void) {
+    // edit lines read from a terminal from now on, returns whether it can
+    editing = (in_fd >= 0 && !mem && edit_supported(in_fd));
+    return editing;
+}
+
+void input_prompt(const char *prompt) {
+    // show the prompt, the editor draws it itself so it can redraw the line
+    if (editing) {
+        prompt_str = prompt;
+        return;
+    }
+    printf("%s", prompt);
+    fflush(stdout);
+}
+
+static int fill(void) {
+    // read more input after what is buffered, returns bytes read, 0 at EOF, -1 on SIGINT
+    if (buf_start > 0) {
+        // slide the partial line to the front
+        memmove(buf, buf + buf_start, buf_end - buf_start);
+        buf_end -= buf_start;
+        buf_start = 0;
+    }
+    if (buf_cap - buf_end < READ_CHUNK) {
+        size_t cap = buf_cap ? buf_cap * 2 : READ_CHUNK * 2;
+        while (cap - buf_end < READ_CHUNK) {
+            cap *= 2;
+        }
+        char *bigger = realloc(buf, cap);
+        if (!bigger) {
+            return 0;
+        }
+        buf = bigger;
+        buf_cap = cap;
+    }
+
+    // nothing is running the shell's way, a good time to write out the trace
+    trace_idle(1);
+
+    for (;;) {
+        // let the event loop reap children while we wait for more input
+        if (events_wait(in_fd) < 0) {
+            return -1;
+        }
+        ssize_t n = read(in_fd, buf + buf_end, buf_cap - buf_end - 1);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        buf_end += n;
+        return (int)n;
+    }
+}
+
+static int mem_getline(char **line) {
+    if (mem_pos >= mem_len) {
+        return 0;
+    }
+    const char *start = mem + mem_pos;
+    const char *nl = memchr(start, '\n', mem_len - mem_pos);
+    size_t len = nl ? (size_t)(nl - start) : mem_len - mem_pos;
+    mem_pos += len + (nl ? 1 : 0);
+
+    if (len + 1 > line_cap) {
+        size_t cap = line_cap ? line_cap : 256;
+        while (cap < len + 1) {
+            cap *= 2;
+        }
+        char *bigger = realloc(line_buf, cap);
+        if (!bigger) {
+            return 0;
+        }
+        line_buf = bigger;
+        line_cap = cap;
+    }
+    memcpy(line_buf, start, len);
+    line_buf[len] = '\0';
+    *line = line_buf;
+    return 1;
+}
+
+int input_getline(char **line) {
+    // next line without its newline, writable and valid until the next call
+    // returns 1 for a line, 0 at EOF, -1 if interrupted by SIGINT (pending input dropped)
+    if (mem) {
+        return mem_getline(line);
+    }
+    if (editing) {
+        fflush(stdout);
+        return edit_getline(in_fd, prompt_str, line);
+    }
+
+    for (;;) {
+        char *nl = NULL;
+        if (buf_end > buf_start) {
+            nl = memchr(buf + buf_start, '\n', buf_end - buf_start);
+        }
+        if (nl) {
+            *nl = '\0';
+            *line = buf + buf_start;
+            buf_start = nl - buf + 1;
+            return 1;
+        }
+
+        if (at_eof) {
+            if (buf_end > buf_start) {
+                // last line without a newline
+                buf[buf_end] = '\0';
+                *line = buf + buf_start;
+                buf_start = buf_end;
+                return 1;
+            }
+            return 0;
+        }
+
+        int n = fill();
+        if (n < 0) {
+            buf_start = buf_end = 0;
+            return -1;
+        }
+        if (n == 0) {
+            at_eof = 1;
+        }
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+// line reader for the shell's input, no line length limit
+// regular script files are mmap'd, ttys and pipes go through a large read buffer
+// an interactive terminal can use the line editor instead
+
+void input_init(int fd);
+int input_open_file(const char *path);
+void input_open_string(const char *str);
+int input_use_editor(void);
+void input_prompt(const char *prompt);
+int input_getline(char **line);
+
+#endif
@@ -1,219 +1,612 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <errno.h>
-#include "jobs.h" 
-
-job_t jobs[MAX_JOBS];
+#include "jobs.h"
+#include "events.h"
+#include "trace.h"
+#include "stats.h"
+
+// open addressing map from a positive key (pid, pgid or job id) to its job
+// linear probing, deletions shift the run back so there are no tombstones
+typedef struct {
+    int *keys;      // 0 marks an empty slot
+    job_t **vals;
+    size_t cap;     // power of two
+    size_t count;
+    int bits;
+} job_index_t;
+
+static job_index_t by_pid;      // every live process of every job
+static job_index_t by_pgid;
+static job_index_t by_id;
+
+static job_t *all_head = NULL, *all_tail = NULL;        // every job, ascending ID
+static job_t *active_head = NULL, *active_tail = NULL;  // jobs not done yet, ascending ID
+
+// exit statuses of background processes whose job left the table unwaited,
+// so 'wait PID' still has them; the oldest are overwritten
+#define SAVED_MAX 1024
+static struct {
+    pid_t pid;
+    int status;
+} saved[SAVED_MAX];
+static int saved_next = 0;
 
 pid_t shell_pgid = 0;   // set in main
+int job_control = 0;    // interactive shells put jobs in their own process groups
+
+static size_t index_slot(const job_index_t *ix, int key) {
+    // fibonacci hashing, the top bits are the well mixed ones
+    return (size_t)(((uint64_t)(unsigned)key * 0x9E3779B97F4A7C15ULL) >> (64 - ix->bits));
+}
 
-// return the first free slot or -1 if none
-static int find_job_slot(void) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (!jobs[i].used) {
-            return i;
+static job_t *index_get(const job_index_t *ix, int key) {
+    if (!ix->cap) {
+        return NULL;
+    }
+    for (size_t i = index_slot(ix, key); ix->keys[i]; i = (i + 1) & (ix->cap - 1)) {
+        if (ix->keys[i] == key) {
+            return ix->vals[i];
         }
     }
-    return -1; // no free jobs
+    return NULL;
 }
 
-// return next job id, ascending order so job numbers assigned sequentially
-static int get_next_jobID(void) {
-    int max_id = 0;
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].used && jobs[i].job_id > max_id) {
-            max_id = jobs[i].job_id;
+static int index_put(job_index_t *ix, int key, job_t *job);
+
+static int index_grow(job_index_t *ix) {
+    job_index_t bigger = { 0 };
+    bigger.bits = ix->cap ? ix->bits + 1 : 6;
+    bigger.cap = (size_t)1 << bigger.bits;
+    bigger.keys = calloc(bigger.cap, sizeof(int));
+    bigger.vals = calloc(bigger.cap, sizeof(job_t *));
+    if (!bigger.keys || !bigger.vals) {
+        free(bigger.keys);
+        free(bigger.vals);
+        return -1;
+    }
+    for (size_t i = 0; i < ix->cap; i++) {
+        if (ix->keys[i]) {
+            index_put(&bigger, ix->keys[i], ix->vals[i]);
         }
     }
-    return max_id + 1;
+    free(ix->keys);
+    free(ix->vals);
+    *ix = bigger;
+    return 0;
 }
 
-void jobs_init(void) {
-    memset(jobs, 0, sizeof(jobs));  // clear all job entries
+static int index_put(job_index_t *ix, int key, job_t *job) {
+    // insert or replace, a reused pid/pgid points at the newest job
+    if ((ix->count + 1) * 2 > ix->cap && index_grow(ix) < 0) {
+        return -1;
+    }
+    size_t i = index_slot(ix, key);
+    while (ix->keys[i] && ix->keys[i] != key) {
+        i = (i + 1) & (ix->cap - 1);
+    }
+    if (!ix->keys[i]) {
+        ix->count++;
+    }
+    ix->keys[i] = key;
+    ix->vals[i] = job;
+    return 0;
 }
 
-int add_job(pid_t pgid, const char *cmdline, job_state_t state) {
-    int index = find_job_slot();
-    if (index < 0) {
-        return -1; // job table is full
+static void index_del(job_index_t *ix, int key, const job_t *job) {
+    // remove key only if it still belongs to job
+    if (!ix->cap) {
+        return;
+    }
+    size_t i = index_slot(ix, key);
+    while (ix->keys[i] != key) {
+        if (!ix->keys[i]) {
+            return;
+        }
+        i = (i + 1) & (ix->cap - 1);
+    }
+    if (ix->vals[i] != job) {
+        return;
     }
-    jobs[index].used = 1;
 
-    jobs[index].pgid = pgid;
-    // printf("Job added with PGID: %d", pgid);
+    // shift later members of the probe run back into the hole
+    size_t hole = i;
+    for (size_t j = (i + 1) & (ix->cap - 1); ix->keys[j]; j = (j + 1) & (ix->cap - 1)) {
+        size_t home = index_slot(ix, ix->keys[j]);
+        // move j if its home slot isn't cyclically within (hole, j]
+        if ((j > hole && (home <= hole || home > j)) || (j < hole && home <= hole && home > j)) {
+            ix->keys[hole] = ix->keys[j];
+            ix->vals[hole] = ix->vals[j];
+            hole = j;
+        }
+    }
+    ix->keys[hole] = 0;
+    ix->vals[hole] = NULL;
+    ix->count--;
+}
 
-    jobs[index].state = state;
-    jobs[index].job_id = get_next_jobID();
-    jobs[index].is_bg = 0; // default to fg
+static void unlink_active(job_t *job) {
+    // job finished, it can no longer be the '+' job
+    if (!job->active) {
+        return;
+    }
+    if (job->prev_active) {
+        job->prev_active->next_active = job->next_active;
+    } else {
+        active_head = job->next_active;
+    }
+    if (job->next_active) {
+        job->next_active->prev_active = job->prev_active;
+    } else {
+        active_tail = job->prev_active;
+    }
+    job->prev_active = job->next_active = NULL;
+    job->active = 0;
+}
 
-    // save original command line safely
-    strncpy(jobs[index].cmdline, cmdline, sizeof(jobs[index].cmdline) - 1); 
-    jobs[index].cmdline[sizeof(jobs[index].cmdline) - 1] = '\0';            
-    return index;
+// return next job id, ascending order so job numbers assigned sequentially
+static int get_next_jobID(void) {
+    // the tail holds the highest ID in the table
+    return all_tail ? all_tail->job_id + 1 : 1;
 }
 
-void remove_job(int index) {
-    // job finished
-    jobs[index].used = 0;
-    jobs[index].pgid = 0;
-    jobs[index].cmdline[0] = '\0';
-    jobs[index].state = DONE;
-    jobs[index].job_id = 0;
+void jobs_init(void) {
+    // clear all job entries
+    memset(&by_pid, 0, sizeof(by_pid));
+    memset(&by_pgid, 0, sizeof(by_pgid));
+    memset(&by_id, 0, sizeof(by_id));
+    all_head = all_tail = NULL;
+    active_head = active_tail = NULL;
 }
 
-int find_job_PGID(pid_t pgid) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].used && jobs[i].pgid == pgid) {
-            return i;
+job_t *add_job(const char *cmdline, job_state_t state) {
+    // new job with no processes yet, the first one added leads the process group
+    job_t *job = calloc(1, sizeof(job_t));
+    if (!job) {
+        return NULL;
+    }
+    // save original command line
+    job->cmdline = strdup(cmdline);
+    if (!job->cmdline) {
+        free(job);
+        return NULL;
+    }
+
+    job->state = state;
+    job->pidfd = -1;
+    job->job_id = get_next_jobID();
+    job->is_bg = 0; // default to fg
+
+    if (index_put(&by_id, job->job_id, job) < 0) {
+        free(job->cmdline);
+        free(job);
+        return NULL;
+    }
+
+    // highest ID so far, append to both lists
+    job->prev = all_tail;
+    if (all_tail) {
+        all_tail->next = job;
+    } else {
+        all_head = job;
+    }
+    all_tail = job;
+
+    if (state != DONE) {
+        job->prev_active = active_tail;
+        if (active_tail) {
+            active_tail->next_active = job;
+        } else {
+            active_head = job;
         }
+        active_tail = job;
+        job->active = 1;
     }
-    return -1;
-    
+    stats_job_added();
+    return job;
 }
 
+int add_job_process(job_t *job, pid_t pid) {
+    // append a launched pipeline stage to the job
+    if (job->nprocs == job->procs_cap) {
+        int cap = job->procs_cap ? job->procs_cap * 2 : 2;
+        process_t *procs = realloc(job->procs, cap * sizeof(process_t));
+        if (!procs) {
+            return -1;
+        }
+        job->procs = procs;
+        job->procs_cap = cap;
+    }
+    if (index_put(&by_pid, pid, job) < 0) {
+        return -1;
+    }
+    if (job->nprocs == 0) {
+        // first stage leads the process group
+        if (index_put(&by_pgid, pid, job) < 0) {
+            index_del(&by_pid, pid, job);
+            return -1;
+        }
+        job->pgid = pid;
+    }
 
+    job->procs[job->nprocs].pid = pid;
+    job->procs[job->nprocs].state = RUNNING;
+    job->procs[job->nprocs].status = 0;
+    memset(&job->procs[job->nprocs].usage, 0, sizeof(struct rusage));
+    job->procs[job->nprocs].started = TRACE_START();
+    job->procs[job->nprocs].placement[0] = '\0';
+    job->nprocs++;
+    return 0;
+}
 
-int find_job_ID(int job_id) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].used && jobs[i].job_id == job_id) {
-            return i;
-        }
+static void close_pidfd(job_t *job) {
+    if (job->pidfd >= 0) {
+        events_pidfd_close(job->pidfd);
+        job->pidfd = -1;
     }
-    return -1;
 }
 
-int most_recent_job(void) {
-    // for finding the most recently created job for '+' denotion
-    int max_index = -1;
-    int max_id = -1;
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].used && jobs[i].state != DONE && jobs[i].job_id > max_id) {
-            max_id = jobs[i].job_id;
-            max_index = i;
+void jobs_forget_fds(void) {
+    // in a forked child the pidfds are gone (closed like on exec), and
+    // the parent's jobs are not our children anyway
+    for (job_t *job = all_head; job; job = job->next) {
+        job->pidfd = -1;
+    }
+}
+
+void watch_job(job_t *job) {
+    // wake the event loop directly when the last stage, whose status is the job's, exits
+    if (job->nprocs == 0) {
+        return;
+    }
+    job->pidfd_pid = job->procs[job->nprocs - 1].pid;
+    job->pidfd = events_pidfd_open(job->pidfd_pid);
+}
+
+void remove_job(job_t *job) {
+    // job finished
+    close_pidfd(job);
+    for (int i = 0; i < job->nprocs; i++) {
+        index_del(&by_pid, job->procs[i].pid, job);
+    }
+    if (job->pgid) {
+        index_del(&by_pgid, job->pgid, job);
+    }
+    index_del(&by_id, job->job_id, job);
+    unlink_active(job);
+
+    if (job->prev) {
+        job->prev->next = job->next;
+    } else {
+        all_head = job->next;
+    }
+    if (job->next) {
+        job->next->prev = job->prev;
+    } else {
+        all_tail = job->prev;
+    }
+
+    free(job->procs);
+    free(job->cmdline);
+    free(job);
+    stats_job_removed();
+}
+
+void jobs_forget(void) {
+    // a forked child that takes commands of its own starts with no jobs,
+    // call after jobs_forget_fds so the parent's pidfds are left alone
+    while (all_head) {
+        remove_job(all_head);
+    }
+    memset(saved, 0, sizeof(saved));
+    saved_next = 0;
+}
+
+// recompute a job's state from its processes
+// done once every stage exited, stopped once nothing is left running
+static void refresh_job_state(job_t *job) {
+    job_state_t was = job->state;
+    int running = 0, stopped = 0;
+    for (int i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].state == RUNNING) {
+            running++;
+        } else if (job->procs[i].state == STOPPED) {
+            stopped++;
+        }
+    }
+
+    if (running) {
+        job->state = RUNNING;
+    } else if (stopped) {
+        job->state = STOPPED;
+        if (was != STOPPED) {
+            shell_stats.jobs_stopped++;
+        }
+    } else {
+        job->state = DONE;
+        unlink_active(job);
+        if (was != DONE) {
+            shell_stats.jobs_reaped++;
         }
     }
-    return max_index;
 }
 
-void run_jobs(void) {
-    // get used jobs into a list
-    int used_list[MAX_JOBS];
-    int used_count = 0;
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].used) {
-            used_list[used_count++] = i;
+// mark every live process of a job as running again after SIGCONT
+static void mark_job_running(job_t *job) {
+    for (int i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].state == STOPPED) {
+            job->procs[i].state = RUNNING;
+            trace_instant(TRACE_CONTINUE, job->procs[i].pid, job->cmdline);
         }
     }
+    job->state = RUNNING;
+}
 
-    // sort used jobs by ascending ID
-    for (int i = 0; i < used_count - 1; i++) {
-        for (int j = i + 1; j < used_count; j++) {
-            int idx_i = used_list[i];
-            int idx_j = used_list[j];
-            if (jobs[idx_i].job_id > jobs[idx_j].job_id) {
-                int temp = used_list[i];
-                used_list[i] = used_list[j];
-                used_list[j] = temp;
+void update_job_status(pid_t pid, int status, const struct rusage *usage) {
+    // record a wait status reported for one child, with its resource usage once it exited
+    job_t *job = index_get(&by_pid, pid);
+    if (!job) {
+        return;
+    }
+    for (int p = 0; p < job->nprocs; p++) {
+        if (job->procs[p].pid != pid || job->procs[p].state == DONE) {
+            continue;
+        }
+        job->procs[p].status = status;
+        if (WIFSTOPPED(status)) {
+            job->procs[p].state = STOPPED;
+            trace_instant(TRACE_STOP, pid, job->cmdline);
+        } else if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (trace_enabled) {
+                trace_instant(TRACE_REAP, pid, job->cmdline);
+                if (job->procs[p].started) {
+                    trace_complete(TRACE_RUN, job->procs[p].started, trace_now(), pid, job->cmdline);
+                }
+            }
+            // reaped, the pid may be reused from now on
+            job->procs[p].state = DONE;
+            job->procs[p].usage = *usage;
+            index_del(&by_pid, pid, job);
+            if (pid == job->pidfd_pid) {
+                close_pidfd(job);   // would stay readable forever
             }
         }
+        refresh_job_state(job);
+        return;
+    }
+}
+
+void job_rusage(const job_t *job, struct rusage *total) {
+    // sum the usage of a job's exited processes, max RSS is the largest stage
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < job->nprocs; i++) {
+        const struct rusage *ru = &job->procs[i].usage;
+        timeradd(&total->ru_utime, &ru->ru_utime, &total->ru_utime);
+        timeradd(&total->ru_stime, &ru->ru_stime, &total->ru_stime);
+        if (ru->ru_maxrss > total->ru_maxrss) {
+            total->ru_maxrss = ru->ru_maxrss;
+        }
+        total->ru_minflt += ru->ru_minflt;
+        total->ru_majflt += ru->ru_majflt;
+        total->ru_nvcsw += ru->ru_nvcsw;
+        total->ru_nivcsw += ru->ru_nivcsw;
+    }
+}
+
+static void print_rusage(const char *label, const struct rusage *ru, const char *placement) {
+    // one line of 'jobs -l' usage, with the process's placement if it has one
+    printf("      %-14s user %ld.%03lds  sys %ld.%03lds  maxrss %ldkB  flt %ld/%ld  ctxsw %ld/%ld%s%s\n",
+           label,
+           (long)ru->ru_utime.tv_sec, (long)ru->ru_utime.tv_usec / 1000,
+           (long)ru->ru_stime.tv_sec, (long)ru->ru_stime.tv_usec / 1000,
+           ru->ru_maxrss, ru->ru_minflt, ru->ru_majflt, ru->ru_nvcsw, ru->ru_nivcsw,
+           *placement ? "  " : "", placement);
+}
+
+static void print_job_usage(const job_t *job) {
+    // per process usage, then the job total
+    static const char *state_names[] = { "Running", "Stopped", "Done" };
+    char label[32];
+
+    for (int i = 0; i < job->nprocs; i++) {
+        snprintf(label, sizeof(label), "%d %s", (int)job->procs[i].pid, state_names[job->procs[i].state]);
+        print_rusage(label, &job->procs[i].usage, job->procs[i].placement);
+    }
+
+    struct rusage total;
+    job_rusage(job, &total);
+    print_rusage("total", &total, "");
+}
+
+static int exit_status(int status) {
+    // a wait status as $? would show it
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    if (WIFSTOPPED(status)) {
+        return 128 + WSTOPSIG(status);
+    }
+    return 0;
+}
+
+int job_status(const job_t *job) {
+    // exit status of the job as $? would show it, taken from the last stage
+    if (job->nprocs == 0) {
+        return 127;
     }
+    return exit_status(job->procs[job->nprocs - 1].status);
+}
+
+int wait_fg_job(job_t *job, struct rusage *usage) {
+    // hand the terminal to the job and block until it stops or every stage exits
+    // usage, if given, gets the summed usage of the stages that exited
+    // returns the job's exit status
+    if (job_control) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    }
+
+    // the event loop reaps children and updates the job
+    while (job->state == RUNNING) {
+        events_wait(-1);
+    }
+
+    // restore terminal to shell
+    if (job_control) {
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+    }
+
+    if (usage) {
+        job_rusage(job, usage);
+    }
+    int status = job_status(job);
+
+    // if exited or killed, remove from job table
+    if (job->state == DONE) {
+        remove_job(job);
+    }
+    return status;
+}
+
+job_t *find_job_PGID(pid_t pgid) {
+    return index_get(&by_pgid, pgid);
+}
+
+
+
+static void save_statuses(const job_t *job) {
+    // the job is leaving the table before anyone waited for it
+    for (int i = 0; i < job->nprocs; i++) {
+        saved[saved_next].pid = job->procs[i].pid;
+        saved[saved_next].status = exit_status(job->procs[i].status);
+        saved_next = (saved_next + 1) % SAVED_MAX;
+    }
+}
+
+job_t *find_job_spec(const char *spec) {
+    // %N, %+ / %% / % for the current job, %- for the one before it
+    if (spec[0] != '%') {
+        return NULL;
+    }
+    const char *id = spec + 1;
+    if (!*id || strcmp(id, "+") == 0 || strcmp(id, "%") == 0) {
+        return most_recent_job();
+    }
+    if (strcmp(id, "-") == 0) {
+        return active_tail ? active_tail->prev_active : NULL;
+    }
+    char *end;
+    long n = strtol(id, &end, 10);
+    return (*end || n <= 0 || n > INT32_MAX) ? NULL : find_job_ID((int)n);
+}
+
+job_t *find_job_ID(int job_id) {
+    return index_get(&by_id, job_id);
+}
+
+job_t *most_recent_job(void) {
+    // for finding the most recently created job for '+' denotion
+    return active_tail;
+}
 
+void run_jobs(int long_format) {
+    // jobs are kept in ascending ID order, no sorting needed
+    // 'jobs -l' adds each process with its resource usage
     // find most recent jobs (with highest ID)
-    int idx_recent = most_recent_job();
-    int recent_id  = (idx_recent >= 0) ? jobs[idx_recent].job_id : -1;
+    job_t *recent = most_recent_job();
 
     // print in ascending ID order
-    for (int x = 0; x < used_count; x++) {
-        int i = used_list[x];
+    job_t *next;
+    for (job_t *job = all_head; job; job = next) {
+        next = job->next;
 
-        char marker = (jobs[i].job_id == recent_id) ? '+' : '-';
+        char marker = (job == recent) ? '+' : '-';
 
-        switch (jobs[i].state) {
+        switch (job->state) {
             case DONE:
                 // print once on the next jobs call
-                if (jobs[i].is_bg) {
+                if (job->is_bg) {
                     // show '&' for background
-                    printf("[%d]%c  Done       %s&\n", jobs[i].job_id, marker, jobs[i].cmdline);
+                    printf("[%d]%c  Done       %s&\n", job->job_id, marker, job->cmdline);
                 } else {
                     // foreground finished
-                    printf("[%d]%c  Done       %s\n", jobs[i].job_id, marker, jobs[i].cmdline);
+                    printf("[%d]%c  Done       %s\n", job->job_id, marker, job->cmdline);
                 }
 
-                // remove for the next jobs call
-                remove_job(i);
+                // removed below, after the -l listing
                 break;
 
             case RUNNING:
-                if (jobs[i].is_bg) {
+                if (job->is_bg) {
                     // show '&' for background
-                    printf("[%d]%c  Running    %s&\n", jobs[i].job_id, marker, jobs[i].cmdline);
+                    printf("[%d]%c  Running    %s&\n", job->job_id, marker, job->cmdline);
                 } else {
                     // foreground
-                    printf("[%d]%c  Running    %s\n", jobs[i].job_id, marker, jobs[i].cmdline);
+                    printf("[%d]%c  Running    %s\n", job->job_id, marker, job->cmdline);
                 }
                 break;
 
             case STOPPED:
-                printf("[%d]%c  Stopped    %s\n", jobs[i].job_id, marker, jobs[i].cmdline);
+                printf("[%d]%c  Stopped    %s\n", job->job_id, marker, job->cmdline);
                 break;
         }
+
+        if (long_format) {
+            print_job_usage(job);
+        }
+
+        // done jobs are printed once, remove for the next jobs call
+        if (job->state == DONE) {
+            save_statuses(job);
+            remove_job(job);
+        }
     }
 }
 
-void run_fg(int job_id) {
+int run_fg(int job_id) {
     // user runs 'fg'
     // bring job into foreground / resume stopped/bg process
     // wait for completion and handle process state updates
 
+    if (!job_control) {
+        fprintf(stderr, "fg: no job control\n");
+        return 1;
+    }
+
     // if job ID is specified, use that, if not resume most recent
-    int idx;
+    job_t *job;
     if (job_id > 0) {
-        idx = find_job_ID(job_id);
+        job = find_job_ID(job_id);
     } else {
-        idx = most_recent_job();
+        job = most_recent_job();
     }
-    if (idx < 0) {
+    if (!job || job->state == DONE) {
         fprintf(stderr, "fg: no current job\n");
-        return;
+        return 1;
     }
 
     // jobs command line
-    printf("%s\n", jobs[idx].cmdline);
+    printf("%s\n", job->cmdline);
     fflush(stdout);
 
     // update state and bg
-    jobs[idx].is_bg = 0;
-    jobs[idx].state = RUNNING;
-
-    // terminal control to the fg job
-    tcsetpgrp(STDIN_FILENO, jobs[idx].pgid);
+    job->is_bg = 0;
+    mark_job_running(job);
 
     // resume all processes in jobs process group
-    kill(-jobs[idx].pgid, SIGCONT);
-
-    // blocking wait, waitpid on the PGID
-    int status;
-    pid_t wpid;
-    do {
-        wpid = waitpid(-jobs[idx].pgid, &status, WUNTRACED);    // negative for pgid
-        if (wpid == -1 && errno == ECHILD) {
-            break;
-        }
-    } while (!WIFEXITED(status) && !WIFSIGNALED(status) && !WIFSTOPPED(status));
+    kill(-job->pgid, SIGCONT);
 
-    tcsetpgrp(STDIN_FILENO, shell_pgid);
-
-    // if exited or killed, remove from job table
-    if (WIFEXITED(status) || WIFSIGNALED(status)) {
-        remove_job(idx);
-    } else if (WIFSTOPPED(status)) {    // if stopped update state
-        jobs[idx].state = STOPPED;
-    }
+    return wait_fg_job(job, NULL);
 }
 
 // void run_bg(int job_id) {
@@ -243,73 +636,242 @@ void run_fg(int job_id) {
 //     jobs[idx].state = RUNNING;
 //     kill(-jobs[idx].pgid, SIGCONT);
 // }
+int run_bg(int job_id) {
+    if (!job_control) {
+        fprintf(stderr, "bg: no job control\n");
+        return 1;
+    }
 
-void run_bg(int job_id) {
     // Find specified job (or most recent)
-    int idx = (job_id > 0) ? find_job_ID(job_id) : most_recent_job();
-    if (idx < 0) {
+    job_t *job = (job_id > 0) ? find_job_ID(job_id) : most_recent_job();
+    if (!job) {
         fprintf(stderr, "bg: no current job\n");
-        return;
+        return 1;
     }
 
     // Only resume if the job is STOPPED
-    if (jobs[idx].state == STOPPED) {
-        // remove newline from the job’s command line
-        char *cmd = jobs[idx].cmdline;
-        size_t len = strlen(cmd);
-        if (len > 0 && cmd[len - 1] == '\n') {
-            cmd[len - 1] = '\0';
-        }
-        printf("[%d]+ %s &\n", jobs[idx].job_id, cmd);
+    if (job->state == STOPPED) {
+        printf("[%d]+ %s &\n", job->job_id, job->cmdline);
 
         // mark as running and bg
-        jobs[idx].is_bg = 1;
-        jobs[idx].state = RUNNING;
+        job->is_bg = 1;
+        mark_job_running(job);
 
         // send continue
-        kill(-jobs[idx].pgid, SIGCONT);
+        kill(-job->pgid, SIGCONT);
+        return 0;
     } else {
         // job done or dne
         fprintf(stderr, "bg: no current job\n");
+        return 1;
     }
 }
 
 
 
-void sigchld_handler(int sig) {
+static job_t *job_of_pid(pid_t pid) {
+    // the job pid was a stage of: live, or exited and still in the table
+    job_t *job = index_get(&by_pid, pid);
+    for (job_t *j = all_tail; j && !job; j = j->prev) {
+        for (int i = 0; i < j->nprocs && !job; i++) {
+            if (j->procs[i].pid == pid) {
+                job = j;
+            }
+        }
+    }
+    return job;
+}
+
+static int saved_status(pid_t pid) {
+    // a pid whose job was already reported, newest first, -1 if there is none
+    for (int k = 1; k <= SAVED_MAX; k++) {
+        int i = (saved_next - k + SAVED_MAX) % SAVED_MAX;
+        if (saved[i].pid == pid) {
+            saved[i].pid = 0;   // waited for, like any other
+            return saved[i].status;
+        }
+    }
+    return -1;
+}
+
+static int wait_for_pid(pid_t pid) {
+    // 'wait PID': a live stage of a job, an exited one still in the table,
+    // or one whose job was already reported; -1 if interrupted
+    job_t *job = job_of_pid(pid);
+    for (int i = 0; job && i < job->nprocs; i++) {
+        if (job->procs[i].pid != pid) {
+            continue;
+        }
+        while (job->procs[i].state == RUNNING) {
+            if (events_wait(-1) < 0) {
+                return -1;
+            }
+        }
+        return exit_status(job->procs[i].status);
+    }
+    int status = saved_status(pid);
+    if (status >= 0) {
+        return status;
+    }
+    fprintf(stderr, "wait: pid %d is not a child of this shell\n", (int)pid);
+    return 127;
+}
+
+static int wait_for_job(job_t *job) {
+    // 'wait %N': until it finishes or stops, a finished job is then forgotten
+    // -1 if interrupted
+    while (job->state == RUNNING) {
+        if (events_wait(-1) < 0) {
+            return -1;
+        }
+    }
+    int status = job_status(job);
+    if (job->state == DONE) {
+        remove_job(job);
+    }
+    return status;
+}
+
+static int wait_for_any(job_t **only, int n) {
+    // 'wait -n': the first of the jobs (or of all jobs if n is 0) to finish,
+    // one that already finished counts, 127 if there is nothing to wait for, -1 if interrupted
+    for (;;) {
+        int running = 0;
+        for (job_t *job = all_head; job; job = job->next) {
+            int chosen = (n == 0);
+            for (int i = 0; i < n && !chosen; i++) {
+                chosen = (only[i] == job);
+            }
+            if (!chosen) {
+                continue;
+            }
+            if (job->state == DONE) {
+                int status = job_status(job);
+                remove_job(job);
+                return status;
+            }
+            running |= (job->state == RUNNING);
+        }
+        if (!running) {
+            return 127;
+        }
+        if (events_wait(-1) < 0) {
+            return -1;
+        }
+    }
+}
+
+int run_wait(char **args) {
+    // wait               every running job, finished ones are forgotten, returns 0
+    // wait %job|PID...   each in turn, returns the last one's status
+    // wait -n [%job...]  the next one to finish, returns its status
+    // blocks in the event loop, woken by SIGCHLD and the jobs' pidfds; Ctrl-C stops it
+    int next = args[1] && strcmp(args[1], "-n") == 0;
+    char **ids = args + 1 + next;
+
+    if (next) {
+        int n = 0;
+        while (ids[n]) {
+            n++;
+        }
+        job_t **only = calloc(n ? n : 1, sizeof(job_t *));
+        if (!only) {
+            perror("wait");
+            return 1;
+        }
+        for (int i = 0; i < n; i++) {
+            char *end;
+            long pid = strtol(ids[i], &end, 10);
+            int valid = ids[i][0] != '%' && !*end && pid > 0 && pid <= INT32_MAX;
+            only[i] = (ids[i][0] == '%') ? find_job_spec(ids[i]) : valid ? job_of_pid(pid) : NULL;
+            int status = (!only[i] && valid) ? saved_status(pid) : -1;
+            if (status >= 0) {
+                // it finished and was reported before the wait, that counts as first
+                free(only);
+                return status;
+            }
+            if (!only[i]) {
+                fprintf(stderr, "wait: %s: no such job\n", ids[i]);
+                free(only);
+                return 127;
+            }
+        }
+        int status = wait_for_any(only, n);
+        free(only);
+        return status < 0 ? 128 + SIGINT : status;
+    }
+
+    if (!ids[0]) {
+        for (job_t *job = active_head; job; ) {
+            if (job->state != RUNNING) {
+                job = job->next_active;
+            } else if (events_wait(-1) < 0) {
+                return 128 + SIGINT;
+            } else {
+                job = active_head;  // the list changes as jobs finish
+            }
+        }
+        job_t *next_job;
+        for (job_t *job = all_head; job; job = next_job) {
+            next_job = job->next;
+            if (job->state == DONE && job->is_bg) {
+                remove_job(job);
+            }
+        }
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 0; ids[i]; i++) {
+        if (ids[i][0] == '%') {
+            job_t *job = find_job_spec(ids[i]);
+            if (!job) {
+                fprintf(stderr, "wait: %s: no such job\n", ids[i]);
+                status = 127;
+                continue;
+            }
+            status = wait_for_job(job);
+        } else {
+            char *end;
+            long pid = strtol(ids[i], &end, 10);
+            if (*end || pid <= 0 || pid > INT32_MAX) {
+                fprintf(stderr, "wait: %s: not a pid or valid job spec\n", ids[i]);
+                status = 2;
+                continue;
+            }
+            status = wait_for_pid((pid_t)pid);
+        }
+        if (status < 0) {
+            return 128 + SIGINT;    // interrupted, not waiting for the rest
+        }
+    }
+    return status;
+}
+
+void handle_sigchld(void) {
     // handle child process state changes
+    // called from the event loop, the only place jobs change state
 
     int status;
     pid_t child_pid;
+    struct rusage usage;
 
-    // get all children with changed state
-    while ((child_pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {   
-        // printf("child process %d changed state w status: %d\n", child_pid, status);
-
-        int idx = find_job_PGID(child_pid);        // find corresponding child (getpgid(child_PID))
-        if (idx < 0) {
-            continue;
-        }
+    shell_stats.sigchld_wakeups++;
 
-        if (WIFSTOPPED(status)) {
-            // printf("job %d (pgid: %d) stopped\n", idx, jobs[idx].pgid);
-            jobs[idx].state = STOPPED;
-        } else if (WIFEXITED(status)) {
-            // printf("job %d (pgid: %d) exited normally\n", idx, jobs[idx].pgid);
-            jobs[idx].state = DONE;
-        } else if (WIFSIGNALED(status)) {
-            // printf("job %d (pgid: %d) killed by signal\n", idx, jobs[idx].pgid);
-            jobs[idx].state = DONE;
+    // get all children with changed state, wait4 also reports what an exited child used
+    while ((child_pid = wait4(-1, &status, WNOHANG | WUNTRACED, &usage)) > 0) {
+        if (!WIFSTOPPED(status)) {
+            shell_stats.children_reaped++;
         }
+        // find the job owning this pid and update its stage
+        update_job_status(child_pid, status, &usage);
     }
 }
 
 
-void sigtstp_handler(int sig) {
+void handle_sigtstp(void) {
     // stop foreground process with ctrl z is pressed
 
-    (void)sig;
-    
     pid_t fg_pgid = tcgetpgrp(STDIN_FILENO);    // get foreground process group
     if (fg_pgid != shell_pgid) {
         kill(-fg_pgid, SIGTSTP);    // stop foreground process, not entire shell
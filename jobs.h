@@ -2,8 +2,7 @@
 #define JOBS_H
 
 #include <sys/types.h>
-
-#define MAX_JOBS 40
+#include <sys/resource.h>
 
 // job states
 typedef enum {
@@ -12,32 +11,63 @@ typedef enum {
     DONE
 } job_state_t;
 
-
+// one process of a job (a pipeline stage)
 typedef struct {
-    int used;
+    pid_t pid;
+    job_state_t state;
+    int status; // last wait status
+    struct rusage usage; // filled in by wait4 once the process exited
+    long long started; // trace_now() at launch when tracing, else 0
+    char placement[64]; // 'cpus' placement as 'jobs -l' shows it, "" if none
+} process_t;
+
+typedef struct job {
     int job_id;
     pid_t pgid;
     job_state_t state;
     int is_bg; // background or foreground
-    char cmdline[200]; // store the command line
-} job_t;
+    char *cmdline; // store the command line
+    process_t *procs; // processes of the pipeline, in stage order
+    int nprocs;
+    int procs_cap;
+    int pidfd; // pidfd of the last stage, -1 if none
+    pid_t pidfd_pid;
 
-extern job_t jobs[MAX_JOBS];
+    // every job in ascending job ID order
+    struct job *prev;
+    struct job *next;
+
+    // jobs that are not done yet in ascending job ID order, the tail is '+'
+    struct job *prev_active;
+    struct job *next_active;
+    int active;
+} job_t;
 
 void jobs_init(void);
-int add_job(pid_t pgid, const char *cmdline, job_state_t state);
-void remove_job(int index);
-int find_job_PGID(pid_t pgid);
-int find_job_ID(int job_id);
-int most_recent_job(void);
-void run_jobs(void);
-void run_fg(int job_id);
-void run_bg(int job_id);
-void sigchld_handler(int sig);
-void sigtstp_handler(int sig);
-
-
-// shell's PGID accessor 
+job_t *add_job(const char *cmdline, job_state_t state);
+int add_job_process(job_t *job, pid_t pid);
+void update_job_status(pid_t pid, int status, const struct rusage *usage);
+void job_rusage(const job_t *job, struct rusage *total);
+int job_status(const job_t *job);
+int wait_fg_job(job_t *job, struct rusage *usage);
+void remove_job(job_t *job);
+job_t *find_job_PGID(pid_t pgid);
+job_t *find_job_ID(int job_id);
+job_t *find_job_spec(const char *spec);
+job_t *most_recent_job(void);
+void run_jobs(int long_format);
+int run_fg(int job_id);
+int run_bg(int job_id);
+int run_wait(char **args);
+void watch_job(job_t *job);
+void jobs_forget_fds(void);
+void jobs_forget(void);
+void handle_sigchld(void);
+void handle_sigtstp(void);
+
+
+// shell's PGID accessor
 extern pid_t shell_pgid;
+extern int job_control;
 
 #endif
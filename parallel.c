@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "parallel.h"
+#include "jobs.h"
+#include "spawn.h"
+#include "events.h"
+#include "cmdhash.h"
+#include "trace.h"
+#include "stats.h"
+
+#define READ_CHUNK 65536
+
+// one of the -j slots
+typedef struct {
+    job_t *job;     // NULL when free
+    int out_fd;     // memfds holding the job's output with -g, -1 otherwise
+    int err_fd;
+} slot_t;
+
+// work items, one per line
+typedef struct {
+    int fd;
+    char *buf;
+    size_t cap;
+    size_t start;
+    size_t end;
+    int eof;
+} item_reader_t;
+
+static int next_item(item_reader_t *r, char **item) {
+    // next line without its newline, returns 1, 0 at EOF, -1 on SIGINT
+    for (;;) {
+        char *nl = NULL;
+        if (r->end > r->start) {
+            nl = memchr(r->buf + r->start, '\n', r->end - r->start);
+        }
+        if (nl || (r->eof && r->end > r->start)) {
+            if (!nl) {
+                nl = r->buf + r->end;   // last line without a newline, cap has room
+                r->end++;
+            }
+            *nl = '\0';
+            *item = r->buf + r->start;
+            r->start = nl - r->buf + 1;
+            return 1;
+        }
+        if (r->eof) {
+            return 0;
+        }
+
+        // slide the partial line down and make room for another chunk
+        if (r->start > 0) {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->start = 0;
+        }
+        if (r->cap - r->end <= READ_CHUNK) {
+            size_t cap = r->cap ? r->cap * 2 : READ_CHUNK * 2;
+            char *bigger = realloc(r->buf, cap);
+            if (!bigger) {
+                return 0;
+            }
+            r->buf = bigger;
+            r->cap = cap;
+        }
+
+        // jobs keep being reaped while we wait for input
+        if (events_wait(r->fd) < 0) {
+            return -1;
+        }
+        ssize_t n = read(r->fd, r->buf + r->end, r->cap - r->end - 1);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (n <= 0) {
+            r->eof = 1;
+        } else {
+            r->end += n;
+        }
+    }
+}
+
+static char **build_argv(char **tmpl, int ntmpl, const char *item, char **argv) {
+    // every "{}" in the template is replaced by item, without any the item is appended
+    // argv has room for ntmpl + 2 entries, substituted words are malloc'd
+    int substituted = 0;
+    size_t item_len = strlen(item);
+
+    for (int i = 0; i < ntmpl; i++) {
+        const char *p = strstr(tmpl[i], "{}");
+        if (!p) {
+            argv[i] = tmpl[i];
+            continue;
+        }
+
+        int count = 0;
+        for (; p; p = strstr(p + 2, "{}")) {
+            count++;
+        }
+        char *word = malloc(strlen(tmpl[i]) + count * item_len + 1);
+        if (!word) {
+            return NULL;
+        }
+        char *w = word;
+        const char *s = tmpl[i];
+        for (p = strstr(s, "{}"); p; s = p + 2, p = strstr(s, "{}")) {
+            memcpy(w, s, p - s);
+            w += p - s;
+            memcpy(w, item, item_len);
+            w += item_len;
+        }
+        strcpy(w, s);
+        argv[i] = word;
+        substituted = 1;
+    }
+
+    int argc = ntmpl;
+    if (!substituted) {
+        argv[argc++] = (char *)item;
+    }
+    argv[argc] = NULL;
+    return argv;
+}
+
+static void free_argv(char **tmpl, int ntmpl, char **argv) {
+    for (int i = 0; i < ntmpl; i++) {
+        if (argv[i] != tmpl[i]) {
+            free(argv[i]);
+        }
+    }
+}
+
+static char *join_args(char **argv) {
+    // command line shown in the job table
+    size_t len = 1;
+    for (int i = 0; argv[i]; i++) {
+        len += strlen(argv[i]) + 1;
+    }
+    char *line = malloc(len);
+    if (!line) {
+        return NULL;
+    }
+    char *p = line;
+    for (int i = 0; argv[i]; i++) {
+        if (i > 0) {
+            *p++ = ' ';
+        }
+        size_t n = strlen(argv[i]);
+        memcpy(p, argv[i], n);
+        p += n;
+    }
+    *p = '\0';
+    return line;
+}
+
+static void copy_output(int from, int to) {
+    // write a finished job's grouped output in one piece
+    struct stat st;
+    if (fstat(from, &st) < 0) {
+        return;
+    }
+    off_t off = 0;
+    while (off < st.st_size) {
+        ssize_t n = sendfile(to, from, &off, st.st_size - off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            break;  // O_APPEND and some other targets refuse sendfile
+        }
+        if (n <= 0) {
+            return;
+        }
+    }
+
+    char buf[8192];
+    while (off < st.st_size) {
+        ssize_t n = pread(from, buf, sizeof(buf), off);
+        if (n <= 0 || write(to, buf, n) != n) {
+            return;
+        }
+        off += n;
+    }
+}
+
+static void close_slot(slot_t *slot) {
+    if (slot->out_fd >= 0) {
+        close(slot->out_fd);
+    }
+    if (slot->err_fd >= 0) {
+        close(slot->err_fd);
+    }
+    slot->job = NULL;
+    slot->out_fd = slot->err_fd = -1;
+}
+
+static int launch(slot_t *slot, const char *path, char **argv, int devnull, int group) {
+    // start one work item in slot, returns 0 or the exit status it failed with
+    if (group) {
+        slot->out_fd = memfd_create("parallel-out", MFD_CLOEXEC);
+        slot->err_fd = memfd_create("parallel-err", MFD_CLOEXEC);
+        if (slot->out_fd < 0 || slot->err_fd < 0) {
+            perror("parallel: memfd_create");
+            close_slot(slot);
+            return 1;
+        }
+    }
+
+    char *cmdline = join_args(argv);
+    job_t *job = cmdline ? add_job(cmdline, RUNNING) : NULL;
+    free(cmdline);
+    if (!job) {
+        perror("parallel");
+        close_slot(slot);
+        return 1;
+    }
+
+    // with job control each item gets its own group, none of them owns the terminal
+    spawn_req_t req;
+    spawn_req_init(&req, argv, job_control ? 0 : -1, 0, events_child_mask());
+    req.path = path;
+    spawn_add_dup(&req, devnull, STDIN_FILENO);
+    if (group) {
+        spawn_add_dup(&req, slot->out_fd, STDOUT_FILENO);
+        spawn_add_dup(&req, slot->err_fd, STDERR_FILENO);
+    }
+    long long t_spawn = trace_now();
+    pid_t pid = spawn_start(&req);
+    spawn_req_free(&req);
+
+    if (pid < 0) {
+        stats_exec_failed(errno);
+        fprintf(stderr, "parallel: %s: %s\n", argv[0], strerror(errno));
+        remove_job(job);
+        close_slot(slot);
+        return (errno == ENOENT) ? 127 : 126;
+    }
+
+    shell_stats.spawns++;
+    stats_latency(STATS_SPAWN, trace_now() - t_spawn);
+    if (add_job_process(job, pid) < 0) {
+        perror("parallel");
+        kill(pid, SIGKILL);     // untracked, so nothing else would reap it
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+        }
+        remove_job(job);
+        close_slot(slot);
+        return 1;
+    }
+    watch_job(job);
+    job->is_bg = 1;
+    slot->job = job;
+    return 0;
+}
+
+static int collect(slot_t *slots, long nslots, int *failed) {
+    // release the slots of finished jobs, returns how many were freed
+    int freed = 0;
+    for (long i = 0; i < nslots; i++) {
+        job_t *job = slots[i].job;
+        if (!job || job->state != DONE) {
+            continue;
+        }
+        if (job_status(job) != 0) {
+            (*failed)++;
+        }
+        if (slots[i].out_fd >= 0) {
+            copy_output(slots[i].out_fd, STDOUT_FILENO);
+            copy_output(slots[i].err_fd, STDERR_FILENO);
+        }
+        remove_job(job);
+        close_slot(&slots[i]);
+        freed++;
+    }
+    return freed;
+}
+
+int run_parallel(char **args) {
+    // user runs 'parallel [-j N] [-g] [-a file] cmd args...'
+    // runs cmd once per line of stdin (or file), "{}" in args is replaced by the line,
+    // otherwise it is appended, at most N at a time (default: online CPUs)
+    // -g holds each job's stdout/stderr and writes them together once it finishes
+    long njobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int group = 0;
+    const char *item_file = NULL;
+
+    int argi = 1;
+    for (; args[argi] && args[argi][0] == '-'; argi++) {
+        if (strcmp(args[argi], "-j") == 0 && args[argi+1]) {
+            char *end;
+            njobs = strtol(args[++argi], &end, 10);
+            if (*end || njobs < 1) {
+                fprintf(stderr, "parallel: %s: invalid job count\n", args[argi]);
+                return 2;
+            }
+        } else if (strcmp(args[argi], "-g") == 0) {
+            group = 1;
+        } else if (strcmp(args[argi], "-a") == 0 && args[argi+1]) {
+            item_file = args[++argi];
+        } else if (strcmp(args[argi], "--") == 0) {
+            argi++;
+            break;
+        } else {
+            fprintf(stderr, "parallel: usage: parallel [-j N] [-g] [-a file] command [args...]\n");
+            return 2;
+        }
+    }
+    if (!args[argi]) {
+        fprintf(stderr, "parallel: usage: parallel [-j N] [-g] [-a file] command [args...]\n");
+        return 2;
+    }
+    if (njobs < 1) {
+        njobs = 1;
+    }
+
+    char **tmpl = &args[argi];
+    int ntmpl = 0;
+    while (tmpl[ntmpl]) {
+        ntmpl++;
+    }
+
+    // resolved once, every item runs the same binary
+    const char *path = cmdhash_lookup(tmpl[0]);
+    if (!path) {
+        fprintf(stderr, "Command not found: %s\n", tmpl[0]);
+        return 127;
+    }
+
+    item_reader_t reader = { .fd = STDIN_FILENO };
+    if (item_file) {
+        reader.fd = open(item_file, O_RDONLY | O_CLOEXEC);
+        if (reader.fd < 0) {
+            fprintf(stderr, "parallel: %s: %s\n", item_file, strerror(errno));
+            return 1;
+        }
+    }
+
+    // items never read the shell's input
+    int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    slot_t *slots = calloc(njobs, sizeof(slot_t));
+    char **argv = malloc((ntmpl + 2) * sizeof(char *));
+    if (devnull < 0 || !slots || !argv) {
+        perror("parallel");
+        free(slots);
+        free(argv);
+        if (devnull >= 0) {
+            close(devnull);
+        }
+        if (item_file) {
+            close(reader.fd);
+        }
+        return 1;
+    }
+    for (long i = 0; i < njobs; i++) {
+        slots[i].out_fd = slots[i].err_fd = -1;
+    }
+
+    int nrunning = 0, started = 0, failed = 0;
+    int interrupted = 0, eof = 0;
+    fflush(stdout);
+
+    for (;;) {
+        nrunning -= collect(slots, njobs, &failed);
+
+        // refill every free slot before waiting again
+        long free_slot = 0;
+        while (!interrupted && !eof && nrunning < njobs) {
+            char *item;
+            int got = next_item(&reader, &item);
+            if (got < 0) {
+                interrupted = 1;
+                break;
+            }
+            if (got == 0) {
+                eof = 1;
+                break;
+            }
+            if (!*item) {
+                continue;
+            }
+
+            while (slots[free_slot].job) {
+                free_slot++;
+            }
+            if (!build_argv(tmpl, ntmpl, item, argv)) {
+                perror("parallel");
+                interrupted = 1;
+                break;
+            }
+            started++;
+            if (launch(&slots[free_slot], path, argv, devnull, group) == 0) {
+                nrunning++;
+            } else {
+                failed++;
+            }
+            free_argv(tmpl, ntmpl, argv);
+
+            // items that finished while we were reading free their slots early
+            nrunning -= collect(slots, njobs, &failed);
+            free_slot = 0;
+        }
+
+        if (nrunning == 0 && (eof || interrupted)) {
+            break;
+        }
+
+        if (events_wait(-1) < 0 && !interrupted) {
+            // ctrl-c reached only the shell, pass it on and stop taking items
+            interrupted = 1;
+            for (long i = 0; i < njobs; i++) {
+                if (slots[i].job) {
+                    kill(job_control ? -slots[i].job->pgid : slots[i].job->procs[0].pid, SIGINT);
+                }
+            }
+        }
+    }
+
+    fprintf(stderr, "parallel: %d jobs, %d failed%s\n", started, failed,
+            interrupted ? ", interrupted" : "");
+
+    close(devnull);
+    if (item_file) {
+        close(reader.fd);
+    }
+    free(reader.buf);
+    free(argv);
+    free(slots);
+
+    // like GNU parallel: the number of failed jobs, capped at 101
+    if (interrupted) {
+        return 128 + SIGINT;
+    }
+    return failed > 101 ? 101 : failed;
+}
@@ -0,0 +1,8 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// 'parallel' builtin, runs a command once per input line with at most N at a time
+
+int run_parallel(char **args);
+
+#endif
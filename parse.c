@@ -0,0 +1,1559 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse.h"
+#include "vars.h"
+
+// grammar
+//   list     := and_or ((';' | '&' | newline) and_or)* [';' | '&']
+//   and_or   := pipeline (('&&' | '||') linebreak pipeline)* | NAME '(' ')' linebreak function-body
+//   pipeline := ['time'] ['!'] ('cpus' word | 'rlimit' word)* command ('|' linebreak command)*
+//   command  := ['cpus' word] (simple | compound redirection*)
+//   simple   := (assignment | redirection)* (word | redirection)*, not empty
+//   compound := '{' list '}' | '(' list ')'
+//             | 'if' list 'then' list ('elif' list 'then' list)* ['else' list] 'fi'
+//             | ('while' | 'until') list 'do' list 'done'
+//             | 'for' NAME [linebreak 'in' word*] (';' | newline) linebreak 'do' list 'done'
+//             | 'case' word linebreak 'in' linebreak (['('] word ('|' word)* ')' list [';;'] linebreak)* 'esac'
+//   assignment := NAME=word, only before the command name
+//   redirection := [digits]('<' | '>' | '>>' | '<&' | '>&' | '<<' | '<<-' | '<<<') word
+// reserved words (if, then, do, '{', ...) only count unquoted where a command name could be
+// words may use '...', "..." and backslash escapes, '#' at the start of a word
+// comments out the rest of the line
+// a word with $(...), `...`, a parameter or an unquoted *, ? or [ in it is kept as
+// source text and expanded when its command runs (expand.c), the substitution may
+// hold blanks and operators
+// inside a compound command, after '|', '&&' or '||', or in an open quote the
+// next line is read onto the text; here-doc bodies are read at the end of the
+// line that started them
+// the code for a compound command is built on its own and spliced into the code
+// around it, unless it has redirections or is part of a pipeline, then it is
+// the body of a pipeline stage
+
+#define SUBST_MAX_CASES 32      // case commands open at once inside one $( )
+
+typedef enum {
+    TOK_END,            // end of the text read so far
+    TOK_WORD,
+    TOK_NEWLINE,
+    TOK_PIPE,
+    TOK_AMP,
+    TOK_SEMI,
+    TOK_AND_IF,         // &&
+    TOK_OR_IF,          // ||
+    TOK_DSEMI,          // ;;
+    TOK_LPAREN,
+    TOK_RPAREN,
+    TOK_LESS,
+    TOK_GREAT,
+    TOK_DGREAT,         // >>
+    TOK_LESSAND,        // <&
+    TOK_GREATAND,       // >&
+    TOK_DLESS,          // <<
+    TOK_DLESSDASH,      // <<-
+    TOK_TLESS           // <<<
+} token_type_t;
+
+typedef struct {
+    token_type_t type;
+    char *word;         // TOK_WORD, quotes removed
+    int quoted;         // TOK_WORD had quotes or escapes
+    int expand;         // TOK_WORD has a substitution, a parameter or a wildcard, word is the source text
+    int fd;             // redirection operators, -1 if no number was given
+    size_t start;       // source span
+    size_t end;
+} token_t;
+
+// code being compiled, the instructions grow in the arena
+typedef struct {
+    instr_t *ops;
+    int nops;
+    int cap;
+    int nslots;
+} builder_t;
+
+// a here-doc whose body is read once its line is done
+typedef struct {
+    redir_t *redir;
+    arena_t *arena;     // the one the redirection lives in
+} pending_t;
+
+typedef struct {
+    arena_t *arena;
+    const char *line;   // text read so far, lines joined by '\n'
+    size_t len;
+    char *buf;          // owned copy of the text once a second line is added, NULL before
+    size_t cap;
+    size_t pos;
+    token_t tok;        // lookahead
+    size_t prev_end;    // end of the token before tok
+    int failed;
+    int (*next_line)(char **line);  // NULL if there is nothing after the text
+    builder_t *b;       // where instructions go
+    function_def_t **defs;          // where function definitions go
+    pending_t *pending;
+    int npending;
+    int pending_cap;
+    char *scratch;      // a here-doc line taken from the text
+    size_t scratch_cap;
+} parser_t;
+
+// words are collected in a list while a command is parsed, then flattened into argv
+typedef struct word_node {
+    struct word_node *next;
+    char *word;
+    int raw;
+} word_node_t;
+
+static const char *closing_words[] = { "then", "elif", "else", "fi", "do", "done", "esac", "}" };
+
+// words after which a command starts, for scanning a $( ) before it is parsed
+static const char *leading_words[] = { "then", "do", "else", "elif", "if", "while", "until", "{", "!", "time" };
+
+static int is_redirection(token_type_t type) {
+    return type == TOK_LESS || type == TOK_GREAT || type == TOK_DGREAT || type == TOK_LESSAND ||
+           type == TOK_GREATAND || type == TOK_DLESS || type == TOK_DLESSDASH || type == TOK_TLESS;
+}
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static int is_operator(char c) {
+    return c == '|' || c == '&' || c == ';' || c == '<' || c == '>' || c == '(' || c == ')' || c == '\n';
+}
+
+static void syntax_error(parser_t *ps, const char *msg) {
+    if (!ps->failed) {
+        fprintf(stderr, "yash: syntax error: %s\n", msg);
+    }
+    ps->failed = 1;
+}
+
+static void unexpected(parser_t *ps) {
+    // report the current token
+    if (ps->failed) {
+        return;
+    }
+    if (ps->tok.type == TOK_END || ps->tok.type == TOK_NEWLINE) {
+        fprintf(stderr, "yash: syntax error near newline\n");
+    } else {
+        fprintf(stderr, "yash: syntax error near '%.*s'\n",
+                (int)(ps->tok.end - ps->tok.start), ps->line + ps->tok.start);
+    }
+    ps->failed = 1;
+}
+
+static const char *skip_dquote(const char *s, int *subst) {
+    // s is just past an opening '"', returns one past the closing one or NULL
+    // *subst is set if there is a command substitution or a parameter inside
+    while (*s && *s != '"') {
+        if (*s == '\\' && s[1]) {
+            s += 2;
+        } else if (*s == '$' && parse_param_end(s)) {
+            *subst = 1;
+            s = parse_param_end(s);
+        } else if ((*s == '$' && s[1] == '(') || *s == '`') {
+            *subst = 1;
+            s = parse_subst_end(s);
+            if (!s) {
+                return NULL;
+            }
+        } else {
+            s++;
+        }
+    }
+    return *s ? s + 1 : NULL;
+}
+
+const char *parse_subst_end(const char *s) {
+    // s is at "$(" or '`', returns one past the closing ')' or '`', NULL if unterminated
+    // quotes and nested substitutions inside are skipped over
+    int subst;
+    if (*s == '`') {
+        for (s++; *s; s++) {
+            if (*s == '\\' && s[1]) {
+                s++;
+            } else if (*s == '`') {
+                return s + 1;
+            }
+        }
+        return NULL;
+    }
+    // a case item's pattern ends in a ')' of its own, so the depth each 'case' was opened
+    // at is kept until its 'esac'; both only count where a command starts
+    int cases[SUBST_MAX_CASES];
+    int ncases = 0;
+    int command = 1;
+    int depth = 1;
+    s += 2;
+    while (*s) {
+        char c = *s++;
+        if (c == ' ' || c == '\t') {
+            continue;
+        }
+        int was_command = command;
+        command = (c == ';' || c == '&' || c == '|' || c == '\n' || c == '(');
+        if (c == '\\') {
+            if (*s) {
+                s++;
+            }
+        } else if (c == '\'') {
+            s = strchr(s, '\'');
+            if (!s) {
+                return NULL;
+            }
+            s++;
+        } else if (c == '"') {
+            s = skip_dquote(s, &subst);
+        } else if ((c == '$' && *s == '(') || c == '`') {
+            s = parse_subst_end(s - 1);
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')' && ncases > 0 && depth == cases[ncases - 1]) {
+            command = 1;    // a pattern's, the item's commands follow
+        } else if (c == ')' && --depth == 0) {
+            return s;
+        } else if (!command && c != ')') {
+            // a word, up to where a quote, substitution or operator starts
+            const char *w = s - 1;
+            size_t n = strcspn(w, " \t\n;&|()<>'\"\\`$");
+            n = n ? n : 1;
+            if (was_command && n == 4 && memcmp(w, "case", 4) == 0 && ncases < SUBST_MAX_CASES) {
+                cases[ncases++] = depth;
+            } else if (was_command && n == 4 && memcmp(w, "esac", 4) == 0 && ncases > 0) {
+                ncases--;
+            }
+            for (size_t i = 0; was_command && i < sizeof(leading_words) / sizeof(leading_words[0]); i++) {
+                command |= strlen(leading_words[i]) == n && memcmp(w, leading_words[i], n) == 0;
+            }
+            s = w + n;
+        }
+        if (!s) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+const char *parse_param_end(const char *s) {
+    // s is at '$', returns one past $NAME, ${NAME}, $N, ${NN}, or one of $?, $$, $!, $#,
+    // $@ and $*, NULL if it isn't one of them
+    if (s[1] && strchr("?$!#@*", s[1])) {
+        return s + 2;
+    }
+    if (s[1] >= '0' && s[1] <= '9') {
+        return s + 2;
+    }
+    if (s[1] == '{' && s[2] >= '0' && s[2] <= '9') {
+        size_t digits = strspn(s + 2, "0123456789");
+        return s[2 + digits] == '}' ? s + 3 + digits : NULL;
+    }
+    size_t len = var_name_len(s + (s[1] == '{' ? 2 : 1));
+    if (!len) {
+        return NULL;
+    }
+    if (s[1] == '{') {
+        return s[2 + len] == '}' ? s + 3 + len : NULL;
+    }
+    return s + 1 + len;
+}
+
+static char *cook_word(parser_t *ps, size_t start, size_t end) {
+    // copy a word that has quotes or backslashes into the arena with them removed
+    // the source span was already checked for unterminated quotes
+    const char *s = ps->line;
+    char *out = arena_alloc(ps->arena, end - start + 1);
+    if (!out) {
+        return NULL;
+    }
+    char *w = out;
+    size_t i = start;
+    while (i < end) {
+        char c = s[i++];
+        if (c == '\\') {
+            if (i < end) {
+                *w++ = s[i++];
+            }
+        } else if (c == '\'') {
+            while (s[i] != '\'') {
+                *w++ = s[i++];
+            }
+            i++;
+        } else if (c == '"') {
+            while (s[i] != '"') {
+                // inside double quotes backslash only escapes these
+                if (s[i] == '\\' && strchr("\\\"$`", s[i+1])) {
+                    i++;
+                }
+                *w++ = s[i++];
+            }
+            i++;
+        } else {
+            *w++ = c;
+        }
+    }
+    *w = '\0';
+    return out;
+}
+
+static const char *lex(parser_t *ps) {
+    // the token at ps->pos into ps->tok
+    // returns NULL, or why a word is unterminated; the position is then left alone
+    const char *s = ps->line;
+    size_t i = ps->pos;
+    token_t *tok = &ps->tok;
+
+    while (is_blank(s[i])) {
+        i++;
+    }
+    if (s[i] == '#') {
+        i += strcspn(s + i, "\n");
+    }
+
+    tok->start = i;
+    tok->word = NULL;
+    tok->quoted = 0;
+    tok->expand = 0;
+    tok->fd = -1;
+
+    if (!s[i]) {
+        tok->type = TOK_END;
+        tok->end = ps->pos = i;
+        return NULL;
+    }
+
+    // N< and N> take the number as the fd to redirect
+    size_t d = i;
+    while (s[d] >= '0' && s[d] <= '9') {
+        d++;
+    }
+    if (d > i && (s[d] == '<' || s[d] == '>')) {
+        tok->fd = atoi(s + i);
+        i = d;
+    }
+
+    switch (s[i]) {
+        case '\n': tok->type = TOK_NEWLINE; i++; break;
+        case '(': tok->type = TOK_LPAREN; i++; break;
+        case ')': tok->type = TOK_RPAREN; i++; break;
+        case '|':
+            tok->type = (s[i+1] == '|') ? TOK_OR_IF : TOK_PIPE;
+            i += (s[i+1] == '|') ? 2 : 1;
+            break;
+        case '&':
+            tok->type = (s[i+1] == '&') ? TOK_AND_IF : TOK_AMP;
+            i += (s[i+1] == '&') ? 2 : 1;
+            break;
+        case ';':
+            tok->type = (s[i+1] == ';') ? TOK_DSEMI : TOK_SEMI;
+            i += (s[i+1] == ';') ? 2 : 1;
+            break;
+        case '<':
+            if (s[i+1] == '<' && s[i+2] == '<') {
+                tok->type = TOK_TLESS;
+                i += 3;
+            } else if (s[i+1] == '<' && s[i+2] == '-') {
+                tok->type = TOK_DLESSDASH;
+                i += 3;
+            } else if (s[i+1] == '<') {
+                tok->type = TOK_DLESS;
+                i += 2;
+            } else if (s[i+1] == '&') {
+                tok->type = TOK_LESSAND;
+                i += 2;
+            } else {
+                tok->type = TOK_LESS;
+                i++;
+            }
+            break;
+        case '>':
+            tok->type = (s[i+1] == '>') ? TOK_DGREAT : (s[i+1] == '&') ? TOK_GREATAND : TOK_GREAT;
+            i += (tok->type == TOK_GREAT) ? 1 : 2;
+            break;
+        default: {
+            // a word, find its end and note whether it needs cooking or expanding
+            int quoted = 0, expand = 0;
+            while (s[i] && !is_blank(s[i]) && !is_operator(s[i])) {
+                char c = s[i++];
+                if (c == '\\') {
+                    quoted = 1;
+                    if (s[i]) {
+                        i++;
+                    }
+                } else if (c == '\'') {
+                    quoted = 1;
+                    while (s[i] && s[i] != c) {
+                        i++;
+                    }
+                    if (!s[i]) {
+                        return "unterminated '";
+                    }
+                    i++;
+                } else if (c == '"') {
+                    quoted = 1;
+                    const char *end = skip_dquote(s + i, &expand);
+                    if (!end) {
+                        return "unterminated \"";
+                    }
+                    i = end - s;
+                } else if (c == '$' && s[i] == '{' && !parse_param_end(s + i - 1)) {
+                    return "bad substitution";
+                } else if (c == '$' && parse_param_end(s + i - 1)) {
+                    expand = 1;
+                    i = parse_param_end(s + i - 1) - s;
+                } else if ((c == '$' && s[i] == '(') || c == '`') {
+                    expand = 1;
+                    const char *end = parse_subst_end(s + i - 1);
+                    if (!end) {
+                        return (c == '`') ? "unterminated `" : "unterminated $(";
+                    }
+                    i = end - s;
+                } else if (c == '*' || c == '?' || c == '[') {
+                    expand = 1;     // a pattern, globbed at run time
+                }
+            }
+            tok->type = TOK_WORD;
+            tok->quoted = quoted;
+            tok->expand = expand;
+            if (expand) {
+                // quotes stay in, expand_command removes them
+                tok->word = arena_strndup(ps->arena, s + tok->start, i - tok->start);
+            } else if (quoted) {
+                tok->word = cook_word(ps, tok->start, i);
+            } else {
+                tok->word = arena_strndup(ps->arena, s + tok->start, i - tok->start);
+            }
+            if (!tok->word) {
+                syntax_error(ps, "out of memory");
+                tok->type = TOK_END;
+            }
+            break;
+        }
+    }
+    tok->end = ps->pos = i;
+    return NULL;
+}
+
+static int take_line(parser_t *ps, char **line) {
+    // the next line of input for a here-doc body: the rest of the text if there
+    // is any, then from next_line
+    if (ps->pos < ps->len) {
+        size_t n = strcspn(ps->line + ps->pos, "\n");
+        if (n + 1 > ps->scratch_cap) {
+            char *grown = realloc(ps->scratch, n + 1);
+            if (!grown) {
+                return -1;
+            }
+            ps->scratch = grown;
+            ps->scratch_cap = n + 1;
+        }
+        memcpy(ps->scratch, ps->line + ps->pos, n);
+        ps->scratch[n] = '\0';
+        ps->pos += n + (ps->line[ps->pos + n] == '\n');
+        *line = ps->scratch;
+        return 1;
+    }
+    return ps->next_line ? ps->next_line(line) : 0;
+}
+
+static int read_body(parser_t *ps, const pending_t *p) {
+    // the lines up to the delimiter become the here-doc's target, each with its newline
+    redir_t *r = p->redir;
+    size_t len = 0, cap = 256;
+    char *body = malloc(cap);
+    if (!body) {
+        fprintf(stderr, "yash: out of memory\n");
+        return -1;
+    }
+    char *line;
+    int got;
+    while ((got = take_line(ps, &line)) > 0) {
+        if (r->strip_tabs) {
+            line += strspn(line, "\t");
+        }
+        if (strcmp(line, r->delim) == 0) {
+            break;
+        }
+        size_t n = strlen(line);
+        if (len + n + 2 > cap) {
+            while (len + n + 2 > cap) {
+                cap *= 2;
+            }
+            char *grown = realloc(body, cap);
+            if (!grown) {
+                free(body);
+                fprintf(stderr, "yash: out of memory\n");
+                return -1;
+            }
+            body = grown;
+        }
+        memcpy(body + len, line, n);
+        len += n;
+        body[len++] = '\n';
+    }
+    if (got < 0) {
+        free(body);
+        return -1;
+    }
+    if (got == 0) {
+        fprintf(stderr, "yash: here-document ended by end of input (wanted '%s')\n", r->delim);
+    }
+    r->target = arena_strndup(p->arena, body, len);
+    free(body);
+    if (!r->target) {
+        fprintf(stderr, "yash: out of memory\n");
+        return -1;
+    }
+    // an unquoted delimiter only costs an expansion if there is something to expand
+    r->raw = r->raw && strpbrk(r->target, "$`\\") != NULL;
+    return 0;
+}
+
+static int read_pending(parser_t *ps) {
+    // bodies of the here-docs of the line just finished, in the order they appeared
+    for (int i = 0; i < ps->npending; i++) {
+        if (read_body(ps, &ps->pending[i]) < 0) {
+            ps->npending = 0;
+            ps->failed = 1;
+            return -1;
+        }
+    }
+    ps->npending = 0;
+    return 0;
+}
+
+static int more_lines(parser_t *ps) {
+    // the text so far ended in the middle of something: read the here-doc
+    // bodies it owes, then add the next line to the text
+    // 1 if there was one, 0 at the end of input, -1 if interrupted or out of memory
+    if (!ps->buf) {
+        // the caller's line is only good until next_line is called, and
+        // words are lexed again from the start once their line goes on
+        ps->cap = ps->len + 256;
+        ps->buf = malloc(ps->cap);
+        if (!ps->buf) {
+            syntax_error(ps, "out of memory");
+            return -1;
+        }
+        memcpy(ps->buf, ps->line, ps->len + 1);
+        ps->line = ps->buf;
+    }
+    if (ps->pos >= ps->len && read_pending(ps) < 0) {
+        return -1;
+    }
+    char *line;
+    int got = ps->next_line ? ps->next_line(&line) : 0;
+    if (got <= 0) {
+        return got;
+    }
+    size_t n = strlen(line);
+    if (ps->len + n + 2 > ps->cap) {
+        size_t cap = ps->cap * 2;
+        while (ps->len + n + 2 > cap) {
+            cap *= 2;
+        }
+        char *grown = realloc(ps->buf, cap);
+        if (!grown) {
+            syntax_error(ps, "out of memory");
+            return -1;
+        }
+        ps->buf = grown;
+        ps->cap = cap;
+        ps->line = ps->buf;
+    }
+    ps->buf[ps->len] = '\n';
+    memcpy(ps->buf + ps->len + 1, line, n + 1);
+    ps->len += n + 1;
+    return 1;
+}
+
+static void next_token(parser_t *ps) {
+    ps->prev_end = ps->tok.end;
+    const char *unterminated;
+    while ((unterminated = lex(ps)) != NULL) {
+        // an open quote or substitution goes on on the next line
+        int got = (ps->failed || strcmp(unterminated, "bad substitution") == 0) ? 0 : more_lines(ps);
+        if (got <= 0) {
+            if (got == 0) {
+                syntax_error(ps, unterminated);
+            }
+            ps->failed = 1;
+            ps->tok.type = TOK_END;
+            ps->tok.start = ps->tok.end = ps->pos = ps->len;
+            return;
+        }
+        ps->pos = ps->tok.start;
+    }
+    if (ps->tok.type == TOK_NEWLINE && ps->npending) {
+        // here-doc bodies start right after the newline
+        read_pending(ps);
+    }
+}
+
+static int linebreak(parser_t *ps) {
+    // skip newlines, reading more lines while the text runs out here
+    for (;;) {
+        if (ps->failed) {
+            return -1;
+        }
+        if (ps->tok.type == TOK_NEWLINE) {
+            next_token(ps);
+        } else if (ps->tok.type == TOK_END) {
+            int got = more_lines(ps);
+            if (got == 0) {
+                syntax_error(ps, "unexpected end of input");
+            }
+            if (got <= 0) {
+                ps->failed = 1;
+                return -1;
+            }
+            ps->pos = ps->tok.start;
+            next_token(ps);
+        } else {
+            return 0;
+        }
+    }
+}
+
+static int is_word(const parser_t *ps, const char *word) {
+    // an unquoted word, as reserved words and the prefixes have to be
+    return ps->tok.type == TOK_WORD && !ps->tok.quoted && !ps->tok.expand && strcmp(ps->tok.word, word) == 0;
+}
+
+static int is_closing(const parser_t *ps) {
+    // a reserved word that ends a list
+    for (size_t i = 0; i < sizeof(closing_words) / sizeof(closing_words[0]); i++) {
+        if (is_word(ps, closing_words[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int expect(parser_t *ps, const char *word) {
+    if (!is_word(ps, word)) {
+        unexpected(ps);
+        return -1;
+    }
+    next_token(ps);
+    return ps->failed ? -1 : 0;
+}
+
+static int emit(parser_t *ps, opcode_t op) {
+    // append an instruction to the code being built, returns its index
+    builder_t *b = ps->b;
+    if (b->nops == b->cap) {
+        int cap = b->cap ? b->cap * 2 : 8;
+        instr_t *grown = arena_alloc(ps->arena, cap * sizeof(instr_t));
+        if (!grown) {
+            syntax_error(ps, "out of memory");
+            return -1;
+        }
+        if (b->nops) {
+            memcpy(grown, b->ops, b->nops * sizeof(instr_t));
+        }
+        b->ops = grown;
+        b->cap = cap;
+    }
+    instr_t *ins = &b->ops[b->nops];
+    memset(ins, 0, sizeof(*ins));
+    ins->op = op;
+    return b->nops++;
+}
+
+static code_t *finish(parser_t *ps, builder_t *b) {
+    code_t *code = arena_alloc(ps->arena, sizeof(code_t));
+    if (!code) {
+        syntax_error(ps, "out of memory");
+        return NULL;
+    }
+    code->ops = b->ops;
+    code->nops = b->nops;
+    code->nslots = b->nslots;
+    return code;
+}
+
+static int splice(parser_t *ps, const code_t *code) {
+    // append code, its jumps moved along and its slots after the ones in use
+    int base = ps->b->nops, slots = ps->b->nslots;
+    for (int i = 0; i < code->nops; i++) {
+        int k = emit(ps, code->ops[i].op);
+        if (k < 0) {
+            return -1;
+        }
+        instr_t *ins = &ps->b->ops[k];
+        *ins = code->ops[i];
+        ins->target += base;
+        ins->slot += slots;
+        if (ins->op == OP_LOOP || ins->op == OP_FOR) {
+            ins->arg += base;
+        }
+    }
+    ps->b->nslots += code->nslots;
+    return 0;
+}
+
+static void patch(parser_t *ps, int chain, int target) {
+    // jumps still to be placed are chained through their targets, -1 ends the chain
+    while (chain >= 0) {
+        int next = ps->b->ops[chain].target;
+        ps->b->ops[chain].target = target;
+        chain = next;
+    }
+}
+
+static int parse_prefix(parser_t *ps, const char *keyword, const char **arg) {
+    // 'cpus LIST' or 'rlimit SPEC' in front of a pipeline or a stage, like 'time' only when unquoted
+    // 1 if it was there, 0 if not
+    if (!is_word(ps, keyword)) {
+        return 0;
+    }
+    next_token(ps);
+    if (ps->tok.type != TOK_WORD) {
+        unexpected(ps);
+        return -1;
+    }
+    *arg = ps->tok.word;
+    next_token(ps);
+    return 1;
+}
+
+static int is_assignment(const parser_t *ps) {
+    // NAME=... with the name unquoted, before the command name
+    const char *s = ps->line + ps->tok.start;
+    size_t len = var_name_len(s);
+    return ps->tok.type == TOK_WORD && len && s[len] == '=';
+}
+
+static char **flatten(parser_t *ps, word_node_t *words, int n, char *raw) {
+    // the words of a list as a NULL terminated array, raw flags copied to raw if set
+    char **argv = arena_alloc(ps->arena, (n + 1) * sizeof(char *));
+    if (!argv) {
+        syntax_error(ps, "out of memory");
+        return NULL;
+    }
+    int i = 0;
+    for (word_node_t *w = words; w; w = w->next) {
+        if (raw) {
+            raw[i] = w->raw;
+        }
+        argv[i++] = w->word;
+    }
+    argv[i] = NULL;
+    return argv;
+}
+
+static int add_word(parser_t *ps, word_node_t ***tail, char *word, int raw) {
+    word_node_t *node = arena_alloc(ps->arena, sizeof(word_node_t));
+    if (!node) {
+        syntax_error(ps, "out of memory");
+        return -1;
+    }
+    node->word = word;
+    node->raw = raw;
+    node->next = NULL;
+    **tail = node;
+    *tail = &node->next;
+    return 0;
+}
+
+static words_t *make_words(parser_t *ps, word_node_t *list, int n, int raw) {
+    words_t *w = arena_alloc(ps->arena, sizeof(words_t));
+    if (!w) {
+        syntax_error(ps, "out of memory");
+        return NULL;
+    }
+    w->n = n;
+    w->var = NULL;
+    w->raw = NULL;
+    if (raw && !(w->raw = arena_alloc(ps->arena, n))) {
+        syntax_error(ps, "out of memory");
+        return NULL;
+    }
+    w->words = flatten(ps, list, n, w->raw);
+    return w->words ? w : NULL;
+}
+
+static int parse_redirection(parser_t *ps, command_t *cmd, redir_t ***tail, int *raw) {
+    redir_t *r = arena_alloc(ps->arena, sizeof(redir_t));
+    if (!r) {
+        syntax_error(ps, "out of memory");
+        return -1;
+    }
+    token_type_t op = ps->tok.type;
+    r->kind = (op == TOK_LESS) ? REDIR_IN : (op == TOK_GREAT) ? REDIR_OUT : (op == TOK_DGREAT) ? REDIR_APPEND :
+              (op == TOK_LESSAND || op == TOK_GREATAND) ? REDIR_DUP :
+              (op == TOK_TLESS) ? REDIR_HERESTRING : REDIR_HEREDOC;
+    int out = (op == TOK_GREAT || op == TOK_DGREAT || op == TOK_GREATAND);
+    r->fd = ps->tok.fd >= 0 ? ps->tok.fd : out;
+    r->next = NULL;
+    r->delim = NULL;
+    r->strip_tabs = (op == TOK_DLESSDASH);
+    next_token(ps);
+    if (ps->tok.type != TOK_WORD) {
+        unexpected(ps);
+        return -1;
+    }
+    if (r->kind == REDIR_HEREDOC) {
+        // the delimiter is never expanded, quoting it keeps the body literal
+        // the body is read when the line is done
+        r->delim = ps->tok.expand ? cook_word(ps, ps->tok.start, ps->tok.end) : ps->tok.word;
+        r->raw = !ps->tok.quoted;
+        r->target = NULL;
+        *raw |= r->raw;     // in case the body turns out to need expanding
+        if (ps->npending == ps->pending_cap) {
+            int cap = ps->pending_cap ? ps->pending_cap * 2 : 4;
+            pending_t *grown = realloc(ps->pending, cap * sizeof(pending_t));
+            if (!grown) {
+                r->delim = NULL;
+            } else {
+                ps->pending = grown;
+                ps->pending_cap = cap;
+            }
+        }
+        if (!r->delim) {
+            syntax_error(ps, "out of memory");
+            return -1;
+        }
+        ps->pending[ps->npending].redir = r;
+        ps->pending[ps->npending++].arena = ps->arena;
+    } else {
+        r->target = ps->tok.word;
+        r->raw = ps->tok.expand;
+        *raw |= r->raw;
+    }
+    **tail = r;
+    *tail = &r->next;
+    cmd->nredirs++;
+    next_token(ps);
+    return 0;
+}
+
+static int parse_list(parser_t *ps, int nested);
+static int parse_compound(parser_t *ps, command_t *cmd);
+
+static int is_compound(const parser_t *ps) {
+    return ps->tok.type == TOK_LPAREN || is_word(ps, "{") || is_word(ps, "if") || is_word(ps, "for") ||
+           is_word(ps, "while") || is_word(ps, "until") || is_word(ps, "case");
+}
+
+static int parse_command(parser_t *ps, command_t *cmd) {
+    // assignments, words and redirections up to the next operator, or a compound
+    // command and its redirections
+    word_node_t *words = NULL, **words_tail = &words;
+    word_node_t *assigns = NULL, **assigns_tail = &assigns;
+    redir_t **redirs_tail = &cmd->redirs;
+    int raw = 0;
+    memset(cmd, 0, sizeof(*cmd));
+    if (parse_prefix(ps, "cpus", &cmd->cpus) < 0) {
+        return -1;
+    }
+
+    if (is_compound(ps)) {
+        if (parse_compound(ps, cmd) < 0) {
+            return -1;
+        }
+        while (is_redirection(ps->tok.type)) {
+            if (parse_redirection(ps, cmd, &redirs_tail, &raw) < 0) {
+                return -1;
+            }
+        }
+    } else if (is_closing(ps)) {
+        unexpected(ps);
+        return -1;
+    }
+
+    while (!cmd->body) {
+        if (ps->tok.type == TOK_WORD) {
+            int assign = cmd->argc == 0 && is_assignment(ps);
+            if (add_word(ps, assign ? &assigns_tail : &words_tail, ps->tok.word, ps->tok.expand) < 0) {
+                return -1;
+            }
+            raw |= ps->tok.expand;
+            if (assign) {
+                cmd->nassigns++;
+            } else {
+                cmd->argc++;
+            }
+            next_token(ps);
+        } else if (is_redirection(ps->tok.type)) {
+            if (parse_redirection(ps, cmd, &redirs_tail, &raw) < 0) {
+                return -1;
+            }
+        } else {
+            break;
+        }
+    }
+    if (ps->failed) {
+        return -1;
+    }
+    if (!cmd->body && cmd->argc == 0 && cmd->nassigns == 0 && !cmd->redirs) {
+        // nothing at all; '> file' alone is a command, it creates or truncates file
+        unexpected(ps);
+        return -1;
+    }
+
+    cmd->raw = NULL;
+    if (raw) {
+        cmd->raw = arena_alloc(ps->arena, cmd->argc + cmd->nassigns + 1);
+        if (!cmd->raw) {
+            syntax_error(ps, "out of memory");
+            return -1;
+        }
+    }
+    cmd->argv = flatten(ps, words, cmd->argc, cmd->raw);
+    cmd->assigns = flatten(ps, assigns, cmd->nassigns, cmd->raw ? cmd->raw + cmd->argc : NULL);
+    return (cmd->argv && cmd->assigns) ? 0 : -1;
+}
+
+static const char *source_text(parser_t *ps, size_t start, size_t end) {
+    // source of a pipeline for the job table, on one line: a newline becomes
+    // "; " unless what came before it wants more, then a blank
+    const char *s = ps->line + start;
+    size_t n = end - start;
+    if (!memchr(s, '\n', n)) {
+        return arena_strndup(ps->arena, s, n);
+    }
+    char *out = arena_alloc(ps->arena, 2 * n + 1);
+    if (!out) {
+        return NULL;
+    }
+    size_t len = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] != '\n') {
+            out[len++] = s[i];
+            continue;
+        }
+        while (len && is_blank(out[len - 1])) {
+            len--;
+        }
+        size_t w = len;
+        while (w && !is_blank(out[w - 1])) {
+            w--;
+        }
+        const char *last = out + w;
+        size_t last_len = len - w;
+        int more = len == 0 || strchr("|&;({", out[len - 1]) ||
+                   (last_len == 4 && memcmp(last, "then", 4) == 0) ||
+                   (last_len == 4 && memcmp(last, "else", 4) == 0) ||
+                   (last_len == 2 && memcmp(last, "do", 2) == 0) ||
+                   (last_len == 2 && memcmp(last, "in", 2) == 0);
+        if (!more) {
+            out[len++] = ';';
+        }
+        if (len) {
+            out[len++] = ' ';
+        }
+        while (i + 1 < n && (is_blank(s[i + 1]) || s[i + 1] == '\n')) {
+            i++;
+        }
+    }
+    out[len] = '\0';
+    return out;
+}
+
+static pipeline_t *parse_pipeline(parser_t *ps, int *negate) {
+    pipeline_t *pl = arena_alloc(ps->arena, sizeof(pipeline_t));
+    if (!pl) {
+        syntax_error(ps, "out of memory");
+        return NULL;
+    }
+    memset(pl, 0, sizeof(*pl));
+
+    *negate = 0;
+    if (is_word(ps, "time")) {
+        pl->timed = 1;
+        next_token(ps);
+        if (ps->tok.type != TOK_WORD && ps->tok.type != TOK_LPAREN && !is_redirection(ps->tok.type)) {
+            // bare 'time' times nothing
+            pl->text = "";
+            return ps->failed ? NULL : pl;
+        }
+    }
+    if (is_word(ps, "!")) {
+        *negate = 1;
+        next_token(ps);
+    }
+    for (int found = 1; found > 0; ) {
+        found = parse_prefix(ps, "cpus", &pl->cpus);
+        if (found == 0) {
+            found = parse_prefix(ps, "rlimit", &pl->rlimit);
+        }
+        if (found < 0) {
+            return NULL;
+        }
+    }
+    size_t text_start = ps->tok.start;
+    size_t text_end = text_start;
+
+    // stages are few, collect them in a list and flatten like argv
+    typedef struct stage_node {
+        struct stage_node *next;
+        command_t cmd;
+    } stage_node_t;
+    stage_node_t *stages = NULL, **tail = &stages;
+
+    for (;;) {
+        stage_node_t *node = arena_alloc(ps->arena, sizeof(stage_node_t));
+        if (!node) {
+            syntax_error(ps, "out of memory");
+            return NULL;
+        }
+        node->next = NULL;
+        if (parse_command(ps, &node->cmd) < 0) {
+            return NULL;
+        }
+        *tail = node;
+        tail = &node->next;
+        pl->ncmds++;
+        text_end = ps->prev_end;
+
+        if (ps->tok.type != TOK_PIPE) {
+            break;
+        }
+        next_token(ps);
+        if (linebreak(ps) < 0) {
+            return NULL;
+        }
+    }
+
+    pl->cmds = arena_alloc(ps->arena, pl->ncmds * sizeof(command_t));
+    if (!pl->cmds) {
+        syntax_error(ps, "out of memory");
+        return NULL;
+    }
+    int i = 0;
+    for (stage_node_t *n = stages; n; n = n->next) {
+        pl->cmds[i++] = n->cmd;
+    }
+
+    // job table text
+    pl->text = source_text(ps, text_start, text_end);
+    if (!pl->text) {
+        syntax_error(ps, "out of memory");
+        return NULL;
+    }
+    return pl;
+}
+
+static int emit_pipeline(parser_t *ps, const pipeline_t *pl, int negate) {
+    // a compound command that is all there is to the pipeline runs inline
+    const command_t *cmd = &pl->cmds[0];
+    if (pl->ncmds == 1 && cmd->body && !cmd->subshell && !cmd->nredirs && !cmd->cpus &&
+        !pl->cpus && !pl->rlimit && !pl->timed && !pl->background) {
+        if (splice(ps, cmd->body) < 0) {
+            return -1;
+        }
+    } else {
+        int k = emit(ps, OP_RUN);
+        if (k < 0) {
+            return -1;
+        }
+        ps->b->ops[k].pl = pl;
+    }
+    return (negate && emit(ps, OP_NOT) < 0) ? -1 : 0;
+}
+
+static int is_function_name(const parser_t *ps) {
+    // NAME followed by '(', where a command starts
+    if (ps->tok.type != TOK_WORD || ps->tok.quoted || ps->tok.expand ||
+        var_name_len(ps->tok.word) != strlen(ps->tok.word) || is_compound(ps) || is_closing(ps)) {
+        return 0;
+    }
+    size_t i = ps->pos;
+    while (is_blank(ps->line[i])) {
+        i++;
+    }
+    return ps->line[i] == '(';
+}
+
+static int parse_function(parser_t *ps) {
+    // NAME ( ) compound-command [redirections], parsed into an arena of its own
+    // the definition is listed right away so it is released even if parsing fails
+    function_def_t *fn = calloc(1, sizeof(function_def_t));
+    if (!fn) {
+        syntax_error(ps, "out of memory");
+        return -1;
+    }
+    arena_init(&fn->arena);
+    fn->refs = 1;
+    fn->next = *ps->defs;
+    *ps->defs = fn;
+
+    arena_t *outer_arena = ps->arena;
+    function_def_t **outer_defs = ps->defs;
+    ps->arena = &fn->arena;
+    ps->defs = &fn->defs;
+
+    int err = -1;
+    size_t text_start = ps->tok.start;
+    fn->name = arena_strndup(ps->arena, ps->tok.word, strlen(ps->tok.word));
+    next_token(ps);
+    next_token(ps);
+    if (!fn->name) {
+        syntax_error(ps, "out of memory");
+    } else if (ps->tok.type != TOK_RPAREN) {
+        unexpected(ps);
+    } else {
+        next_token(ps);
+        if (linebreak(ps) == 0 && !is_compound(ps)) {
+            unexpected(ps);
+        }
+        pipeline_t *pl = ps->failed ? NULL : arena_alloc(ps->arena, sizeof(pipeline_t));
+        command_t *cmd = pl ? arena_alloc(ps->arena, sizeof(command_t)) : NULL;
+        if (!ps->failed && !cmd) {
+            syntax_error(ps, "out of memory");
+        } else if (cmd && parse_command(ps, cmd) == 0) {
+            memset(pl, 0, sizeof(*pl));
+            pl->cmds = cmd;
+            pl->ncmds = 1;
+            pl->text = source_text(ps, text_start, ps->prev_end);
+            fn->pl = pl;
+            err = pl->text ? 0 : -1;
+        }
+    }
+
+    ps->arena = outer_arena;
+    ps->defs = outer_defs;
+    int k = err < 0 ? -1 : emit(ps, OP_FUNCTION);
+    if (k < 0) {
+        return -1;
+    }
+    ps->b->ops[k].fn = fn;
+    return 0;
+}
+
+static int parse_and_or(parser_t *ps, int *background) {
+    // pipelines joined by && and ||, and a '&' after them
+    // a lone pipeline goes to the background as it is, a chain as a compound stage
+    *background = 0;
+    if (is_function_name(ps)) {
+        return parse_function(ps);
+    }
+    size_t text_start = ps->tok.start;
+    int negate;
+    pipeline_t *pl = parse_pipeline(ps, &negate);
+    if (!pl) {
+        return -1;
+    }
+    if (ps->tok.type != TOK_AND_IF && ps->tok.type != TOK_OR_IF) {
+        if (ps->tok.type == TOK_AMP) {
+            pl->background = *background = 1;
+            next_token(ps);
+        }
+        return emit_pipeline(ps, pl, negate);
+    }
+
+    // a && b || c: each connector skips the pipeline after it
+    builder_t chain = { 0 };
+    builder_t *outer = ps->b;
+    ps->b = &chain;
+    int err = emit_pipeline(ps, pl, negate);
+    while (!err && (ps->tok.type == TOK_AND_IF || ps->tok.type == TOK_OR_IF)) {
+        int k = emit(ps, ps->tok.type == TOK_AND_IF ? OP_JUMP_FALSE : OP_JUMP_TRUE);
+        next_token(ps);
+        err = -1;
+        if (k >= 0 && linebreak(ps) == 0 && (pl = parse_pipeline(ps, &negate)) != NULL) {
+            err = emit_pipeline(ps, pl, negate);
+            chain.ops[k].target = chain.nops;
+        }
+    }
+    ps->b = outer;
+    if (err) {
+        return -1;
+    }
+    if (ps->tok.type != TOK_AMP) {
+        code_t code = { chain.ops, chain.nops, chain.nslots };
+        return splice(ps, &code);
+    }
+
+    // the whole chain is one background job
+    command_t *cmd = arena_alloc(ps->arena, sizeof(command_t));
+    pl = arena_alloc(ps->arena, sizeof(pipeline_t));
+    if (!cmd || !pl) {
+        syntax_error(ps, "out of memory");
+        return -1;
+    }
+    memset(cmd, 0, sizeof(*cmd));
+    memset(pl, 0, sizeof(*pl));
+    cmd->body = finish(ps, &chain);
+    cmd->argv = cmd->assigns = flatten(ps, NULL, 0, NULL);
+    pl->cmds = cmd;
+    pl->ncmds = 1;
+    pl->background = *background = 1;
+    pl->text = source_text(ps, text_start, ps->prev_end);
+    next_token(ps);
+    if (!cmd->body || !cmd->argv || !pl->text) {
+        syntax_error(ps, "out of memory");
+        return -1;
+    }
+    return emit_pipeline(ps, pl, 0);
+}
+
+static int parse_list(parser_t *ps, int nested) {
+    // and-or lists to the end of the line, or when nested to a closing reserved
+    // word, ')' or ';;', reading more lines as needed
+    // returns how many there were, -1 on error
+    int n = 0;
+    for (;;) {
+        if (nested && linebreak(ps) < 0) {
+            return -1;
+        }
+        if (ps->tok.type == TOK_END || ps->tok.type == TOK_RPAREN || ps->tok.type == TOK_DSEMI || is_closing(ps)) {
+            break;
+        }
+        int background;
+        if (parse_and_or(ps, &background) < 0) {
+            return -1;
+        }
+        n++;
+        if (ps->tok.type == TOK_SEMI || ps->tok.type == TOK_NEWLINE) {
+            next_token(ps);
+        } else if (!background && !(nested && ps->tok.type == TOK_END)) {
+            break;
+        }
+    }
+    return ps->failed ? -1 : n;
+}
+
+static int parse_body(parser_t *ps, const char *closing) {
+    // a list that must not be empty, then its closing word
+    int n = parse_list(ps, 1);
+    if (n == 0) {
+        unexpected(ps);
+    }
+    if (n <= 0) {
+        return -1;
+    }
+    return closing ? expect(ps, closing) : 0;
+}
+
+static int parse_if(parser_t *ps) {
+    // cond JUMP_FALSE(next) body JUMP(fi) ... [else body | STATUS 0]
+    int ends = -1;  // chain of the jumps to past 'fi'
+    do {
+        next_token(ps);     // if or elif
+        if (parse_body(ps, "then") < 0) {
+            return -1;
+        }
+        int skip = emit(ps, OP_JUMP_FALSE);
+        if (skip < 0 || parse_body(ps, NULL) < 0) {
+            return -1;
+        }
+        int k = emit(ps, OP_JUMP);
+        if (k < 0) {
+            return -1;
+        }
+        ps->b->ops[k].target = ends;
+        ends = k;
+        ps->b->ops[skip].target = ps->b->nops;
+    } while (is_word(ps, "elif"));
+
+    if (is_word(ps, "else")) {
+        next_token(ps);
+        if (parse_body(ps, NULL) < 0) {
+            return -1;
+        }
+    } else if (emit(ps, OP_STATUS) < 0) {
+        // no branch taken is success
+        return -1;
+    }
+    patch(ps, ends, ps->b->nops);
+    return expect(ps, "fi");
+}
+
+static int parse_while(parser_t *ps, int until) {
+    // LOOP cond TEST body NEXT(cond) DONE
+    int slot = ps->b->nslots++;
+    int loop = emit(ps, OP_LOOP);
+    if (loop < 0) {
+        return -1;
+    }
+    next_token(ps);
+    int cond = ps->b->nops;
+    if (parse_body(ps, "do") < 0) {
+        return -1;
+    }
+    int test = emit(ps, OP_TEST);
+    if (test < 0 || parse_body(ps, "done") < 0) {
+        return -1;
+    }
+    int next = emit(ps, OP_NEXT);
+    int done = emit(ps, OP_DONE);
+    if (next < 0 || done < 0) {
+        return -1;
+    }
+    instr_t *ops = ps->b->ops;
+    ops[loop].slot = slot;
+    ops[loop].target = done;
+    ops[loop].arg = next;
+    ops[test].slot = slot;
+    ops[test].target = done;
+    ops[test].arg = until;
+    ops[next].slot = slot;
+    ops[next].target = cond;
+    return 0;
+}
+
+static int parse_for(parser_t *ps) {
+    // FOR FOR_NEXT body NEXT(FOR_NEXT) DONE
+    next_token(ps);
+    if (ps->tok.type != TOK_WORD || ps->tok.quoted || ps->tok.expand ||
+        var_name_len(ps->tok.word) != strlen(ps->tok.word)) {
+        unexpected(ps);
+        return -1;
+    }
+    const char *var = ps->tok.word;
+    next_token(ps);
+
+    // no 'in' goes over "$@"
+    word_node_t *list = NULL, **tail = &list;
+    int n = 0, raw = 1;
+    if (ps->tok.type == TOK_NEWLINE && linebreak(ps) < 0) {
+        return -1;
+    }
+    if (is_word(ps, "in")) {
+        raw = 0;
+        next_token(ps);
+        while (ps->tok.type == TOK_WORD) {
+            if (add_word(ps, &tail, ps->tok.word, ps->tok.expand) < 0) {
+                return -1;
+            }
+            raw |= ps->tok.expand;
+            n++;
+            next_token(ps);
+        }
+        if (ps->tok.type != TOK_SEMI && ps->tok.type != TOK_NEWLINE && ps->tok.type != TOK_END) {
+            unexpected(ps);
+            return -1;
+        }
+    } else if (add_word(ps, &tail, "\"$@\"", 1) == 0) {
+        n = 1;
+    } else {
+        return -1;
+    }
+    if (ps->tok.type == TOK_SEMI) {
+        next_token(ps);
+    }
+    if (linebreak(ps) < 0 || expect(ps, "do") < 0) {
+        return -1;
+    }
+    words_t *words = make_words(ps, list, n, raw);
+    if (!words) {
+        return -1;
+    }
+    words->var = var;
+
+    int slot = ps->b->nslots++;
+    int loop = emit(ps, OP_FOR);
+    int step = emit(ps, OP_FOR_NEXT);
+    if (loop < 0 || step < 0 || parse_body(ps, "done") < 0) {
+        return -1;
+    }
+    int next = emit(ps, OP_NEXT);
+    int done = emit(ps, OP_DONE);
+    if (next < 0 || done < 0) {
+        return -1;
+    }
+    instr_t *ops = ps->b->ops;
+    ops[loop].slot = slot;
+    ops[loop].target = done;
+    ops[loop].arg = next;
+    ops[loop].words = words;
+    ops[step].slot = slot;
+    ops[step].target = done;
+    ops[step].words = words;
+    ops[next].slot = slot;
+    ops[next].target = step;
+    return 0;
+}
+
+static int parse_case(parser_t *ps) {
+    // CASE (MATCH(next item) body JUMP(esac))*
+    next_token(ps);
+    if (ps->tok.type != TOK_WORD) {
+        unexpected(ps);
+        return -1;
+    }
+    word_node_t *list = NULL, **tail = &list;
+    if (add_word(ps, &tail, ps->tok.word, ps->tok.expand) < 0) {
+        return -1;
+    }
+    words_t *word = make_words(ps, list, 1, ps->tok.expand);
+    next_token(ps);
+    if (!word || linebreak(ps) < 0 || expect(ps, "in") < 0) {
+        return -1;
+    }
+
+    int slot = ps->b->nslots++;
+    int start = emit(ps, OP_CASE);
+    if (start < 0) {
+        return -1;
+    }
+    ps->b->ops[start].slot = slot;
+    ps->b->ops[start].words = word;
+    int ends = -1;
+    for (;;) {
+        if (linebreak(ps) < 0) {
+            return -1;
+        }
+        if (is_word(ps, "esac")) {
+            break;
+        }
+        if (ps->tok.type == TOK_LPAREN) {
+            next_token(ps);
+        }
+        // patterns keep their quotes so quoted wildcards match themselves
+        list = NULL;
+        tail = &list;
+        int n = 0, raw = 0;
+        for (;;) {
+            if (ps->tok.type != TOK_WORD) {
+                unexpected(ps);
+                return -1;
+            }
+            int keep = ps->tok.expand || ps->tok.quoted;
+            char *w = keep ? arena_strndup(ps->arena, ps->line + ps->tok.start, ps->tok.end - ps->tok.start)
+                           : ps->tok.word;
+            if (!w) {
+                syntax_error(ps, "out of memory");
+                return -1;
+            }
+            if (add_word(ps, &tail, w, keep) < 0) {
+                return -1;
+            }
+            raw |= keep;
+            n++;
+            next_token(ps);
+            if (ps->tok.type != TOK_PIPE) {
+                break;
+            }
+            next_token(ps);
+        }
+        if (ps->tok.type != TOK_RPAREN) {
+            unexpected(ps);
+            return -1;
+        }
+        next_token(ps);
+        words_t *patterns = make_words(ps, list, n, raw);
+        int match = patterns ? emit(ps, OP_MATCH) : -1;
+        if (match < 0 || parse_list(ps, 1) < 0) {
+            return -1;
+        }
+        ps->b->ops[match].slot = slot;
+        ps->b->ops[match].words = patterns;
+        int last = !(ps->tok.type == TOK_DSEMI);
+        if (!last) {
+            next_token(ps);
+            int k = emit(ps, OP_JUMP);
+            if (k < 0) {
+                return -1;
+            }
+            ps->b->ops[k].target = ends;
+            ends = k;
+        }
+        ps->b->ops[match].target = ps->b->nops;
+        if (last) {
+            if (linebreak(ps) < 0) {
+                return -1;
+            }
+            if (!is_word(ps, "esac")) {
+                unexpected(ps);
+                return -1;
+            }
+        }
+    }
+    patch(ps, ends, ps->b->nops);
+    ps->b->ops[start].target = ps->b->nops;
+    return expect(ps, "esac");
+}
+
+static int parse_compound(parser_t *ps, command_t *cmd) {
+    // the code of if, for, while, until, case, { } or ( ) on its own, as cmd's body
+    builder_t b = { 0 };
+    builder_t *outer = ps->b;
+    ps->b = &b;
+    int err;
+    if (ps->tok.type == TOK_LPAREN) {
+        cmd->subshell = 1;
+        next_token(ps);
+        err = parse_body(ps, NULL);
+        if (!err && ps->tok.type != TOK_RPAREN) {
+            unexpected(ps);
+            err = -1;
+        }
+        if (!err) {
+            next_token(ps);
+        }
+    } else if (is_word(ps, "{")) {
+        next_token(ps);
+        err = parse_body(ps, "}");
+    } else if (is_word(ps, "if")) {
+        err = parse_if(ps);
+    } else if (is_word(ps, "for")) {
+        err = parse_for(ps);
+    } else if (is_word(ps, "case")) {
+        err = parse_case(ps);
+    } else {
+        err = parse_while(ps, is_word(ps, "until"));
+    }
+    ps->b = outer;
+    if (err < 0 || ps->failed) {
+        return -1;
+    }
+    cmd->body = finish(ps, &b);
+    return cmd->body ? 0 : -1;
+}
+
+int parse_line(arena_t *arena, const char *line, int (*next_line)(char **line),
+               code_t **code, function_def_t **defs) {
+    // parse a line, and whatever lines after it it needs, into code
+    // *code is NULL for a blank line; *defs lists the functions it defines, for
+    // parse_release once the code is done with
+    // returns 0, or -1 after printing a syntax error, nothing to release then
+    builder_t b = { 0 };
+    parser_t ps = { .arena = arena, .line = line, .len = strlen(line), .next_line = next_line,
+                    .b = &b, .defs = defs };
+    *code = NULL;
+    *defs = NULL;
+
+    next_token(&ps);
+    if (parse_list(&ps, 0) >= 0 && ps.tok.type != TOK_END) {
+        unexpected(&ps);
+    }
+    if (!ps.failed) {
+        read_pending(&ps);
+    }
+    if (!ps.failed && b.nops) {
+        *code = finish(&ps, &b);
+    }
+    free(ps.buf);
+    free(ps.pending);
+    free(ps.scratch);
+    if (ps.failed) {
+        parse_release(*defs);
+        *defs = NULL;
+        *code = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void parse_release(function_def_t *defs) {
+    // drop the parser's hold on a list of definitions
+    function_def_t *next;
+    for (function_def_t *fn = defs; fn; fn = next) {
+        next = fn->next;
+        function_release(fn);
+    }
+}
+
+void function_release(function_def_t *fn) {
+    // drop one hold on a definition, the last one frees it and what was defined inside it
+    if (--fn->refs == 0) {
+        parse_release(fn->defs);
+        arena_free(&fn->arena);
+        free(fn);
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include "arena.h"
+
+// one-pass lexer/parser for a line of input, and the lines after it that an
+// unfinished compound command, here-doc or '|' needs
+// pipelines and the control flow between them are compiled into a code_t
+// that lives in the caller's arena and is valid until arena_reset,
+// function definitions get an arena of their own
+
+typedef enum {
+    REDIR_IN,       // N< file, N defaults to 0
+    REDIR_OUT,      // N> file, N defaults to 1
+    REDIR_APPEND,   // N>> file, N defaults to 1
+    REDIR_DUP,      // N>&M or N<&M, N defaults to 1 or 0; N>&- closes N
+    REDIR_HEREDOC,  // N<<WORD or N<<-WORD, the following lines up to WORD, N defaults to 0
+    REDIR_HERESTRING // N<<< word, the word and a newline, N defaults to 0
+} redir_kind_t;
+
+typedef struct redir {
+    struct redir *next;
+    redir_kind_t kind;
+    int fd;             // fd being redirected
+    const char *target; // file name, quotes removed; a here-doc's body, a here-string, or M for a dup
+    int raw;            // target is kept as source text for expand_command
+    const char *delim;  // here-doc delimiter, quotes removed
+    int strip_tabs;     // <<-, leading tabs are dropped from the body and delimiter lines
+} redir_t;
+
+struct code;
+
+// a simple or compound command, one pipeline stage
+typedef struct {
+    char **argv;        // NULL terminated, quotes removed
+    int argc;
+    char *raw;          // NULL, or raw[i] set if argv[i] is source text to expand at run time
+                        // (a word with $(...), `...`, a parameter or a wildcard), raw[argc + i]
+                        // the same for assigns[i], also set if any redirection is raw
+    redir_t *redirs;    // in source order, later ones win
+    int nredirs;
+    const char *cpus;   // 'cpus LIST' prefix of this stage, NULL if none
+    char **assigns;     // NAME=value prefixes, NULL terminated, like argv
+    int nassigns;       // a command may be nothing but these, then argc is 0
+    const struct code *body;    // if, for, while, until, case, { } or ( ), NULL for a simple
+                                // command; argc and nassigns are then 0
+    int subshell;       // body is a ( list ), it always runs in a child
+} command_t;
+
+// cmd | cmd | ... [&]
+typedef struct pipeline {
+    command_t *cmds;
+    int ncmds;
+    int background;
+    int timed;              // prefixed with the 'time' keyword
+    const char *cpus;       // 'cpus LIST' prefix for every stage, NULL if none
+    const char *rlimit;     // 'rlimit SPEC' prefix, caps for every stage, NULL if none
+    const char *text;       // source text for the job table, without 'time', the prefixes and '&'
+} pipeline_t;
+
+// name() compound-command [redirections], kept until it is redefined or unset
+typedef struct function_def {
+    struct function_def *next;  // the others defined by the same code
+    const char *name;
+    pipeline_t *pl;             // one stage, the body with its redirections
+    arena_t arena;              // everything of the definition, nested ones included
+    struct function_def *defs;  // defined inside the body
+    int refs;                   // the code that defined it, the function table and every call in progress
+} function_def_t;
+
+// word lists of for and case, words kept as source text like argv
+typedef struct {
+    char **words;
+    char *raw;          // NULL, or raw[i] set if words[i] is expanded at run time
+    int n;
+    const char *var;    // OP_FOR: the loop variable
+} words_t;
+
+// compiled control flow, run by code.c
+// a loop or a case keeps its state (words, position, last status) in a frame slot
+typedef enum {
+    OP_RUN,         // run pl, $? is its status
+    OP_NOT,         // ! pipeline: $? = !$?
+    OP_STATUS,      // $? = arg
+    OP_JUMP,        // go to target
+    OP_JUMP_FALSE,  // go to target if $? is not 0
+    OP_JUMP_TRUE,   // go to target if $? is 0
+    OP_LOOP,        // enter a while/until loop: break goes to target, continue to arg
+    OP_TEST,        // after a loop condition: if it failed (arg 0) or succeeded (arg 1, until),
+                    // leave the loop at target with the status of its last body
+    OP_FOR,         // enter a for loop, expand words, break goes to target, continue to arg
+    OP_FOR_NEXT,    // set the loop variable to the next word, or leave at target
+    OP_NEXT,        // end of a loop body: note $? as the loop's status, go to target
+    OP_DONE,        // leave the innermost loop
+    OP_CASE,        // expand the case word, $? = 0, target is past the esac
+    OP_MATCH,       // go to target if the case word matches none of the patterns
+    OP_FUNCTION     // define fn
+} opcode_t;
+
+typedef struct {
+    opcode_t op;
+    int arg;
+    int slot;
+    int target;
+    union {
+        const pipeline_t *pl;       // OP_RUN
+        const words_t *words;       // OP_FOR, OP_FOR_NEXT, OP_CASE, OP_MATCH
+        function_def_t *fn;         // OP_FUNCTION
+    };
+} instr_t;
+
+typedef struct code {
+    instr_t *ops;
+    int nops;
+    int nslots;
+} code_t;
+
+int parse_line(arena_t *arena, const char *line, int (*next_line)(char **line),
+               code_t **code, function_def_t **defs);
+void parse_release(function_def_t *defs);
+void function_release(function_def_t *fn);
+const char *parse_subst_end(const char *s);
+const char *parse_param_end(const char *s);
+
+#endif
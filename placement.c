@@ -0,0 +1,358 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "placement.h"
+
+#define BITS_PER_LONG (8 * sizeof(unsigned long))
+#define MAX_NODES BITS_PER_LONG
+
+// what /sys says about one CPU the shell may run on
+typedef struct {
+    int cpu;
+    int llc;        // lowest numbered CPU sharing its last level cache (L3, else L2)
+    int l2;         // same for L2
+    int smt;        // 0 for a core's first hardware thread, 1 for the next...
+    int node;
+} cpu_info_t;
+
+static cpu_info_t *topo = NULL;     // allowed CPUs in placement order
+static int ntopo = -1;              // -1 until loaded
+static int node_of[PLACEMENT_MAX_CPUS];
+static unsigned long all_nodes = 0;
+
+// 'cpus auto' rotates over cache domains, and within one, so jobs started
+// together don't all land on the same cores
+static int next_domain = 0;
+static int *domain_offset = NULL;
+
+static void set_cpu(unsigned long *mask, int cpu) {
+    mask[cpu / BITS_PER_LONG] |= 1UL << (cpu % BITS_PER_LONG);
+}
+
+static int has_cpu(const unsigned long *mask, int cpu) {
+    return (mask[cpu / BITS_PER_LONG] >> (cpu % BITS_PER_LONG)) & 1;
+}
+
+static int parse_list(const char *s, unsigned long *mask, size_t bits) {
+    // a kernel-style list, "0-3,8,10-11", into mask, -1 if malformed
+    if (!*s) {
+        return -1;
+    }
+    while (*s) {
+        char *end;
+        errno = 0;
+        long lo = strtol(s, &end, 10);
+        if (end == s || errno || lo < 0) {
+            return -1;
+        }
+        long hi = lo;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s || errno || hi < lo) {
+                return -1;
+            }
+        }
+        if ((size_t)hi >= bits) {
+            return -1;
+        }
+        for (long c = lo; c <= hi; c++) {
+            mask[c / BITS_PER_LONG] |= 1UL << (c % BITS_PER_LONG);
+        }
+        s = end;
+        if (*s == ',') {
+            s++;
+        } else if (*s && *s != '\n') {
+            return -1;
+        } else {
+            break;
+        }
+    }
+    return 0;
+}
+
+static int read_line(const char *path, char *buf, size_t len) {
+    FILE *f = fopen(path, "re");
+    if (!f) {
+        return -1;
+    }
+    int ok = fgets(buf, len, f) != NULL;
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+static int first_in_list(const char *path, int fallback) {
+    // lowest CPU of a sysfs list file, which names the group it describes
+    char buf[256];
+    unsigned long mask[PLACEMENT_MAX_CPUS / BITS_PER_LONG] = { 0 };
+    if (read_line(path, buf, sizeof(buf)) < 0 || parse_list(buf, mask, PLACEMENT_MAX_CPUS) < 0) {
+        return fallback;
+    }
+    for (int c = 0; c < PLACEMENT_MAX_CPUS; c++) {
+        if (has_cpu(mask, c)) {
+            return c;
+        }
+    }
+    return fallback;
+}
+
+static int smt_rank(int cpu) {
+    // position of cpu among its core's hardware threads
+    char path[128], buf[256];
+    unsigned long mask[PLACEMENT_MAX_CPUS / BITS_PER_LONG] = { 0 };
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    if (read_line(path, buf, sizeof(buf)) < 0 || parse_list(buf, mask, PLACEMENT_MAX_CPUS) < 0) {
+        return 0;
+    }
+    int rank = 0;
+    for (int c = 0; c < cpu; c++) {
+        rank += has_cpu(mask, c);
+    }
+    return rank;
+}
+
+static void cache_groups(cpu_info_t *ci) {
+    // L2 and last level cache of a CPU, from its cache/indexN entries
+    ci->l2 = ci->llc = -1;
+    for (int i = 0; i < 8; i++) {
+        char path[128], buf[32];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", ci->cpu, i);
+        if (read_line(path, buf, sizeof(buf)) < 0) {
+            break;
+        }
+        int level = atoi(buf);
+        if (level < 2) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", ci->cpu, i);
+        int group = first_in_list(path, ci->cpu);
+        if (level == 2) {
+            ci->l2 = group;
+        }
+        ci->llc = group;    // the highest level seen last
+    }
+    // no cache information (some VMs): a core is its own L2, a node one cache
+    if (ci->l2 < 0) {
+        ci->l2 = ci->cpu;
+    }
+    if (ci->llc < 0) {
+        ci->llc = -1 - ci->node;
+    }
+}
+
+static void load_nodes(void) {
+    // node_of[] from /sys/devices/system/node/nodeN/cpulist
+    DIR *dir = opendir("/sys/devices/system/node");
+    struct dirent *e;
+    while (dir && (e = readdir(dir)) != NULL) {
+        int node;
+        if (sscanf(e->d_name, "node%d", &node) != 1 || node < 0 || node >= (int)MAX_NODES) {
+            continue;
+        }
+        char path[128], buf[1024];
+        unsigned long mask[PLACEMENT_MAX_CPUS / BITS_PER_LONG] = { 0 };
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (read_line(path, buf, sizeof(buf)) < 0 || parse_list(buf, mask, PLACEMENT_MAX_CPUS) < 0) {
+            continue;
+        }
+        all_nodes |= 1UL << node;
+        for (int c = 0; c < PLACEMENT_MAX_CPUS; c++) {
+            if (has_cpu(mask, c)) {
+                node_of[c] = node;
+            }
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+}
+
+static int compare_placement(const void *a, const void *b) {
+    // same cache together, first threads of every core before second threads,
+    // then cores sharing an L2 next to each other
+    const cpu_info_t *x = a, *y = b;
+    if (x->llc != y->llc) {
+        return x->llc < y->llc ? -1 : 1;
+    }
+    if (x->smt != y->smt) {
+        return x->smt - y->smt;
+    }
+    if (x->l2 != y->l2) {
+        return x->l2 - y->l2;
+    }
+    return x->cpu - y->cpu;
+}
+
+static int load_topology(void) {
+    // the CPUs this shell may use, read once
+    if (ntopo >= 0) {
+        return ntopo;
+    }
+    ntopo = 0;
+    load_nodes();
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        return 0;
+    }
+    topo = calloc(CPU_COUNT(&allowed), sizeof(cpu_info_t));
+    domain_offset = calloc(CPU_COUNT(&allowed), sizeof(int));
+    if (!topo || !domain_offset) {
+        return 0;
+    }
+    for (int c = 0; c < PLACEMENT_MAX_CPUS && c < CPU_SETSIZE; c++) {
+        if (!CPU_ISSET(c, &allowed)) {
+            continue;
+        }
+        cpu_info_t *ci = &topo[ntopo++];
+        ci->cpu = c;
+        ci->node = node_of[c];
+        ci->smt = smt_rank(c);
+        cache_groups(ci);
+    }
+    qsort(topo, ntopo, sizeof(cpu_info_t), compare_placement);
+    return ntopo;
+}
+
+static void fill_nodes(placement_t *p) {
+    // prefer memory on the nodes of the chosen CPUs, nothing to do if that is every node
+    p->nodes = 0;
+    for (int i = 0; i < ntopo; i++) {
+        if (has_cpu(p->cpus, topo[i].cpu)) {
+            p->nodes |= 1UL << topo[i].node;
+        }
+    }
+    if (p->nodes == all_nodes) {
+        p->nodes = 0;
+    }
+}
+
+int placement_parse(const char *list, placement_t *p) {
+    // a CPU list as given to 'cpus', returns -1 after a message if it is
+    // malformed or names no CPU this shell may use
+    memset(p, 0, sizeof(*p));
+    if (parse_list(list, p->cpus, PLACEMENT_MAX_CPUS) < 0) {
+        fprintf(stderr, "cpus: %s: expected a CPU list like 0-3,8 or auto\n", list);
+        return -1;
+    }
+    load_topology();
+    int usable = 0;
+    for (int i = 0; i < ntopo; i++) {
+        usable |= has_cpu(p->cpus, topo[i].cpu);
+    }
+    if (!usable) {
+        fprintf(stderr, "cpus: %s: no CPU this shell may run on\n", list);
+        return -1;
+    }
+    fill_nodes(p);
+    return 0;
+}
+
+int placement_auto(int nstages, placement_t *plan) {
+    // one CPU per stage in a single cache domain, stage i + 1 next to stage i
+    if (load_topology() == 0) {
+        fprintf(stderr, "cpus: auto: no CPU topology available\n");
+        return -1;
+    }
+
+    // domains are runs of the same last level cache in topo
+    int best = -1, best_size = 0, chosen = -1, chosen_start = 0, ndomains = 0;
+    int starts[ntopo], sizes[ntopo];
+    for (int i = 0; i < ntopo; i++) {
+        if (i == 0 || topo[i].llc != topo[i - 1].llc) {
+            starts[ndomains] = i;
+            sizes[ndomains++] = 0;
+        }
+        sizes[ndomains - 1]++;
+    }
+    // the next domain in turn that fits the whole pipeline, else the biggest
+    for (int k = 0; k < ndomains && chosen < 0; k++) {
+        int d = (next_domain + k) % ndomains;
+        if (sizes[d] >= nstages) {
+            chosen = d;
+        }
+        if (sizes[d] > best_size) {
+            best = d;
+            best_size = sizes[d];
+        }
+    }
+    if (chosen < 0) {
+        chosen = best;
+    }
+    next_domain = chosen + 1;
+    chosen_start = domain_offset[chosen];
+    domain_offset[chosen] = (chosen_start + nstages) % sizes[chosen];
+
+    for (int i = 0; i < nstages; i++) {
+        const cpu_info_t *ci = &topo[starts[chosen] + (chosen_start + i) % sizes[chosen]];
+        memset(&plan[i], 0, sizeof(plan[i]));
+        set_cpu(plan[i].cpus, ci->cpu);
+        plan[i].automatic = 1;
+        fill_nodes(&plan[i]);
+    }
+    return 0;
+}
+
+static size_t format_list(const unsigned long *mask, size_t bits, char *buf, size_t len) {
+    // mask back into "0-3,8" form
+    size_t n = 0;
+    buf[0] = '\0';
+    for (size_t c = 0; c < bits; c++) {
+        if (!((mask[c / BITS_PER_LONG] >> (c % BITS_PER_LONG)) & 1)) {
+            continue;
+        }
+        size_t hi = c;
+        while (hi + 1 < bits && ((mask[(hi + 1) / BITS_PER_LONG] >> ((hi + 1) % BITS_PER_LONG)) & 1)) {
+            hi++;
+        }
+        int w = (hi == c) ? snprintf(buf + n, len - n, "%s%zu", n ? "," : "", c)
+                          : snprintf(buf + n, len - n, "%s%zu-%zu", n ? "," : "", c, hi);
+        if (w < 0 || (size_t)w >= len - n) {
+            break;
+        }
+        n += w;
+        c = hi;
+    }
+    return n;
+}
+
+void placement_format(const placement_t *p, char *buf, size_t len) {
+    // "cpus 0-3 node 0", as 'jobs -l' shows it
+    size_t n = snprintf(buf, len, "cpus ");
+    if (n >= len) {
+        return;
+    }
+    n += format_list(p->cpus, PLACEMENT_MAX_CPUS, buf + n, len - n);
+    if (p->nodes && n < len) {
+        n += snprintf(buf + n, len - n, " node ");
+        if (n < len) {
+            n += format_list(&p->nodes, MAX_NODES, buf + n, len - n);
+        }
+    }
+    if (p->automatic && n < len) {
+        snprintf(buf + n, len - n, " (auto)");
+    }
+}
+
+void placement_apply(const placement_t *p) {
+    // in the child before exec, both are kept across execve
+    if (sched_setaffinity(0, sizeof(p->cpus), (const cpu_set_t *)p->cpus) < 0) {
+        perror("yash: cpus");
+    }
+    if (p->nodes) {
+        // preferred rather than bound, a full node falls back instead of failing
+        // allocations; kernels before 5.15 only prefer one node
+        unsigned long nodes = p->nodes;
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED_MANY, &nodes, MAX_NODES + 1) < 0) {
+            nodes &= -nodes;
+            syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodes, MAX_NODES + 1);
+        }
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stddef.h>
+
+// CPU affinity and NUMA memory policy for pipeline stages
+//   cpus LIST cmd | cmd    every stage on LIST (e.g. 0-7,16), memory from their nodes
+//   cmd | cpus LIST cmd    just that stage
+//   cpus auto cmd | cmd    one CPU per stage, adjacent stages on cores sharing a cache
+// set in the forked child before exec, set_mempolicy only works on the caller
+
+#define PLACEMENT_MAX_CPUS 1024
+
+typedef struct {
+    unsigned long cpus[PLACEMENT_MAX_CPUS / (8 * sizeof(unsigned long))];
+    unsigned long nodes;    // memory nodes to prefer, 0 leaves the policy alone
+    int automatic;          // chosen by 'cpus auto'
+} placement_t;
+
+int placement_parse(const char *list, placement_t *p);
+int placement_auto(int nstages, placement_t *plan);
+void placement_format(const placement_t *p, char *buf, size_t len);
+void placement_apply(const placement_t *p);
+
+#endif
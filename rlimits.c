@@ -0,0 +1,354 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include "rlimits.h"
+#include "zygote.h"
+
+typedef struct {
+    const char *name;   // in a SPEC
+    char opt;           // ulimit option
+    int resource;
+    rlim_t scale;       // ulimit's unit, 1024 for sizes (kB), 1 for counts and seconds
+    const char *desc;   // for 'ulimit -a'
+} limit_info_t;
+
+// in 'ulimit -a' order
+static const limit_info_t limit_info[] = {
+    { "core",       'c', RLIMIT_CORE,       1024, "core file size (kB)" },
+    { "data",       'd', RLIMIT_DATA,       1024, "data seg size (kB)" },
+    { "nice",       'e', RLIMIT_NICE,       1,    "scheduling priority" },
+    { "fsize",      'f', RLIMIT_FSIZE,      1024, "file size (kB)" },
+    { "sigpending", 'i', RLIMIT_SIGPENDING, 1,    "pending signals" },
+    { "memlock",    'l', RLIMIT_MEMLOCK,    1024, "max locked memory (kB)" },
+    { "rss",        'm', RLIMIT_RSS,        1024, "max memory size (kB)" },
+    { "nofile",     'n', RLIMIT_NOFILE,     1,    "open files" },
+    { "msgqueue",   'q', RLIMIT_MSGQUEUE,   1,    "POSIX message queues (bytes)" },
+    { "rtprio",     'r', RLIMIT_RTPRIO,     1,    "real-time priority" },
+    { "stack",      's', RLIMIT_STACK,      1024, "stack size (kB)" },
+    { "cpu",        't', RLIMIT_CPU,        1,    "cpu time (seconds)" },
+    { "nproc",      'u', RLIMIT_NPROC,      1,    "max user processes" },
+    { "as",         'v', RLIMIT_AS,         1024, "virtual memory (kB)" },
+    { "locks",      'x', RLIMIT_LOCKS,      1,    "file locks" },
+    { "rttime",     'R', RLIMIT_RTTIME,     1,    "real-time non-blocking time (us)" },
+};
+
+#define NUM_LIMITS (int)(sizeof(limit_info) / sizeof(limit_info[0]))
+
+// what 'limit %job' shows
+static const int job_caps[] = { RLIMIT_CPU, RLIMIT_AS, RLIMIT_NOFILE, RLIMIT_NPROC };
+
+static const limit_info_t *info_by_resource(int resource) {
+    for (int i = 0; i < NUM_LIMITS; i++) {
+        if (limit_info[i].resource == resource) {
+            return &limit_info[i];
+        }
+    }
+    return NULL;
+}
+
+static int is_bytes(const limit_info_t *info) {
+    return info->scale > 1 || info->resource == RLIMIT_MSGQUEUE;
+}
+
+static int parse_value(const char *s, size_t len, rlim_t scale, int suffixes, rlim_t *value) {
+    // "unlimited", or a number times scale, with K/M/G/T if suffixes, -1 if malformed
+    if ((len == 9 && strncmp(s, "unlimited", 9) == 0) || (len == 8 && strncmp(s, "infinity", 8) == 0)) {
+        *value = RLIM_INFINITY;
+        return 0;
+    }
+    rlim_t v = 0;
+    size_t i = 0;
+    for (; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+        if (v > (RLIM_INFINITY - 1) / 10) {
+            return -1;
+        }
+        v = v * 10 + (s[i] - '0');
+    }
+    if (i == 0) {
+        return -1;
+    }
+    if (suffixes && i + 1 == len) {
+        const char *units = "KMGT";
+        const char *u = strchr(units, s[i] & ~0x20);
+        if (!u || !s[i]) {
+            return -1;
+        }
+        for (const char *k = units; k <= u; k++) {
+            scale *= 1024;
+        }
+        i++;
+    }
+    if (i != len || (v && scale > (RLIM_INFINITY - 1) / v)) {
+        return -1;
+    }
+    *value = v * scale;
+    return 0;
+}
+
+static void format_value(rlim_t v, int suffixes, char *buf, size_t len) {
+    // the inverse of parse_value with scale 1
+    if (v == RLIM_INFINITY) {
+        snprintf(buf, len, "unlimited");
+        return;
+    }
+    int unit = 0;
+    while (suffixes && v && v % 1024 == 0 && unit < 4) {
+        v /= 1024;
+        unit++;
+    }
+    snprintf(buf, len, "%llu%.*s", (unsigned long long)v, unit ? 1 : 0, &"KMGT"[unit ? unit - 1 : 0]);
+}
+
+int rlimits_parse(const char *spec, rlimits_t *limits, const char *who) {
+    // SPEC into limits, later names win over earlier ones, -1 with a message if malformed
+    limits->n = 0;
+    const char *s = spec;
+    while (*s) {
+        const char *end = strchr(s, ',');
+        if (!end) {
+            end = s + strlen(s);
+        }
+        const char *eq = memchr(s, '=', end - s);
+        const limit_info_t *info = NULL;
+        for (int i = 0; eq && i < NUM_LIMITS; i++) {
+            if ((size_t)(eq - s) == strlen(limit_info[i].name) && strncmp(s, limit_info[i].name, eq - s) == 0) {
+                info = &limit_info[i];
+            }
+        }
+        if (!info) {
+            fprintf(stderr, "%s: %.*s: expected name=value with a name like cpu, as, nofile or nproc\n",
+                    who, (int)(end - s), s);
+            return -1;
+        }
+
+        rlimit_item_t item = { info->resource, 0, 0, 0, 0 };
+        const char *v = eq + 1;
+        const char *colon = memchr(v, ':', end - v);
+        const char *soft_end = colon ? colon : end;
+        int ok = 1;
+        if (soft_end > v) {
+            item.set_soft = 1;
+            ok &= parse_value(v, soft_end - v, 1, is_bytes(info), &item.soft) == 0;
+        }
+        if (!colon) {
+            item.set_hard = 1;
+            item.hard = item.soft;
+        } else if (end > colon + 1) {
+            item.set_hard = 1;
+            ok &= parse_value(colon + 1, end - colon - 1, 1, is_bytes(info), &item.hard) == 0;
+        }
+        if (!ok || !(item.set_soft || item.set_hard)) {
+            fprintf(stderr, "%s: %.*s: expected a number%s or 'unlimited'\n",
+                    who, (int)(end - s), s, is_bytes(info) ? " (K/M/G/T)" : "");
+            return -1;
+        }
+
+        int k = 0;
+        while (k < limits->n && limits->items[k].resource != item.resource) {
+            k++;
+        }
+        limits->items[k] = item;
+        if (k == limits->n) {
+            limits->n++;
+        }
+        s = *end ? end + 1 : end;
+    }
+    if (limits->n == 0) {
+        fprintf(stderr, "%s: empty limit list\n", who);
+        return -1;
+    }
+    return 0;
+}
+
+static void merge(const rlimit_item_t *item, struct rlimit *rl) {
+    // the item over the current limits, a lowered hard limit takes the soft one with it
+    if (item->set_hard) {
+        rl->rlim_max = item->hard;
+    }
+    if (item->set_soft) {
+        rl->rlim_cur = item->soft;
+    } else if (rl->rlim_cur > rl->rlim_max) {
+        rl->rlim_cur = rl->rlim_max;
+    }
+}
+
+int rlimits_apply(const rlimits_t *limits) {
+    // in the child before exec, -1 with a message if a limit can't be set
+    for (int i = 0; i < limits->n; i++) {
+        const rlimit_item_t *item = &limits->items[i];
+        struct rlimit rl;
+        if (getrlimit(item->resource, &rl) < 0) {
+            rl.rlim_cur = rl.rlim_max = RLIM_INFINITY;
+        }
+        merge(item, &rl);
+        if (setrlimit(item->resource, &rl) < 0) {
+            fprintf(stderr, "rlimit: %s: %s\n", info_by_resource(item->resource)->name, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int rlimits_set_pid(pid_t pid, const rlimits_t *limits) {
+    // change a running process's limits, -1 with a message if any failed
+    int result = 0;
+    for (int i = 0; i < limits->n; i++) {
+        const rlimit_item_t *item = &limits->items[i];
+        struct rlimit rl;
+        if (prlimit(pid, item->resource, NULL, &rl) == 0) {
+            merge(item, &rl);
+            if (prlimit(pid, item->resource, &rl, NULL) == 0) {
+                continue;
+            }
+        }
+        if (errno == ESRCH) {
+            return 0;   // exited meanwhile
+        }
+        fprintf(stderr, "limit: %d: %s: %s\n", (int)pid, info_by_resource(item->resource)->name, strerror(errno));
+        result = -1;
+    }
+    return result;
+}
+
+void rlimits_show_pid(pid_t pid) {
+    // "PID cpu=... as=... nofile=... nproc=...", in SPEC form
+    char line[256];
+    int len = snprintf(line, sizeof(line), "%d", (int)pid);
+    for (size_t i = 0; i < sizeof(job_caps) / sizeof(job_caps[0]); i++) {
+        const limit_info_t *info = info_by_resource(job_caps[i]);
+        struct rlimit rl;
+        if (prlimit(pid, info->resource, NULL, &rl) < 0) {
+            return;     // gone, or not ours
+        }
+        char soft[32], hard[32];
+        format_value(rl.rlim_cur, is_bytes(info), soft, sizeof(soft));
+        format_value(rl.rlim_max, is_bytes(info), hard, sizeof(hard));
+        if (rl.rlim_cur == rl.rlim_max) {
+            len += snprintf(line + len, sizeof(line) - len, " %s=%s", info->name, soft);
+        } else {
+            len += snprintf(line + len, sizeof(line) - len, " %s=%s:%s", info->name, soft, hard);
+        }
+    }
+    printf("%s\n", line);
+}
+
+static void print_limit(const limit_info_t *info, int hard, int with_name) {
+    struct rlimit rl;
+    if (getrlimit(info->resource, &rl) < 0) {
+        fprintf(stderr, "ulimit: %s: %s\n", info->desc, strerror(errno));
+        return;
+    }
+    rlim_t v = hard ? rl.rlim_max : rl.rlim_cur;
+    if (with_name) {
+        printf("%-34s(-%c) ", info->desc, info->opt);
+    }
+    if (v == RLIM_INFINITY) {
+        printf("unlimited\n");
+    } else {
+        printf("%llu\n", (unsigned long long)(v / info->scale));
+    }
+}
+
+static int set_limit(const limit_info_t *info, const char *arg, int soft, int hard) {
+    // 'ulimit -X value' on the shell itself, so every child starts with it
+    struct rlimit rl;
+    if (getrlimit(info->resource, &rl) < 0) {
+        fprintf(stderr, "ulimit: %s: %s\n", info->desc, strerror(errno));
+        return 1;
+    }
+    rlim_t v;
+    if (strcmp(arg, "hard") == 0) {
+        v = rl.rlim_max;
+    } else if (strcmp(arg, "soft") == 0) {
+        v = rl.rlim_cur;
+    } else if (parse_value(arg, strlen(arg), info->scale, 0, &v) < 0) {
+        fprintf(stderr, "ulimit: %s: invalid number\n", arg);
+        return 2;
+    }
+    rlimit_item_t item = { info->resource, soft, hard, v, v };
+    merge(&item, &rl);
+    if (setrlimit(info->resource, &rl) < 0) {
+        fprintf(stderr, "ulimit: %s: cannot modify limit: %s\n", info->desc, strerror(errno));
+        return 1;
+    }
+    // the spawn server's children inherit its limits, not ours
+    zygote_setrlimit(info->resource, &rl);
+    return 0;
+}
+
+int run_ulimit(char **args) {
+    // ulimit [-SH] [-a | -X [value]...], -X is one of limit_info's options, -f by default
+    // without -S or -H a value sets both, and the soft limit is shown
+    int soft = 0, hard = 0, all = 0;
+    const limit_info_t *chosen[NUM_LIMITS + 1];
+    const char *values[NUM_LIMITS + 1];
+    int n = 0;
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *o = args[i] + 1; *o; o++) {
+            if (*o == 'S') {
+                soft = 1;
+            } else if (*o == 'H') {
+                hard = 1;
+            } else if (*o == 'a') {
+                all = 1;
+            } else {
+                const limit_info_t *info = NULL;
+                for (int k = 0; k < NUM_LIMITS; k++) {
+                    if (limit_info[k].opt == *o) {
+                        info = &limit_info[k];
+                    }
+                }
+                if (!info || n == NUM_LIMITS) {
+                    fprintf(stderr, "ulimit: -%c: invalid option\n", *o);
+                    fprintf(stderr, "ulimit: usage: ulimit [-SHa] [-cdefilmnqrstuvxR [value]]\n");
+                    return 2;
+                }
+                chosen[n] = info;
+                values[n++] = NULL;
+            }
+        }
+        // a value right after an option belongs to its last resource
+        if (n && !values[n - 1] && args[i + 1] && args[i + 1][0] != '-') {
+            values[n - 1] = args[++i];
+        }
+    }
+    if (args[i]) {
+        if (n == 0) {
+            chosen[n] = info_by_resource(RLIMIT_FSIZE);
+            values[n++] = args[i++];
+        }
+        if (args[i]) {
+            fprintf(stderr, "ulimit: too many arguments\n");
+            return 2;
+        }
+    }
+    if (all) {
+        for (int k = 0; k < NUM_LIMITS; k++) {
+            print_limit(&limit_info[k], hard && !soft, 1);
+        }
+        return 0;
+    }
+    if (n == 0) {
+        chosen[n] = info_by_resource(RLIMIT_FSIZE);
+        values[n++] = NULL;
+    }
+
+    int status = 0;
+    for (int k = 0; k < n; k++) {
+        if (values[k]) {
+            int s = set_limit(chosen[k], values[k], soft || !hard, hard || !soft);
+            status = s > status ? s : status;
+        } else {
+            print_limit(chosen[k], hard && !soft, n > 1);
+        }
+    }
+    return status;
+}
@@ -0,0 +1,32 @@
+#ifndef RLIMITS_H
+#define RLIMITS_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// resource limits
+//   ulimit [-SH] [-a | -c|-d|-e|-f|-i|-l|-m|-n|-q|-r|-s|-t|-u|-v|-x|-R [value]]...
+//                          the shell's own limits, every child inherits them
+//   rlimit SPEC cmd | cmd  caps for one job only, set in its children before exec
+//   limit %job|PID [SPEC]  show or change the limits of a running job with prlimit
+// SPEC is name=value[,name=value...], e.g. cpu=60,as=2G,nofile=256,nproc=64
+// a value is N (soft and hard), SOFT:HARD, SOFT: or :HARD, N may be 'unlimited'
+
+typedef struct {
+    int resource;
+    int set_soft, set_hard;
+    rlim_t soft, hard;
+} rlimit_item_t;
+
+typedef struct {
+    int n;
+    rlimit_item_t items[RLIM_NLIMITS];
+} rlimits_t;
+
+int rlimits_parse(const char *spec, rlimits_t *limits, const char *who);
+int rlimits_apply(const rlimits_t *limits);
+int rlimits_set_pid(pid_t pid, const rlimits_t *limits);
+void rlimits_show_pid(pid_t pid);
+int run_ulimit(char **args);
+
+#endif
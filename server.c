@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "server.h"
+#include "builtins.h"
+#include "events.h"
+#include "expand.h"
+#include "jobs.h"
+#include "spawn.h"
+#include "vars.h"
+
+// a request being run: its connection, where the reply goes, and the job running it
+typedef struct {
+    int conn;
+    job_t *job;
+    int hung_up;
+} client_t;
+
+static client_t *clients;
+static int nclients;
+static int clients_cap;
+
+static int request_child(char **args) {
+    // forked copy of the server for one request
+    // the connection is its stdin until the request brings the client's own
+    (void)args;
+    enter_subshell();
+    // the server's own jobs are the other requests, not this client's
+    jobs_forget();
+
+    char *text = malloc(SERVER_MAX_MSG);
+    if (!text) {
+        perror("yash: server");
+        return 1;
+    }
+    union {
+        struct cmsghdr hdr;
+        char space[CMSG_SPACE(SERVER_NFDS * sizeof(int))];
+    } control;
+    struct iovec iov = { text, SERVER_MAX_MSG };
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.space, .msg_controllen = sizeof(control.space)
+    };
+    ssize_t n;
+    while ((n = recvmsg(STDIN_FILENO, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+    }
+
+    int fds[SERVER_NFDS];
+    int nfds = 0;
+    for (struct cmsghdr *c = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL; c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count && nfds < SERVER_NFDS; i++) {
+            memcpy(&fds[nfds++], CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+        }
+    }
+    if (n <= 0 || nfds != SERVER_NFDS || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || text[n - 1] != '\0') {
+        fprintf(stderr, "yash: server: bad request\n");
+        return 2;
+    }
+
+    // the fds came in above stderr, stdin replaces the connection
+    for (int fd = 0; fd <= STDERR_FILENO; fd++) {
+        dup2(fds[fd], fd);
+        close(fds[fd]);
+    }
+    int in_cwd = fchdir(fds[3]) == 0;
+    close(fds[3]);
+    if (!in_cwd) {
+        fprintf(stderr, "yash: server: cwd: %s\n", strerror(errno));
+        return 1;
+    }
+    char *cwd = getcwd(NULL, 0);
+    if (cwd) {
+        var_set("PWD", cwd);
+        free(cwd);
+    }
+
+    int status = run_string(text);
+    free(text);
+    return status;
+}
+
+static int start_request(int conn) {
+    // a job of its own for each client, in its own process group
+    if (nclients == clients_cap) {
+        int cap = clients_cap ? clients_cap * 2 : 16;
+        client_t *grown = realloc(clients, cap * sizeof(client_t));
+        if (!grown) {
+            return -1;
+        }
+        clients = grown;
+        clients_cap = cap;
+    }
+    job_t *job = add_job("yash --client", RUNNING);
+    if (!job) {
+        return -1;
+    }
+
+    char *argv[] = { "yash --client", NULL };
+    spawn_req_t req;
+    spawn_req_init(&req, argv, 0, 0, events_child_mask());
+    spawn_add_dup(&req, conn, STDIN_FILENO);
+    req.builtin = request_child;
+    fflush(stdout);
+    pid_t pid = spawn_start(&req);
+    spawn_req_free(&req);
+    if (pid < 0 || add_job_process(job, pid) < 0) {
+        if (pid > 0) {
+            kill(pid, SIGKILL);     // reaped by the event loop, no job to report to
+        }
+        remove_job(job);
+        return -1;
+    }
+    watch_job(job);
+    events_hangup_watch(conn);
+
+    clients[nclients].conn = conn;
+    clients[nclients].job = job;
+    clients[nclients].hung_up = 0;
+    nclients++;
+    return 0;
+}
+
+static void accept_clients(int sock) {
+    for (;;) {
+        int conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+        if (conn < 0) {
+            if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED) {
+                perror("yash: server: accept");
+            }
+            if (errno != EINTR && errno != ECONNABORTED) {
+                return;
+            }
+            continue;
+        }
+        if (start_request(conn) < 0) {
+            perror("yash: server");
+            close(conn);
+        }
+    }
+}
+
+static void finish_clients(void) {
+    // reply for every job that is done, stop the ones whose client went away
+    for (int i = 0; i < nclients; i++) {
+        client_t *c = &clients[i];
+        if (c->job->state == DONE) {
+            server_reply_t reply;
+            memset(&reply, 0, sizeof(reply));
+            reply.status = job_status(c->job);
+            job_rusage(c->job, &reply.usage);
+            // the client only reads from here on, the reply always fits
+            send(c->conn, &reply, sizeof(reply), MSG_NOSIGNAL | MSG_DONTWAIT);
+            events_hangup_close(c->conn);
+            remove_job(c->job);
+            clients[i--] = clients[--nclients];
+            continue;
+        }
+        char byte;
+        if (!c->hung_up && recv(c->conn, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0) {
+            // like a terminal going away under a session
+            kill(-c->job->pgid, SIGHUP);
+            kill(-c->job->pgid, SIGCONT);
+            c->hung_up = 1;
+        }
+    }
+}
+
+int server_run(const char *path) {
+    // serve until killed, every request is run by a forked copy of the shell as it is now
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "yash: %s: socket path too long\n", path);
+        return 2;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        perror("yash: server: socket");
+        return 1;
+    }
+    // a socket left behind by an earlier server is replaced, anything else is not
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, SOMAXCONN) < 0) {
+        fprintf(stderr, "yash: %s: %s\n", path, strerror(errno));
+        close(sock);
+        return 1;
+    }
+
+    for (;;) {
+        if (events_wait_any(sock) > 0) {
+            accept_clients(sock);
+        }
+        finish_clients();
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+#include <sys/resource.h>
+
+// command server: a long-lived yash that runs command lines for clients over a
+// unix socket, so they skip the shell's startup
+//   yash --server SOCKET               listen on SOCKET (an old socket file there is replaced)
+//   yash --client SOCKET [-t] CMDS     run CMDS on the server with our stdin/out/err and
+//                                      cwd, exit with its status, -t prints its times
+// a request is one SOCK_SEQPACKET packet: the command text, NUL terminated, with
+// stdin, stdout, stderr and the cwd (an O_PATH fd) attached with SCM_RIGHTS
+// each request runs in a forked copy of the server in its own process group, a job of
+// the server's; a client that hangs up before the reply gets its job sent SIGHUP
+// the reply is a server_reply_t once the job is done
+
+#define SERVER_MAX_MSG (128 * 1024)     // longest command text, fits a packet with the buffers raised
+#define SERVER_NFDS 4                   // stdin, stdout, stderr, cwd
+
+typedef struct {
+    int32_t status;         // as $? would show it
+    struct rusage usage;    // the request's process and every child it waited for
+} server_reply_t;
+
+int server_run(const char *path);
+
+// client side (client.c), no shell state needed
+int client_call(const char *path, const char *text, struct rusage *usage);
+int client_main(int argc, char **argv);
+
+#endif
@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include "spawn.h"
+#include "zygote.h"
+
+extern char **environ;
+
+// glibc 2.35 can give the terminal to the child's group as a spawn file action
+#ifdef __GLIBC_PREREQ
+#if __GLIBC_PREREQ(2, 35)
+#define SPAWN_HAVE_TCSETPGRP 1
+#endif
+#endif
+
+spawn_mode_t spawn_mode = SPAWN_MODE_SPAWN;
+
+// signals the shell handles or ignores that children get back at default
+static const int default_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD };
+
+#define NUM_DEFAULT_SIGNALS (int)(sizeof(default_signals) / sizeof(default_signals[0]))
+
+void spawn_init(void) {
+    // YASH_SPAWN=fork|spawn|zygote picks the launch path, so they can be compared
+    // the spawn server has to start before the shell grows, call this early
+    const char *mode = getenv("YASH_SPAWN");
+    if (mode && strcmp(mode, "fork") == 0) {
+        spawn_mode = SPAWN_MODE_FORK;
+    } else if (mode && strcmp(mode, "zygote") == 0) {
+        if (zygote_start() == 0) {
+            spawn_mode = SPAWN_MODE_ZYGOTE;
+        } else {
+            perror("yash: spawn server");
+            spawn_mode = SPAWN_MODE_SPAWN;
+        }
+    } else {
+        spawn_mode = SPAWN_MODE_SPAWN;
+    }
+}
+
+void spawn_req_init(spawn_req_t *req, char *const *argv, pid_t pgid, int foreground, const sigset_t *sigmask) {
+    req->argv = argv;
+    req->envp = NULL;
+    req->path = NULL;
+    req->pgid = pgid;
+    req->foreground = foreground;
+    req->sigmask = sigmask;
+    req->dups = NULL;
+    req->ndups = 0;
+    req->dups_cap = 0;
+    req->builtin = NULL;
+    req->placement = NULL;
+    req->limits = NULL;
+    req->timing = NULL;
+}
+
+int spawn_add_dup(spawn_req_t *req, int src_fd, int fd) {
+    if (req->ndups == req->dups_cap) {
+        int cap = req->dups_cap ? req->dups_cap * 2 : 4;
+        spawn_dup_t *dups = realloc(req->dups, cap * sizeof(spawn_dup_t));
+        if (!dups) {
+            return -1;
+        }
+        req->dups = dups;
+        req->dups_cap = cap;
+    }
+    req->dups[req->ndups].src_fd = src_fd;
+    req->dups[req->ndups].fd = fd;
+    req->ndups++;
+    return 0;
+}
+
+void spawn_req_free(spawn_req_t *req) {
+    free(req->dups);
+    req->dups = NULL;
+    req->ndups = 0;
+    req->dups_cap = 0;
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void close_cloexec_fds(void) {
+    // a builtin child never execs, close what exec would have
+    // so it doesn't hold pipe ends open behind its siblings
+    DIR *dir = opendir("/proc/self/fd");
+    if (!dir) {
+        return;
+    }
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+        int fd = atoi(e->d_name);
+        if (fd <= STDERR_FILENO || fd == dirfd(dir)) {
+            continue;
+        }
+        int flags = fcntl(fd, F_GETFD);
+        if (flags >= 0 && (flags & FD_CLOEXEC)) {
+            close(fd);
+        }
+    }
+    closedir(dir);
+}
+
+static pid_t spawn_fork(const spawn_req_t *req) {
+    // fallback path, same setup done by hand in a forked child
+    // with timing the child reports its timestamps over a close-on-exec pipe,
+    // EOF on it means the exec went through
+    int timing_fd[2] = { -1, -1 };
+    if (req->timing && pipe2(timing_fd, O_CLOEXEC) == 0) {
+        // keep it out of the way of the child's dup2s
+        int high = fcntl(timing_fd[1], F_DUPFD_CLOEXEC, 64);
+        if (high >= 0) {
+            close(timing_fd[1]);
+            timing_fd[1] = high;
+        }
+    }
+
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        if (timing_fd[0] >= 0) {
+            close(timing_fd[0]);
+            close(timing_fd[1]);
+        }
+        return -1;
+    }
+    else if (pid == 0) {
+        // child
+        long long stamps[2];
+        stamps[0] = (timing_fd[1] >= 0) ? now_ns() : 0;
+
+        if (req->pgid >= 0) {
+            setpgid(0, req->pgid);
+        }
+
+        // take the terminal before exec so a fast reader isn't stopped by SIGTTIN
+        if (req->foreground) {
+            tcsetpgrp(STDIN_FILENO, getpgrp());
+        }
+
+        for (int i = 0; i < NUM_DEFAULT_SIGNALS; i++) {
+            signal(default_signals[i], SIG_DFL);
+        }
+        sigprocmask(SIG_SETMASK, req->sigmask, NULL);
+
+        if (req->placement) {
+            placement_apply(req->placement);
+        }
+        // a job that was meant to be capped must not run uncapped
+        if (req->limits && rlimits_apply(req->limits) < 0) {
+            _exit(126);
+        }
+
+        for (int i = 0; i < req->ndups; i++) {
+            if (req->dups[i].src_fd < 0) {
+                close(req->dups[i].fd);
+            } else if (req->dups[i].src_fd == req->dups[i].fd) {
+                // dup2 onto itself is a no-op, just let the fd survive exec
+                fcntl(req->dups[i].fd, F_SETFD, 0);
+            } else {
+                dup2(req->dups[i].src_fd, req->dups[i].fd);
+            }
+        }
+
+        if (timing_fd[1] >= 0) {
+            stamps[1] = now_ns();
+            ssize_t n = write(timing_fd[1], stamps, sizeof(stamps));
+            (void)n;
+        }
+
+        if (req->builtin) {
+            close_cloexec_fds();
+            _exit(req->builtin((char **)req->argv));
+        }
+
+        char *const *envp = req->envp ? req->envp : environ;
+        if (req->path) {
+            execve(req->path, req->argv, envp);
+        } else {
+            execvpe(req->argv[0], req->argv, envp);
+        }
+        if (errno == ENOENT) {
+            fprintf(stderr, "Command not found: %s\n", req->argv[0]);    // execvp returns if unsuccessful
+        } else {
+            fprintf(stderr, "yash: %s: %s\n", req->argv[0], strerror(errno));
+        }
+        _exit(127); // bash error code 127
+    }
+
+    // parent, set child's pgid too so neither side races the other
+    if (req->pgid >= 0) {
+        setpgid(pid, req->pgid ? req->pgid : pid);
+    }
+
+    if (timing_fd[0] >= 0) {
+        long long stamps[2] = { 0, 0 };
+        close(timing_fd[1]);
+        ssize_t n;
+        do {
+            n = read(timing_fd[0], stamps, sizeof(stamps));
+        } while (n < 0 && errno == EINTR);
+        if (n == sizeof(stamps)) {
+            char eof;
+            while (read(timing_fd[0], &eof, 1) < 0 && errno == EINTR) {
+            }
+        }
+        req->timing->child_start = stamps[0];
+        req->timing->setup_done = stamps[1];
+        req->timing->exec_done = now_ns();
+        close(timing_fd[0]);
+    }
+    return pid;
+}
+
+static pid_t spawn_posix(const spawn_req_t *req) {
+    // pgid, signal defaults and fd setup expressed as spawn attributes/file actions
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    pid_t pid = -1;
+    int err;
+
+    if ((err = posix_spawnattr_init(&attr)) != 0) {
+        errno = err;
+        return -1;
+    }
+    if ((err = posix_spawn_file_actions_init(&actions)) != 0) {
+        posix_spawnattr_destroy(&attr);
+        errno = err;
+        return -1;
+    }
+
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    for (int i = 0; i < NUM_DEFAULT_SIGNALS; i++) {
+        sigaddset(&defaults, default_signals[i]);
+    }
+
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    if (req->pgid >= 0) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, req->pgid);
+    }
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, req->sigmask);
+    posix_spawnattr_setflags(&attr, flags);
+
+#ifdef SPAWN_HAVE_TCSETPGRP
+    // runs after the setpgid and before the dups, on the shell's stdin, the terminal;
+    // the child still has every signal blocked there, so it isn't stopped by SIGTTOU
+    if (req->foreground) {
+        err = posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+    }
+#endif
+    for (int i = 0; err == 0 && i < req->ndups; i++) {
+        // a dup onto itself clears close-on-exec
+        if (req->dups[i].src_fd < 0) {
+            err = posix_spawn_file_actions_addclose(&actions, req->dups[i].fd);
+        } else {
+            err = posix_spawn_file_actions_adddup2(&actions, req->dups[i].src_fd, req->dups[i].fd);
+        }
+    }
+
+    char *const *envp = req->envp ? req->envp : environ;
+    if (err == 0 && req->path) {
+        // already resolved, no PATH walk in the child
+        err = posix_spawn(&pid, req->path, &actions, &attr, req->argv, envp);
+    } else if (err == 0) {
+        err = posix_spawnp(&pid, req->argv[0], &actions, &attr, req->argv, envp);
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    if (req->timing) {
+        // posix_spawn only returns once the child has exec'd, its setup can't be seen
+        req->timing->child_start = 0;
+        req->timing->setup_done = 0;
+        req->timing->exec_done = now_ns();
+    }
+    return pid;
+}
+
+#define MAX_ARG_STRLEN (32 * 4096)      // the kernel's cap on a single argument or environment string
+
+int spawn_args_fit(char *const *argv, char *const *envp) {
+    // whether argv and the environment fit what execve takes, says why not if they don't,
+    // so a glob that matched too much is a clear error rather than a failed exec
+    long limit = sysconf(_SC_ARG_MAX);
+    size_t total = 2 * sizeof(char *);  // both NULL terminators
+    int argc = 0;
+    for (char *const *a = argv; *a; a++, argc++) {
+        size_t len = strlen(*a) + 1;
+        if (len > MAX_ARG_STRLEN) {
+            fprintf(stderr, "yash: %s: argument %d is %zu bytes, longer than the %d an exec allows\n",
+                    argv[0], argc, len - 1, MAX_ARG_STRLEN - 1);
+            return 0;
+        }
+        total += len + sizeof(char *);
+    }
+    for (char *const *e = envp ? envp : environ; *e; e++) {
+        total += strlen(*e) + 1 + sizeof(char *);
+    }
+    if (limit > 0 && total > (size_t)limit) {
+        fprintf(stderr, "yash: %s: argument list too long: %d arguments, %zu bytes with the environment, the limit is %ld\n",
+                argv[0], argc, total, limit);
+        return 0;
+    }
+    return 1;
+}
+
+pid_t spawn_start(const spawn_req_t *req) {
+    // launch argv with the requested setup, returns the pid or -1 with errno set
+    // a failed exec on the spawn path is reported here, on the fork path by the child
+    if (req->builtin) {
+        return spawn_fork(req);     // nothing to exec, the child runs the shell's code
+    }
+    if (req->placement || req->limits) {
+        return spawn_fork(req);     // the memory policy and limits are set by the child itself
+    }
+    if (spawn_mode == SPAWN_MODE_ZYGOTE && zygote_can_spawn(req)) {
+        pid_t pid = zygote_spawn(req);
+        if (pid >= 0 || (errno != EMSGSIZE && errno != EPIPE)) {
+            return pid;
+        }
+        // too big for one request or the server is gone, spawn directly
+    }
+#ifndef SPAWN_HAVE_TCSETPGRP
+    // without tcsetpgrp in the child a foreground reader could hit SIGTTIN before the shell hands over the terminal
+    if (req->foreground) {
+        return spawn_fork(req);
+    }
+#endif
+    if (spawn_mode == SPAWN_MODE_FORK) {
+        return spawn_fork(req);
+    }
+    return spawn_posix(req);
+}
@@ -0,0 +1,56 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <sys/types.h>
+#include <signal.h>
+#include "placement.h"
+#include "rlimits.h"
+
+// how children are launched
+typedef enum {
+    SPAWN_MODE_SPAWN,   // posix_spawn (clone(CLONE_VM|CLONE_VFORK) in glibc)
+    SPAWN_MODE_FORK,    // plain fork() + exec
+    SPAWN_MODE_ZYGOTE   // handed to the spawn server forked at startup (zygote.c)
+} spawn_mode_t;
+
+// fd to install in the child: dup2(src_fd, fd), or close(fd) if src_fd is -1
+typedef struct {
+    int src_fd;
+    int fd;
+} spawn_dup_t;
+
+// when the child got through its setup, for tracing
+// child_start/setup_done are only known on the fork path, 0 otherwise
+typedef struct {
+    long long child_start;  // ns, CLOCK_MONOTONIC
+    long long setup_done;
+    long long exec_done;    // exec succeeded or the child gave up
+} spawn_timing_t;
+
+// everything the child needs set up between fork and exec
+typedef struct {
+    char *const *argv;
+    char *const *envp;      // environment to exec with, NULL for environ (the shell's exported variables)
+    const char *path;       // resolved executable, NULL searches PATH for argv[0]
+    pid_t pgid;             // 0 starts a new group, > 0 joins that group, -1 stays in the shell's
+    int foreground;         // child takes the terminal before exec
+    const sigset_t *sigmask; // signal mask the child execs with
+    spawn_dup_t *dups;      // applied in order
+    int ndups;
+    int dups_cap;
+    int (*builtin)(char **argv); // run in a forked child instead of exec, its return is the exit status
+    const placement_t *placement; // CPUs and memory nodes, set in the child (fork path only)
+    const rlimits_t *limits; // resource caps for this child only (fork path only)
+    spawn_timing_t *timing; // filled in if set, costs a pipe and a wait for the exec
+} spawn_req_t;
+
+extern spawn_mode_t spawn_mode;
+
+void spawn_init(void);
+void spawn_req_init(spawn_req_t *req, char *const *argv, pid_t pgid, int foreground, const sigset_t *sigmask);
+int spawn_add_dup(spawn_req_t *req, int src_fd, int fd);
+void spawn_req_free(spawn_req_t *req);
+int spawn_args_fit(char *const *argv, char *const *envp);
+pid_t spawn_start(const spawn_req_t *req);
+
+#endif
@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "stats.h"
+
+// HDR-style histogram: values below 4 get a bucket each, above that every
+// power of two is split into 4 buckets, so any value is within 25% of its
+// bucket's bounds and 256 buckets cover the whole 64-bit range
+#define SUB_BITS 2
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NBUCKETS 256
+
+// errno values counted individually, anything larger lands in slot 0
+#define STATS_ERRNOS 256
+
+// Prometheus buckets are every power of two from ~1us to ~8.6s
+#define PROM_LOW_SHIFT 10
+#define PROM_HIGH_SHIFT 33
+
+typedef struct {
+    unsigned long counts[NBUCKETS];
+    unsigned long n;
+    unsigned long long sum;     // ns
+    unsigned long long max;
+} histogram_t;
+
+static const char *hist_names[STATS_NHISTS] = { "spawn", "exec" };
+
+static const char *hist_help[STATS_NHISTS] = {
+    "Time the shell spent starting a child, including its exec with posix_spawn.",
+    "Time from a forked child's setup to its exec, only measured while tracing on the fork path."
+};
+
+shell_stats_t shell_stats;
+
+static histogram_t hists[STATS_NHISTS];
+static unsigned long exec_failures[STATS_ERRNOS];
+static char *stats_file = NULL;
+
+static int bucket_of(unsigned long long v) {
+    if (v < SUB_BUCKETS) {
+        return v;
+    }
+    int msb = 63 - __builtin_clzll(v);
+    return ((msb - SUB_BITS + 1) << SUB_BITS) | ((v >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+static unsigned long long bucket_limit(int i) {
+    // first value past bucket i
+    if (i < SUB_BUCKETS) {
+        return i + 1;
+    }
+    int shift = (i >> SUB_BITS) - 1;
+    unsigned long long base = SUB_BUCKETS | (i & (SUB_BUCKETS - 1));
+    return (base + 1) << shift;
+}
+
+void stats_init(void) {
+    // YASH_STATS=FILE dumps from startup on
+    const char *path = getenv("YASH_STATS");
+    if (path && *path) {
+        stats_open(path);
+    }
+}
+
+void stats_latency(stats_hist_t hist, long long ns) {
+    histogram_t *h = &hists[hist];
+    unsigned long long v = ns > 0 ? ns : 0;
+    h->counts[bucket_of(v)]++;
+    h->n++;
+    h->sum += v;
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+void stats_exec_failed(int err) {
+    exec_failures[(err > 0 && err < STATS_ERRNOS) ? err : 0]++;
+}
+
+void stats_job_added(void) {
+    shell_stats.jobs_created++;
+    if (++shell_stats.jobs_current > shell_stats.jobs_max) {
+        shell_stats.jobs_max = shell_stats.jobs_current;
+    }
+}
+
+void stats_job_removed(void) {
+    shell_stats.jobs_current--;
+}
+
+void stats_reset(void) {
+    // start over, jobs still in the table stay counted
+    long current = shell_stats.jobs_current;
+    memset(&shell_stats, 0, sizeof(shell_stats));
+    memset(hists, 0, sizeof(hists));
+    memset(exec_failures, 0, sizeof(exec_failures));
+    shell_stats.jobs_current = shell_stats.jobs_max = current;
+}
+
+static const char *errno_name(int err, char *buf, size_t len) {
+    const char *name = err ? strerrorname_np(err) : NULL;
+    if (!name) {
+        snprintf(buf, len, "%d", err);
+        name = buf;
+    }
+    return name;
+}
+
+static unsigned long long percentile(const histogram_t *h, int pct) {
+    // upper bound of the bucket holding the pct'th percentile, in ns
+    unsigned long target = (h->n * pct + 99) / 100;
+    unsigned long seen = 0;
+    for (int i = 0; i < NBUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= target && seen > 0) {
+            unsigned long long v = bucket_limit(i) - 1;
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+void stats_print(FILE *out) {
+    // human-readable summary for 'shstats'
+    unsigned long failures = 0;
+    for (int i = 0; i < STATS_ERRNOS; i++) {
+        failures += exec_failures[i];
+    }
+
+    fprintf(out, "spawns\t\t%lu\n", shell_stats.spawns);
+    fprintf(out, "exec failures\t%lu", failures);
+    const char *sep = "\t(";
+    for (int i = 0; i < STATS_ERRNOS; i++) {
+        if (exec_failures[i]) {
+            char buf[16];
+            fprintf(out, "%s%s %lu", sep, errno_name(i, buf, sizeof(buf)), exec_failures[i]);
+            sep = ", ";
+        }
+    }
+    fprintf(out, "%s\n", failures ? ")" : "");
+    fprintf(out, "pipelines\t%lu\n", shell_stats.pipelines);
+    fprintf(out, "sigchld wakeups\t%lu\n", shell_stats.sigchld_wakeups);
+    fprintf(out, "children reaped\t%lu\n", shell_stats.children_reaped);
+    fprintf(out, "jobs created\t%lu\n", shell_stats.jobs_created);
+    fprintf(out, "jobs stopped\t%lu\n", shell_stats.jobs_stopped);
+    fprintf(out, "jobs reaped\t%lu\n", shell_stats.jobs_reaped);
+    fprintf(out, "jobs\t\t%ld (max %ld)\n", shell_stats.jobs_current, shell_stats.jobs_max);
+
+    for (int h = 0; h < STATS_NHISTS; h++) {
+        const histogram_t *hist = &hists[h];
+        fprintf(out, "%s latency\tn=%lu", hist_names[h], hist->n);
+        if (hist->n) {
+            fprintf(out, " p50=%.1fus p90=%.1fus p99=%.1fus max=%.1fus",
+                    percentile(hist, 50) / 1e3, percentile(hist, 90) / 1e3,
+                    percentile(hist, 99) / 1e3, hist->max / 1e3);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+static void prom_metric(FILE *out, const char *name, const char *type, const char *help, double value) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n", name, help, name, type, name, value);
+}
+
+void stats_prometheus(FILE *out) {
+    // Prometheus text exposition format, seconds for latencies
+    prom_metric(out, "yash_spawns_total", "counter", "Children started.", shell_stats.spawns);
+    prom_metric(out, "yash_pipelines_total", "counter", "Pipelines launched as jobs.", shell_stats.pipelines);
+    prom_metric(out, "yash_sigchld_wakeups_total", "counter", "Event loop wakeups that reaped children.", shell_stats.sigchld_wakeups);
+    prom_metric(out, "yash_children_reaped_total", "counter", "Children reaped.", shell_stats.children_reaped);
+    prom_metric(out, "yash_jobs_created_total", "counter", "Jobs added to the job table.", shell_stats.jobs_created);
+    prom_metric(out, "yash_jobs_stopped_total", "counter", "Times a job stopped.", shell_stats.jobs_stopped);
+    prom_metric(out, "yash_jobs_reaped_total", "counter", "Jobs whose every process exited.", shell_stats.jobs_reaped);
+    prom_metric(out, "yash_jobs", "gauge", "Jobs in the job table.", shell_stats.jobs_current);
+    prom_metric(out, "yash_jobs_max", "gauge", "Most jobs in the job table at once.", shell_stats.jobs_max);
+
+    fprintf(out, "# HELP yash_exec_failures_total Commands that could not be started, by errno.\n");
+    fprintf(out, "# TYPE yash_exec_failures_total counter\n");
+    for (int i = 0; i < STATS_ERRNOS; i++) {
+        if (exec_failures[i]) {
+            char buf[16];
+            fprintf(out, "yash_exec_failures_total{errno=\"%s\"} %lu\n", errno_name(i, buf, sizeof(buf)), exec_failures[i]);
+        }
+    }
+
+    for (int h = 0; h < STATS_NHISTS; h++) {
+        const histogram_t *hist = &hists[h];
+        const char *name = hist_names[h];
+        fprintf(out, "# HELP yash_%s_seconds %s\n# TYPE yash_%s_seconds histogram\n", name, hist_help[h], name);
+
+        // a power of two is always a bucket boundary, so these counts are exact
+        unsigned long cumulative = 0;
+        int i = 0;
+        for (int shift = PROM_LOW_SHIFT; shift <= PROM_HIGH_SHIFT; shift++) {
+            for (int end = bucket_of(1ULL << shift); i < end; i++) {
+                cumulative += hist->counts[i];
+            }
+            fprintf(out, "yash_%s_seconds_bucket{le=\"%g\"} %lu\n", name, (1ULL << shift) / 1e9, cumulative);
+        }
+        fprintf(out, "yash_%s_seconds_bucket{le=\"+Inf\"} %lu\n", name, hist->n);
+        fprintf(out, "yash_%s_seconds_sum %.9f\n", name, hist->sum / 1e9);
+        fprintf(out, "yash_%s_seconds_count %lu\n", name, hist->n);
+    }
+}
+
+static int write_file(void) {
+    // write to a temporary and rename it over, so a collector never reads half a file
+    size_t len = strlen(stats_file) + 5;
+    char *tmp = malloc(len);
+    if (!tmp) {
+        return -1;
+    }
+    snprintf(tmp, len, "%s.tmp", stats_file);
+
+    FILE *f = fopen(tmp, "we");
+    if (!f) {
+        fprintf(stderr, "yash: stats: %s: %s\n", tmp, strerror(errno));
+        free(tmp);
+        return -1;
+    }
+    stats_prometheus(f);
+    int err = ferror(f);
+    if (fclose(f) != 0 || err || rename(tmp, stats_file) < 0) {
+        fprintf(stderr, "yash: stats: %s: %s\n", stats_file, strerror(errno ? errno : EIO));
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+    return 0;
+}
+
+int stats_open(const char *path) {
+    // dump to path on exit and SIGUSR1, written once now so a bad path shows up at once
+    char *file = strdup(path);
+    if (!file) {
+        return -1;
+    }
+    free(stats_file);
+    stats_file = file;
+    if (write_file() < 0) {
+        stats_forget();
+        return -1;
+    }
+    return 0;
+}
+
+void stats_dump(void) {
+    // SIGUSR1
+    if (stats_file) {
+        write_file();
+    }
+}
+
+void stats_close(void) {
+    // final dump, then stop
+    stats_dump();
+    stats_forget();
+}
+
+void stats_forget(void) {
+    // stop dumping without writing, a forked child leaves the file to the shell
+    free(stats_file);
+    stats_file = NULL;
+}
+
+const char *stats_path(void) {
+    return stats_file;
+}
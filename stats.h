@@ -0,0 +1,44 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+// always-on aggregate counters and latency histograms, shown by 'shstats'
+// YASH_STATS=FILE or 'shstats -o FILE' also writes them in Prometheus text
+// format to FILE on exit and on SIGUSR1
+
+typedef enum {
+    STATS_SPAWN,    // shell blocked in spawn_start, posix_spawn includes the child's exec
+    STATS_EXEC,     // child setup done to exec done, fork path with timing only
+    STATS_NHISTS
+} stats_hist_t;
+
+typedef struct {
+    unsigned long spawns;
+    unsigned long pipelines;
+    unsigned long sigchld_wakeups;  // event loop rounds that reaped
+    unsigned long children_reaped;
+    unsigned long jobs_created;
+    unsigned long jobs_stopped;
+    unsigned long jobs_reaped;      // every stage exited
+    long jobs_current;
+    long jobs_max;                  // job table high-water mark
+} shell_stats_t;
+
+extern shell_stats_t shell_stats;
+
+void stats_init(void);
+void stats_latency(stats_hist_t hist, long long ns);
+void stats_exec_failed(int err);
+void stats_job_added(void);
+void stats_job_removed(void);
+void stats_reset(void);
+void stats_print(FILE *out);
+void stats_prometheus(FILE *out);
+int stats_open(const char *path);
+void stats_dump(void);
+void stats_close(void);
+void stats_forget(void);
+const char *stats_path(void);
+
+#endif
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include "trace.h"
+#include "fdtable.h"
+
+#define TRACE_EVENTS 8192   // buffered before events are dropped
+#define DETAIL_LEN 48
+
+typedef struct {
+    char type;              // 'X' complete, 'i' instant, 'M' track name
+    unsigned char phase;
+    pid_t track;
+    long long ts;           // ns, CLOCK_MONOTONIC
+    long long dur;
+    char detail[DETAIL_LEN];
+} trace_event_t;
+
+static const char *phase_names[TRACE_NPHASES] = {
+    "parse", "resolve", "redirect", "spawn", "child setup", "exec",
+    "run", "stop", "continue", "reap"
+};
+
+int trace_enabled = 0;
+
+static trace_event_t *events = NULL;
+static int nevents = 0;
+static long dropped = 0;
+static int trace_fd = -1;
+static char *trace_file = NULL;
+static pid_t shell_pid;
+
+long long trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void trace_init(void) {
+    // YASH_TRACE=FILE traces from startup
+    const char *path = getenv("YASH_TRACE");
+    if (path && *path) {
+        trace_open(path);
+    }
+}
+
+int trace_open(const char *path) {
+    // start a new trace in path, replacing one in progress
+    trace_close();
+
+    int fd = fd_shell(open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if (fd < 0) {
+        fprintf(stderr, "yash: trace: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (!events) {
+        events = malloc(TRACE_EVENTS * sizeof(trace_event_t));
+        if (!events) {
+            close(fd);
+            return -1;
+        }
+    }
+    trace_fd = fd;
+    trace_file = strdup(path);
+    shell_pid = getpid();
+    nevents = 0;
+    dropped = 0;
+    trace_enabled = 1;
+
+    // an unterminated array is still a valid trace if the shell dies
+    if (write(trace_fd, "[\n", 2) < 0) {
+        trace_close();
+        return -1;
+    }
+    trace_name_track(shell_pid, "yash");
+    return 0;
+}
+
+static trace_event_t *new_event(char type, trace_phase_t phase, pid_t track, const char *detail) {
+    if (nevents == TRACE_EVENTS) {
+        dropped++;      // never block the command being traced
+        return NULL;
+    }
+    trace_event_t *e = &events[nevents++];
+    e->type = type;
+    e->phase = phase;
+    e->track = track;
+    e->ts = 0;
+    e->dur = 0;
+    snprintf(e->detail, sizeof(e->detail), "%s", detail ? detail : "");
+    return e;
+}
+
+void trace_complete(trace_phase_t phase, long long start, long long end, pid_t track, const char *detail) {
+    // a phase that ran from start to end (trace_now() values) on a track, 0 is the shell's
+    if (!trace_enabled) {
+        return;
+    }
+    trace_event_t *e = new_event('X', phase, track ? track : shell_pid, detail);
+    if (e) {
+        e->ts = start;
+        e->dur = end - start;
+    }
+}
+
+void trace_instant(trace_phase_t phase, pid_t track, const char *detail) {
+    if (!trace_enabled) {
+        return;
+    }
+    trace_event_t *e = new_event('i', phase, track ? track : shell_pid, detail);
+    if (e) {
+        e->ts = trace_now();
+    }
+}
+
+void trace_name_track(pid_t track, const char *name) {
+    // label a track, each pipeline stage gets its own
+    if (!trace_enabled) {
+        return;
+    }
+    new_event('M', 0, track, name);
+}
+
+static size_t json_escape(char *out, const char *s) {
+    // out needs room for 6 bytes per input byte
+    char *o = out;
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            *o++ = '\\';
+            *o++ = c;
+        } else if (c < 0x20) {
+            o += sprintf(o, "\\u%04x", c);
+        } else {
+            *o++ = c;
+        }
+    }
+    *o = '\0';
+    return o - out;
+}
+
+static void flush_events(void) {
+    char out[65536];
+    size_t len = 0;
+
+    for (int i = 0; i < nevents; i++) {
+        const trace_event_t *e = &events[i];
+        char detail[DETAIL_LEN * 6];
+        json_escape(detail, e->detail);
+
+        if (e->type == 'M') {
+            len += snprintf(out + len, sizeof(out) - len,
+                            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                            shell_pid, e->track, detail);
+        } else if (e->type == 'X') {
+            len += snprintf(out + len, sizeof(out) - len,
+                            "{\"name\":\"%s\",\"cat\":\"yash\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"cmd\":\"%s\"}},\n",
+                            phase_names[e->phase], e->ts / 1000.0, e->dur / 1000.0, shell_pid, e->track, detail);
+        } else {
+            len += snprintf(out + len, sizeof(out) - len,
+                            "{\"name\":\"%s\",\"cat\":\"yash\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"cmd\":\"%s\"}},\n",
+                            phase_names[e->phase], e->ts / 1000.0, shell_pid, e->track, detail);
+        }
+
+        if (len > sizeof(out) - 1024 || i == nevents - 1) {
+            if (write(trace_fd, out, len) < 0) {
+                break;
+            }
+            len = 0;
+        }
+    }
+    nevents = 0;
+}
+
+void trace_idle(int waiting) {
+    // write buffered events between commands, every time if the shell is about
+    // to wait anyway, otherwise only once the buffer is half full
+    if (!trace_enabled || nevents == 0) {
+        return;
+    }
+    if (waiting || nevents >= TRACE_EVENTS / 2) {
+        flush_events();
+    }
+}
+
+void trace_close(void) {
+    // flush and terminate the JSON array
+    if (trace_fd < 0) {
+        return;
+    }
+    flush_events();
+
+    char tail[128];
+    int len = snprintf(tail, sizeof(tail),
+                       "{\"name\":\"dropped_events\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"count\":%ld}}\n]\n",
+                       shell_pid, dropped);
+    ssize_t written = write(trace_fd, tail, len);
+    (void)written;  // nothing left to do about a failure here
+    close(trace_fd);
+    trace_fd = -1;
+    free(trace_file);
+    trace_file = NULL;
+    trace_enabled = 0;
+}
+
+const char *trace_path(void) {
+    // file being traced to, NULL when off
+    return trace_file;
+}
@@ -0,0 +1,39 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <sys/types.h>
+
+// opt-in per-command tracing in Chrome trace event JSON (chrome://tracing, Perfetto)
+// enabled by YASH_TRACE=FILE in the environment or 'set -o trace=FILE'
+// events go to a fixed buffer and are written out when the shell is idle
+
+typedef enum {
+    TRACE_PARSE,
+    TRACE_RESOLVE,
+    TRACE_REDIRECT,     // opening redirection targets in the shell
+    TRACE_SPAWN,        // fork/posix_spawn in the shell
+    TRACE_CHILD_SETUP,  // pgid, signals and dup2s in the child (fork path)
+    TRACE_EXEC,         // until the new program is running
+    TRACE_RUN,          // the child itself, start to reap
+    TRACE_STOP,
+    TRACE_CONTINUE,
+    TRACE_REAP,
+    TRACE_NPHASES
+} trace_phase_t;
+
+extern int trace_enabled;
+
+// cheap timestamp for call sites, 0 when tracing is off
+#define TRACE_START() (trace_enabled ? trace_now() : 0)
+
+void trace_init(void);
+int trace_open(const char *path);
+void trace_close(void);
+const char *trace_path(void);
+long long trace_now(void);
+void trace_complete(trace_phase_t phase, long long start, long long end, pid_t track, const char *detail);
+void trace_instant(trace_phase_t phase, pid_t track, const char *detail);
+void trace_name_track(pid_t track, const char *name);
+void trace_idle(int waiting);
+
+#endif
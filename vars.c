@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "vars.h"
+
+extern char **environ;
+
+// one variable, its NAME=value string is what goes into envp as is
+typedef struct {
+    char *entry;        // "NAME=value", or "NAME=" while unset
+    size_t entry_cap;   // a new value that fits is written over the old one
+    size_t name_len;
+    uint64_t hash;
+    int set;            // has a value, 'export NAME' alone marks a name that has none
+    int exported;
+    int env_index;      // its slot in envp, -1 if not there
+} var_t;
+
+// open addressing by name hash, linear probing, deletions shift the run back
+static var_t **slots = NULL;
+static size_t cap = 0;      // power of two
+static size_t count = 0;
+static int bits = 0;
+
+// exported variables that have a value, NULL terminated
+static char **envp = NULL;
+static size_t envp_len = 0;
+static size_t envp_cap = 0;
+static int envp_dirty = 1;  // the set of exported variables changed, rebuild before use
+
+int shell_status = 0;
+pid_t shell_pid = 0;
+pid_t shell_last_bg = 0;
+const char *shell_name = "yash";
+static char *no_args[] = { NULL };
+char **shell_args = no_args;
+int shell_nargs = 0;
+
+static uint64_t hash_name(const char *name, size_t len) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static size_t home_slot(uint64_t hash) {
+    // fibonacci hashing, the top bits are the well mixed ones
+    return (size_t)((hash * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+static size_t find_slot(const char *name, size_t len, uint64_t hash) {
+    // the slot holding name, or the empty slot where it would go
+    size_t i = home_slot(hash);
+    while (slots[i] && (slots[i]->hash != hash || slots[i]->name_len != len ||
+                        memcmp(slots[i]->entry, name, len) != 0)) {
+        i = (i + 1) & (cap - 1);
+    }
+    return i;
+}
+
+static var_t *lookup(const char *name, size_t len) {
+    if (!cap) {
+        return NULL;
+    }
+    return slots[find_slot(name, len, hash_name(name, len))];
+}
+
+static int grow(void) {
+    int new_bits = cap ? bits + 1 : 8;
+    size_t new_cap = (size_t)1 << new_bits;
+    var_t **bigger = calloc(new_cap, sizeof(var_t *));
+    if (!bigger) {
+        return -1;
+    }
+    var_t **old = slots;
+    size_t old_cap = cap;
+    slots = bigger;
+    cap = new_cap;
+    bits = new_bits;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i]) {
+            slots[find_slot(old[i]->entry, old[i]->name_len, old[i]->hash)] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static void remove_slot(size_t i) {
+    // shift later members of the probe run back into the hole
+    size_t hole = i;
+    for (size_t j = (i + 1) & (cap - 1); slots[j]; j = (j + 1) & (cap - 1)) {
+        size_t home = home_slot(slots[j]->hash);
+        // move j if its home slot isn't cyclically within (hole, j]
+        if ((j > hole && (home <= hole || home > j)) || (j < hole && home <= hole && home > j)) {
+            slots[hole] = slots[j];
+            hole = j;
+        }
+    }
+    slots[hole] = NULL;
+    count--;
+}
+
+static int in_env(const var_t *v) {
+    return v->set && v->exported;
+}
+
+static var_t *put(const char *name, size_t len, const char *value, int export) {
+    // set name to value (NULL leaves the value alone), export 1 exports it,
+    // 0 stops exporting it, -1 keeps whatever it was
+    // an exported variable whose value changes is patched into envp in place
+    if ((count + 1) * 2 > cap && grow() < 0) {
+        return NULL;
+    }
+    uint64_t hash = hash_name(name, len);
+    size_t i = find_slot(name, len, hash);
+    var_t *v = slots[i];
+    int was_in_env = v && in_env(v);
+    if (!v) {
+        v = calloc(1, sizeof(var_t));
+        if (!v || !(v->entry = malloc(len + 2))) {
+            free(v);
+            return NULL;
+        }
+        memcpy(v->entry, name, len);
+        memcpy(v->entry + len, "=", 2);
+        v->entry_cap = len + 2;
+        v->name_len = len;
+        v->hash = hash;
+        v->env_index = -1;
+        slots[i] = v;
+        count++;
+    }
+
+    if (value) {
+        // a loop variable takes a new value every iteration, reuse its entry when it fits
+        size_t value_len = strlen(value);
+        if (len + value_len + 2 > v->entry_cap) {
+            size_t entry_cap = len + value_len + 2 < 32 ? 32 : len + value_len + 2;
+            char *entry = malloc(entry_cap);
+            if (!entry) {
+                return NULL;
+            }
+            memcpy(entry, name, len);
+            entry[len] = '=';
+            memcpy(entry + len + 1, value, value_len + 1);
+            if (v->env_index >= 0 && !envp_dirty) {
+                envp[v->env_index] = entry;
+            }
+            free(v->entry);
+            v->entry = entry;
+            v->entry_cap = entry_cap;
+        } else {
+            memmove(v->entry + len + 1, value, value_len + 1);
+        }
+        v->set = 1;
+    }
+    if (export >= 0) {
+        v->exported = export;
+    }
+    if (in_env(v) != was_in_env) {
+        envp_dirty = 1;
+    }
+    return v;
+}
+
+static void del(const char *name, size_t len) {
+    if (!cap) {
+        return;
+    }
+    size_t i = find_slot(name, len, hash_name(name, len));
+    var_t *v = slots[i];
+    if (!v) {
+        return;
+    }
+    if (in_env(v)) {
+        envp_dirty = 1;
+    }
+    remove_slot(i);
+    free(v->entry);
+    free(v);
+}
+
+static int sync_env(void) {
+    // rebuild envp if a variable was exported or unset since the last time
+    if (!envp_dirty) {
+        return 0;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < cap; i++) {
+        n += slots[i] && in_env(slots[i]);
+    }
+    if (n + 1 > envp_cap) {
+        size_t new_cap = envp_cap ? envp_cap : 64;
+        while (new_cap < n + 1) {
+            new_cap *= 2;
+        }
+        char **grown = malloc(new_cap * sizeof(char *));
+        if (!grown) {
+            return -1;
+        }
+        // environ may still point at the old array, so it goes only after the switch
+        char **old = envp;
+        envp = grown;
+        envp_cap = new_cap;
+        environ = envp;
+        free(old);
+    }
+    envp_len = 0;
+    for (size_t i = 0; i < cap; i++) {
+        var_t *v = slots[i];
+        if (!v) {
+            continue;
+        }
+        if (in_env(v)) {
+            v->env_index = (int)envp_len;
+            envp[envp_len++] = v->entry;
+        } else {
+            v->env_index = -1;
+        }
+    }
+    envp[envp_len] = NULL;
+    environ = envp;
+    envp_dirty = 0;
+    return 0;
+}
+
+static int out_of_memory(const char *who) {
+    fprintf(stderr, "%s: out of memory\n", who);
+    return 1;
+}
+
+void vars_init(void) {
+    // every environment variable becomes an exported shell variable
+    shell_pid = getpid();
+    for (char **e = environ; *e; e++) {
+        size_t len = var_name_len(*e);
+        if (len && (*e)[len] == '=' && !put(*e, len, *e + len + 1, 1)) {
+            out_of_memory("yash");
+            break;
+        }
+    }
+    if (sync_env() < 0) {
+        out_of_memory("yash");
+    }
+}
+
+size_t var_name_len(const char *s) {
+    // length of the variable name s starts with, 0 if it doesn't start with one
+    if (!((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || *s == '_')) {
+        return 0;
+    }
+    size_t len = 1;
+    while ((s[len] >= 'a' && s[len] <= 'z') || (s[len] >= 'A' && s[len] <= 'Z') ||
+           (s[len] >= '0' && s[len] <= '9') || s[len] == '_') {
+        len++;
+    }
+    return len;
+}
+
+const char *var_getn(const char *name, size_t len) {
+    // value of the first len bytes of name, NULL if unset
+    var_t *v = lookup(name, len);
+    return (v && v->set) ? v->entry + len + 1 : NULL;
+}
+
+const char *var_get(const char *name) {
+    return var_getn(name, strlen(name));
+}
+
+int var_set(const char *name, const char *value) {
+    // an exported variable stays exported
+    if (!put(name, strlen(name), value, -1) || sync_env() < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int vars_assign(char *const *assigns, int n) {
+    // NAME=value words, checked by the parser
+    for (int i = 0; i < n; i++) {
+        size_t len = var_name_len(assigns[i]);
+        if (!put(assigns[i], len, assigns[i] + len + 1, -1)) {
+            out_of_memory("yash");
+            return -1;
+        }
+    }
+    return sync_env() < 0 ? -1 : 0;
+}
+
+int vars_push(char *const *assigns, int n, vars_saved_t *saved) {
+    // exported for the duration of a builtin, vars_pop puts the old values back
+    saved->n = 0;
+    saved->entries = NULL;
+    saved->state = NULL;
+    if (n == 0) {
+        return 0;
+    }
+    saved->entries = malloc(n * sizeof(char *));
+    saved->state = malloc(n);
+    if (!saved->entries || !saved->state) {
+        free(saved->entries);
+        free(saved->state);
+        out_of_memory("yash");
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        size_t len = var_name_len(assigns[i]);
+        var_t *v = lookup(assigns[i], len);
+        // an unknown name is saved as "NAME=", its '=' is never read back
+        saved->entries[i] = v ? strdup(v->entry) : strndup(assigns[i], len + 1);
+        saved->state[i] = !v ? VAR_SAVED_NONE : (v->set ? VAR_SAVED_SET : VAR_SAVED_UNSET) | (v->exported ? VAR_SAVED_EXPORTED : 0);
+        if (!saved->entries[i] || !put(assigns[i], len, assigns[i] + len + 1, 1)) {
+            free(saved->entries[i]);
+            vars_pop(saved);
+            out_of_memory("yash");
+            return -1;
+        }
+        saved->n = i + 1;
+    }
+    return sync_env();
+}
+
+void vars_pop(vars_saved_t *saved) {
+    // in reverse, so a name assigned twice ends up as it started
+    for (int i = saved->n - 1; i >= 0; i--) {
+        char *old = saved->entries[i];
+        size_t len = var_name_len(old);
+        int state = saved->state[i];
+        if (state & VAR_SAVED_SET) {
+            // an exported value is patched back in place, no rebuild
+            put(old, len, old + len + 1, (state & VAR_SAVED_EXPORTED) != 0);
+        } else {
+            del(old, len);
+            if (state & VAR_SAVED_UNSET) {
+                put(old, len, NULL, (state & VAR_SAVED_EXPORTED) != 0);
+            }
+        }
+        free(old);
+    }
+    free(saved->entries);
+    free(saved->state);
+    saved->n = 0;
+    sync_env();
+}
+
+char **vars_envp_with(char *const *assigns, int n) {
+    // envp with NAME=value words added or replacing the exported value, for
+    // one command's prefix assignments; a malloc'd array of borrowed strings
+    if (sync_env() < 0) {
+        return NULL;
+    }
+    char **out = malloc((envp_len + n + 1) * sizeof(char *));
+    if (!out) {
+        return NULL;
+    }
+    memcpy(out, envp, envp_len * sizeof(char *));
+    size_t len = envp_len;
+    for (int i = 0; i < n; i++) {
+        size_t name_len = var_name_len(assigns[i]);
+        var_t *v = lookup(assigns[i], name_len);
+        if (v && v->env_index >= 0) {
+            out[v->env_index] = assigns[i];
+            continue;
+        }
+        // not exported yet, but maybe assigned twice
+        size_t j = envp_len;
+        while (j < len && strncmp(out[j], assigns[i], name_len + 1) != 0) {
+            j++;
+        }
+        out[j] = assigns[i];
+        len += (j == len);
+    }
+    out[len] = NULL;
+    return out;
+}
+
+static void print_quoted(const char *s) {
+    // single quotes, a ' inside becomes '\''
+    putchar('\'');
+    for (; *s; s++) {
+        if (*s == '\'') {
+            fputs("'\\''", stdout);
+        } else {
+            putchar(*s);
+        }
+    }
+    putchar('\'');
+}
+
+static int compare_vars(const void *a, const void *b) {
+    return strcmp((*(var_t *const *)a)->entry, (*(var_t *const *)b)->entry);
+}
+
+static int list_exported(void) {
+    // export -p, sorted, in a form the shell can read back
+    var_t **list = malloc((count + 1) * sizeof(var_t *));
+    if (!list) {
+        return out_of_memory("export");
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < cap; i++) {
+        if (slots[i] && slots[i]->exported) {
+            list[n++] = slots[i];
+        }
+    }
+    qsort(list, n, sizeof(var_t *), compare_vars);
+    for (size_t i = 0; i < n; i++) {
+        printf("export %.*s", (int)list[i]->name_len, list[i]->entry);
+        if (list[i]->set) {
+            putchar('=');
+            print_quoted(list[i]->entry + list[i]->name_len + 1);
+        }
+        putchar('\n');
+    }
+    free(list);
+    return 0;
+}
+
+int run_export(char **args) {
+    // export [-p] [NAME[=value]...]
+    int i = 1;
+    if (args[i] && strcmp(args[i], "-p") == 0) {
+        i++;
+    }
+    if (!args[i]) {
+        return list_exported();
+    }
+    int status = 0;
+    for (; args[i]; i++) {
+        size_t len = var_name_len(args[i]);
+        if (!len || (args[i][len] != '=' && args[i][len] != '\0')) {
+            fprintf(stderr, "export: %s: not a valid name\n", args[i]);
+            status = 1;
+            continue;
+        }
+        const char *value = args[i][len] == '=' ? args[i] + len + 1 : NULL;
+        if (!put(args[i], len, value, 1)) {
+            return out_of_memory("export");
+        }
+    }
+    if (sync_env() < 0) {
+        return out_of_memory("export");
+    }
+    return status;
+}
+
+int run_unset(char **args) {
+    // unset [-v] NAME...
+    int i = 1;
+    if (args[i] && strcmp(args[i], "-v") == 0) {
+        i++;
+    }
+    int status = 0;
+    for (; args[i]; i++) {
+        size_t len = var_name_len(args[i]);
+        if (!len || args[i][len] != '\0') {
+            fprintf(stderr, "unset: %s: not a valid name\n", args[i]);
+            status = 1;
+            continue;
+        }
+        del(args[i], len);
+    }
+    if (sync_env() < 0) {
+        return out_of_memory("unset");
+    }
+    return status;
+}
+
+int run_shift(char **args) {
+    // shift [N], $N+1 becomes $1
+    int n = args[1] ? atoi(args[1]) : 1;
+    if (n < 0 || n > shell_nargs) {
+        fprintf(stderr, "shift: %s: shift count out of range\n", args[1] ? args[1] : "1");
+        return 1;
+    }
+    shell_args += n;
+    shell_nargs -= n;
+    return 0;
+}
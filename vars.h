@@ -0,0 +1,51 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// shell variables
+//   NAME=value [NAME=value...]         set in the shell
+//   NAME=value cmd                     in cmd's environment only
+//   export [-p] [NAME[=value]...]      pass to children, bare 'export' lists them
+//   unset [-v] NAME...
+//   shift [N]                          drop positional parameters
+//   $NAME, ${NAME}, $?, $$, $! and the positional $0, $1..., ${10}..., $#, $@, $*
+//   are expanded at run time (expand.c)
+// the exported ones are kept as a ready envp, patched in place when a value
+// changes and only rebuilt when a variable is exported or unset; environ points
+// at it so getenv and exec see the same thing
+
+extern int shell_status;    // $?, status of the last pipeline
+extern pid_t shell_pid;     // $$, the shell's pid even in a subshell
+extern pid_t shell_last_bg; // $!, the last stage of the last job started with '&'
+extern const char *shell_name;  // $0
+extern char **shell_args;   // $1..., the script's arguments or the running function's
+extern int shell_nargs;     // $#
+
+// what a builtin's prefix assignments replaced, for vars_pop
+#define VAR_SAVED_NONE      0   // no such variable
+#define VAR_SAVED_SET       1   // had a value
+#define VAR_SAVED_UNSET     2   // exported but no value
+#define VAR_SAVED_EXPORTED  4
+
+typedef struct {
+    char **entries;     // old NAME=value
+    char *state;        // VAR_SAVED_* of each
+    int n;
+} vars_saved_t;
+
+void vars_init(void);
+size_t var_name_len(const char *s);
+const char *var_get(const char *name);
+const char *var_getn(const char *name, size_t len);
+int var_set(const char *name, const char *value);
+int vars_assign(char *const *assigns, int n);
+int vars_push(char *const *assigns, int n, vars_saved_t *saved);
+void vars_pop(vars_saved_t *saved);
+char **vars_envp_with(char *const *assigns, int n);
+int run_export(char **args);
+int run_unset(char **args);
+int run_shift(char **args);
+
+#endif
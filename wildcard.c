@@ -0,0 +1,577 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "wildcard.h"
+
+#define DENTS_BUF (256 * 1024)      // one getdents64 call returns thousands of names
+#define SORT_CUTOFF 16              // below this insertion sort beats partitioning
+
+// what getdents64 fills the buffer with
+struct linux_dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef enum {
+    OP_LIT,     // bytes that must be there
+    OP_ANY,     // ?
+    OP_STAR,    // *
+    OP_CLASS    // [...]
+} op_kind_t;
+
+typedef struct {
+    op_kind_t kind;
+    const char *lit;            // OP_LIT, into the component's text
+    size_t len;
+    unsigned char set[32];      // OP_CLASS, one bit per byte
+} op_t;
+
+// one path component of the pattern, compiled
+typedef struct {
+    char *text;         // literal bytes, escapes removed; the whole name if !magic
+    op_t *ops;
+    int nops;
+    int magic;          // has a wildcard
+    int globstar;       // is exactly '**'
+    int dot;            // starts with a literal '.', so it may match hidden names
+    size_t min_len;
+} component_t;
+
+// names saved while a directory is read, to descend into afterwards
+typedef struct {
+    char *buf;          // NUL terminated, back to back
+    size_t len;
+    size_t cap;
+} name_list_t;
+
+typedef struct {
+    arena_t *arena;
+    wildcard_t *out;
+    component_t *comps;
+    int ncomps;
+    int dir_only;       // the pattern ends in '/', only directories match and keep it
+    char *dents;        // getdents64 buffer, shared, nothing recurses while it's in use
+    char *path;         // directory being read as it appears in a match, "" or ends in '/'
+    size_t path_len;
+    size_t path_cap;
+    int failed;
+} walk_t;
+
+static void set_bit(unsigned char *set, int c) {
+    set[c >> 3] |= 1 << (c & 7);
+}
+
+static int has_bit(const unsigned char *set, unsigned char c) {
+    return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+static int named_class(const char *name, size_t len, unsigned char *set) {
+    // [:alpha:] and friends, bytes in the C locale, -1 if unknown
+    static const struct {
+        const char *name;
+        int (*fn)(int);
+    } classes[] = {
+        { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank }, { "cntrl", iscntrl },
+        { "digit", isdigit }, { "graph", isgraph }, { "lower", islower }, { "print", isprint },
+        { "punct", ispunct }, { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+    };
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) == len && strncmp(classes[i].name, name, len) == 0) {
+            for (int c = 0; c < 128; c++) {
+                if (classes[i].fn(c)) {
+                    set_bit(set, c);
+                }
+            }
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static size_t compile_class(const char *p, size_t n, op_t *op) {
+    // [...] at p, returns its length, 0 if it isn't closed (then '[' is literal)
+    size_t i = 1;
+    int negate = 0;
+    if (i < n && (p[i] == '!' || p[i] == '^')) {
+        negate = 1;
+        i++;
+    }
+    memset(op->set, 0, sizeof(op->set));
+    for (int first = 1; i < n; first = 0) {
+        if (p[i] == ']' && !first) {
+            if (negate) {
+                for (size_t k = 0; k < sizeof(op->set); k++) {
+                    op->set[k] = ~op->set[k];
+                }
+            }
+            op->kind = OP_CLASS;
+            return i + 1;
+        }
+        if (p[i] == '[' && i + 1 < n && p[i + 1] == ':') {
+            const char *close = memmem(p + i + 2, n - i - 2, ":]", 2);
+            if (close && named_class(p + i + 2, close - (p + i + 2), op->set) == 0) {
+                i = close + 2 - p;
+                continue;
+            }
+        }
+        unsigned char lo = p[i];
+        if (p[i] == '\\' && i + 1 < n) {
+            lo = p[++i];
+        }
+        i++;
+        unsigned char hi = lo;
+        if (i + 1 < n && p[i] == '-' && p[i + 1] != ']') {
+            i++;
+            hi = p[i];
+            if (p[i] == '\\' && i + 1 < n) {
+                hi = p[++i];
+            }
+            i++;
+        }
+        for (int c = lo; c <= hi; c++) {
+            set_bit(op->set, c);
+        }
+    }
+    return 0;
+}
+
+static int compile(const char *p, size_t n, component_t *c) {
+    // one component of the pattern, n bytes at p, into ops
+    memset(c, 0, sizeof(*c));
+    c->text = malloc(n + 1);
+    c->ops = malloc((n + 1) * sizeof(op_t));
+    if (!c->text || !c->ops) {
+        return -1;
+    }
+    c->globstar = (n == 2 && p[0] == '*' && p[1] == '*');
+    char *t = c->text;
+    size_t i = 0;
+    while (i < n) {
+        op_t *last = c->nops ? &c->ops[c->nops - 1] : NULL;
+        char ch = p[i];
+        if (ch == '*') {
+            if (!last || last->kind != OP_STAR) {
+                c->ops[c->nops++].kind = OP_STAR;
+            }
+            c->magic = 1;
+            i++;
+            continue;
+        }
+        if (ch == '?') {
+            c->ops[c->nops++].kind = OP_ANY;
+            c->magic = 1;
+            c->min_len++;
+            i++;
+            continue;
+        }
+        if (ch == '[') {
+            size_t len = compile_class(p + i, n - i, &c->ops[c->nops]);
+            if (len) {
+                c->nops++;
+                c->magic = 1;
+                c->min_len++;
+                i += len;
+                continue;
+            }
+        }
+        if (ch == '\\' && i + 1 < n) {
+            ch = p[++i];
+        }
+        i++;
+        // a literal byte, runs of them are one op
+        if (last && last->kind == OP_LIT) {
+            last->len++;
+        } else {
+            c->ops[c->nops].kind = OP_LIT;
+            c->ops[c->nops].lit = t;
+            c->ops[c->nops++].len = 1;
+        }
+        *t++ = ch;
+        c->min_len++;
+    }
+    *t = '\0';
+    c->dot = (c->nops && c->ops[0].kind == OP_LIT && c->ops[0].lit[0] == '.');
+    return 0;
+}
+
+static int match(const component_t *c, const char *name, size_t len) {
+    // one name against a compiled component
+    // the ops between two stars have a fixed length, so backtracking only
+    // ever has to move the last star
+    const op_t *ops = c->ops;
+    int nops = c->nops;
+    if (len < c->min_len || (name[0] == '.' && !c->dot)) {
+        return 0;
+    }
+    // a literal start or end rejects most names before the real match
+    if (ops[0].kind == OP_LIT && memcmp(name, ops[0].lit, ops[0].len) != 0) {
+        return 0;
+    }
+    if (ops[nops - 1].kind == OP_LIT &&
+        memcmp(name + len - ops[nops - 1].len, ops[nops - 1].lit, ops[nops - 1].len) != 0) {
+        return 0;
+    }
+
+    int i = 0, star = -1;
+    size_t p = 0, star_p = 0;
+    for (;;) {
+        if (i < nops) {
+            const op_t *op = &ops[i];
+            if (op->kind == OP_STAR) {
+                star = i++;
+                star_p = p;
+                if (i == nops) {
+                    return 1;   // a trailing star takes the rest
+                }
+                continue;
+            }
+            if (p < len) {
+                if (op->kind == OP_ANY || (op->kind == OP_CLASS && has_bit(op->set, name[p]))) {
+                    i++;
+                    p++;
+                    continue;
+                }
+                if (op->kind == OP_LIT && len - p >= op->len && memcmp(name + p, op->lit, op->len) == 0) {
+                    i++;
+                    p += op->len;
+                    continue;
+                }
+            }
+        } else if (p == len) {
+            return 1;
+        }
+
+        // mismatch, the last star takes one more byte
+        if (star < 0 || star_p >= len) {
+            return 0;
+        }
+        p = ++star_p;
+        i = star + 1;
+        if (ops[i].kind == OP_LIT) {
+            // straight to the next place the literal after the star occurs
+            const char *hit = memmem(name + p, len - p, ops[i].lit, ops[i].len);
+            if (!hit) {
+                return 0;
+            }
+            p = star_p = hit - name;
+        }
+    }
+}
+
+static int add_match(walk_t *w, const char *name, size_t len, int slash) {
+    // path + name (+ '/') into the arena and the result list
+    wildcard_t *out = w->out;
+    if (out->n == out->cap) {
+        size_t cap = out->cap ? out->cap * 2 : 64;
+        char **grown = realloc(out->paths, cap * sizeof(char *));
+        if (!grown) {
+            w->failed = 1;
+            return -1;
+        }
+        out->paths = grown;
+        out->cap = cap;
+    }
+    char *s = arena_alloc(w->arena, w->path_len + len + slash + 1);
+    if (!s) {
+        w->failed = 1;
+        return -1;
+    }
+    memcpy(s, w->path, w->path_len);
+    memcpy(s + w->path_len, name, len);
+    if (slash) {
+        s[w->path_len + len] = '/';
+    }
+    s[w->path_len + len + slash] = '\0';
+    out->paths[out->n++] = s;
+    return 0;
+}
+
+static int save_name(walk_t *w, name_list_t *names, const char *name, size_t len) {
+    if (names->len + len + 1 > names->cap) {
+        size_t cap = names->cap ? names->cap : 4096;
+        while (cap < names->len + len + 1) {
+            cap *= 2;
+        }
+        char *grown = realloc(names->buf, cap);
+        if (!grown) {
+            w->failed = 1;
+            return -1;
+        }
+        names->buf = grown;
+        names->cap = cap;
+    }
+    memcpy(names->buf + names->len, name, len + 1);
+    names->len += len + 1;
+    return 0;
+}
+
+static int is_dir(int dirfd, const char *name, unsigned char type, int follow) {
+    // d_type when the file system fills it in, otherwise a stat
+    if (type == DT_DIR) {
+        return 1;
+    }
+    if (type != DT_UNKNOWN && !(type == DT_LNK && follow)) {
+        return 0;
+    }
+    struct stat st;
+    return fstatat(dirfd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void walk(walk_t *w, int dirfd, int k);
+
+static void descend(walk_t *w, int dirfd, const char *name, size_t len, int k) {
+    // into subdirectory name to match component k there
+    int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return;     // not a directory, or not ours to read, like any other non-match
+    }
+    size_t saved = w->path_len;
+    if (w->path_len + len + 2 > w->path_cap) {
+        size_t cap = w->path_cap * 2;
+        while (cap < w->path_len + len + 2) {
+            cap *= 2;
+        }
+        char *grown = realloc(w->path, cap);
+        if (!grown) {
+            w->failed = 1;
+            close(fd);
+            return;
+        }
+        w->path = grown;
+        w->path_cap = cap;
+    }
+    memcpy(w->path + w->path_len, name, len);
+    w->path_len += len;
+    w->path[w->path_len++] = '/';
+    walk(w, fd, k);
+    w->path_len = saved;
+    close(fd);
+}
+
+static void walk(walk_t *w, int dirfd, int k) {
+    // match components k.. against the directory dirfd, which is w->path
+    const component_t *c = &w->comps[k];
+    int last = (k == w->ncomps - 1);
+
+    if (!c->magic) {
+        // a plain name, no need to read the directory
+        size_t len = strlen(c->text);
+        if (!last) {
+            descend(w, dirfd, c->text, len, k + 1);
+        } else {
+            struct stat st;
+            if (fstatat(dirfd, c->text, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                (!w->dir_only || is_dir(dirfd, c->text, DT_UNKNOWN, 1))) {
+                add_match(w, c->text, len, w->dir_only);
+            }
+        }
+        return;
+    }
+
+    // '**' matches no directory at all as well as any depth of them
+    // '**/*.c' tests the names for '*.c' in the same pass, anything else
+    // after '**' gets a walk of its own first
+    const component_t *next = NULL;
+    if (c->globstar && !last) {
+        if (k + 1 == w->ncomps - 1 && w->comps[k + 1].magic && !w->comps[k + 1].globstar) {
+            next = &w->comps[k + 1];
+        } else {
+            walk(w, dirfd, k + 1);
+            lseek(dirfd, 0, SEEK_SET);
+        }
+    }
+
+    name_list_t subdirs = { 0 };
+    for (;;) {
+        long n = syscall(SYS_getdents64, dirfd, w->dents, DENTS_BUF);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        for (long pos = 0; pos < n && !w->failed; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(w->dents + pos);
+            pos += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) {
+                continue;
+            }
+            size_t len = strlen(name);
+
+            if (c->globstar) {
+                if (next && match(next, name, len) && (!w->dir_only || is_dir(dirfd, name, d->d_type, 1))) {
+                    add_match(w, name, len, w->dir_only);
+                }
+                // hidden names and symlinked directories are not descended into
+                if (name[0] == '.') {
+                    continue;
+                }
+                int dir = is_dir(dirfd, name, d->d_type, 0);
+                if (last && (dir || !w->dir_only)) {
+                    add_match(w, name, len, w->dir_only);
+                }
+                if (dir) {
+                    save_name(w, &subdirs, name, len);
+                }
+            } else if (match(c, name, len)) {
+                if (!last) {
+                    if (d->d_type == DT_DIR || d->d_type == DT_LNK || d->d_type == DT_UNKNOWN) {
+                        save_name(w, &subdirs, name, len);
+                    }
+                } else if (!w->dir_only || is_dir(dirfd, name, d->d_type, 1)) {
+                    add_match(w, name, len, w->dir_only);
+                }
+            }
+        }
+    }
+
+    // the buffer is free again, go down
+    for (size_t off = 0; off < subdirs.len && !w->failed; ) {
+        const char *name = subdirs.buf + off;
+        size_t len = strlen(name);
+        descend(w, dirfd, name, len, c->globstar ? k : k + 1);
+        off += len + 1;
+    }
+    free(subdirs.buf);
+}
+
+static void swap(char **a, size_t i, size_t j) {
+    char *t = a[i];
+    a[i] = a[j];
+    a[j] = t;
+}
+
+static void sort_paths(char **a, size_t n, size_t depth) {
+    // multikey quicksort: a three way partition on the byte at depth, only
+    // the equal part moves on to the next byte, so shared prefixes
+    // (the directory) are compared once per partition, not once per pair
+    while (n > 1) {
+        if (n < SORT_CUTOFF) {
+            for (size_t i = 1; i < n; i++) {
+                for (size_t j = i; j > 0 && strcmp(a[j - 1] + depth, a[j] + depth) > 0; j--) {
+                    swap(a, j, j - 1);
+                }
+            }
+            return;
+        }
+        swap(a, 0, n / 2);
+        unsigned char pivot = a[0][depth];
+        size_t lt = 1, i = 1, gt = n;   // [1,lt) less, [lt,i) equal, [gt,n) greater
+        while (i < gt) {
+            unsigned char ch = a[i][depth];
+            if (ch < pivot) {
+                swap(a, lt++, i++);
+            } else if (ch > pivot) {
+                swap(a, i, --gt);
+            } else {
+                i++;
+            }
+        }
+        // the pivot sits at 0, in the equal run it belongs to
+        swap(a, 0, --lt);
+        sort_paths(a, lt, depth);
+        sort_paths(a + gt, n - gt, depth);
+        if (pivot == '\0') {
+            return;     // the equal ones ended here, they are the same string
+        }
+        a += lt;
+        n = gt - lt;
+        depth++;
+    }
+}
+
+int wildcard_expand(arena_t *arena, const char *pattern, wildcard_t *out) {
+    // the matches of pattern in out, sorted, out->n is 0 if there is no
+    // wildcard in it or nothing matched; -1 if out of memory
+    out->n = 0;
+    int ncomps = 0, dir_only = 0, magic = 0;
+    for (const char *s = pattern; *s; s++) {
+        ncomps += (*s == '/');
+    }
+    component_t *comps = calloc(ncomps + 1, sizeof(component_t));
+    if (!comps) {
+        return -1;
+    }
+    int absolute = (pattern[0] == '/');
+    ncomps = 0;
+    int failed = 0;
+    for (const char *s = pattern; *s && !failed; ) {
+        const char *start = s;
+        while (*s && *s != '/') {
+            s += (*s == '\\' && s[1]) ? 2 : 1;
+        }
+        if (s > start) {
+            failed = compile(start, s - start, &comps[ncomps]) < 0;
+            magic |= comps[ncomps++].magic;
+        }
+        while (*s == '/') {
+            s++;
+            dir_only = !*s;
+        }
+    }
+
+    walk_t w = { .arena = arena, .out = out, .comps = comps, .ncomps = ncomps, .dir_only = dir_only };
+    if (!failed && magic) {
+        w.dents = malloc(DENTS_BUF);
+        w.path_cap = 256;
+        w.path = malloc(w.path_cap);
+        int dirfd = (w.dents && w.path) ? open(absolute ? "/" : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+        w.failed = !w.dents || !w.path;
+        if (dirfd >= 0) {
+            if (absolute) {
+                w.path[w.path_len++] = '/';
+            }
+            walk(&w, dirfd, 0);
+            close(dirfd);
+        }
+        free(w.dents);
+        free(w.path);
+        failed = w.failed;
+    }
+    for (int i = 0; i < ncomps; i++) {
+        free(comps[i].text);
+        free(comps[i].ops);
+    }
+    free(comps);
+    if (failed) {
+        out->n = 0;
+        return -1;
+    }
+    sort_paths(out->paths, out->n, 0);
+    return 0;
+}
+
+int wildcard_match(const char *pattern, const char *s) {
+    // whether all of s matches pattern, -1 if out of memory
+    if (!strpbrk(pattern, "*?[\\")) {
+        return strcmp(pattern, s) == 0;
+    }
+    component_t c;
+    int hit = -1;
+    if (compile(pattern, strlen(pattern), &c) == 0) {
+        c.dot = 1;
+        size_t len = strlen(s);
+        hit = c.nops ? match(&c, s, len) : len == 0;
+    }
+    free(c.text);
+    free(c.ops);
+    return hit;
+}
+
+void wildcard_free(wildcard_t *w) {
+    free(w->paths);
+    w->paths = NULL;
+    w->n = w->cap = 0;
+}
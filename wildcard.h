@@ -0,0 +1,26 @@
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#include <stddef.h>
+#include "arena.h"
+
+// pathname expansion: *, ?, [...] and ** (any number of directories)
+// each directory is read once with large getdents64 batches, names are
+// tested with a matcher compiled per path component, and the matches are
+// sorted with a multikey string quicksort
+// in a pattern a backslash makes the next character literal, that is how
+// expand.c passes on quoted characters
+// wildcard_match tests one string for case, where '/' and a leading '.' are
+// ordinary characters
+
+typedef struct {
+    char **paths;   // the matches, strings in the caller's arena, sorted bytewise
+    size_t n;
+    size_t cap;
+} wildcard_t;
+
+int wildcard_expand(arena_t *arena, const char *pattern, wildcard_t *out);
+void wildcard_free(wildcard_t *w);
+int wildcard_match(const char *pattern, const char *s);
+
+#endif
@@ -1,469 +1,893 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/wait.h>
-#include <fcntl.h>
-#include <signal.h>
-#include <errno.h>
-#include <sys/stat.h>
-#include "jobs.h"
-
-#define MAX_INPUT 2000
-#define MAX_ARGS  100
-
-void parse_left_redirection(char **args, char **in_file, char **out_file, char **err_file, int *pipe_index);
-
-void parse_right_redirection(char **args, int pipe_index, char **right_in, char **right_out, char **right_err);
-
-void setup_redirections(const char *in_file, const char *out_file, const char *err_file);
-
-void run_command(char **args, const char *in_file, const char *out_file, const char *err_file, int background, const char *original_cmdline);
-
-void run_pipe( char **args, int pipe_index,
-    const char *left_in, const char *left_out, const char *left_err,
-    const char *right_in, const char *right_out, const char *right_err
-);
-
-int parse_input(char *input, char **args, int *arg_count);
-
-static int check_background(char **args, char *original_cmdline);
-
-int main() {    
-
-    jobs_init();
-
-    // ignore SIGTTOU and SIGTTIN so not suspended for calling tcsetpgrp
-    signal(SIGTTOU, SIG_IGN);
-    signal(SIGTTIN, SIG_IGN);
-
-    shell_pgid = getpid();
-    setpgid(shell_pgid, shell_pgid);
-    tcsetpgrp(STDIN_FILENO, shell_pgid); // terminal control to the shell
-
-    signal(SIGCHLD, sigchld_handler);
-    signal(SIGTSTP, sigtstp_handler);
-
-    // ignore SIGINT in the shell so ctrl-c won't kill yash itself
-    signal(SIGINT, SIG_IGN); 
-
-    char input[MAX_INPUT];
-    char *args[MAX_ARGS];
-    int arg_count;
-
-    char og_cmdline[MAX_INPUT];
-
-    while (1) {
-        // prompt displayed immediately 
-        printf("# ");
-        fflush(stdout);
-
-        // read input
-        if (fgets(input, MAX_INPUT, stdin) == NULL) {
-            // on ctrl d EOF
-            printf("\n");
-            break;
-        }
-
-        // store original input for job control
-        strcpy(og_cmdline, input);
-
-        parse_input(input, args, &arg_count);
-
-        // continue if empty line
-        if (arg_count == 0) {
-            continue;
-        }
-
-        // check for job commands
-        if (strcmp(args[0], "jobs") == 0) {
-            run_jobs();
-            continue; 
-        }
-        if (strcmp(args[0], "fg") == 0) {
-            // parse if user typed fg with a number
-            int job_id = 0;
-            if (args[1]) {
-                job_id = atoi(args[1]);  // convert to integer
-            }
-            run_fg(job_id);
-            continue;
-        }
-        if (strcmp(args[0], "bg") == 0) {
-            int job_id = 0;
-            if (args[1]) {
-                job_id = atoi(args[1]);
-            }
-            run_bg(job_id);
-            continue;
-        }
-        
-
-        // parse for redirection and check if pipe
-        char *in_file, *out_file, *err_file;
-        int pipe_index;
-        parse_left_redirection(args, &in_file, &out_file, &err_file, &pipe_index);
-
-        // if found a pipe
-        if (pipe_index != -1) {
-            // check for right side of pipe redirections
-            char *right_in, *right_out, *right_err;
-            parse_right_redirection(args, pipe_index, &right_in, &right_out, &right_err);
-
-            run_pipe(args, pipe_index,
-                in_file, out_file, err_file,      // left side
-                right_in, right_out, right_err    // right side
-            );
-        } else {
-            // single command
-            int is_background = check_background(args, og_cmdline); // '&' + pipe not supported
-            run_command(args, in_file, out_file, err_file, is_background, og_cmdline);
-        }
-    }
-
-    return 0;
-}
-
-int parse_input(char *input, char **args, int *arg_count) {
-    *arg_count = 0;
-
-    // remove trailing newline
-    size_t len = strlen(input);
-    if (len > 0 && input[len-1] == '\n') {
-        input[len-1] = '\0';
-    }
-
-    char *saveptr;
-    char *token = strtok_r(input, " \t", &saveptr);
-
-    while (token && *arg_count < MAX_ARGS - 1) {
-        args[(*arg_count)++] = token;
-        token = strtok_r(NULL, " \t", &saveptr);    // delimit spaces + tabs
-    }
-    args[*arg_count] = NULL;    // null terminate for execvp
-    return *arg_count;
-}
-
-
-void parse_left_redirection(char **args, char **in_file, char **out_file, char **err_file, int *pipe_index) {
-    // "< file" , file replaces STDIN
-    // "> file" , file replaces STDOUT
-    //  "2> file" , file replaced STDERR
-    // only actual command arguments remain in args[], redirection details stored separately
-  
-    *in_file = NULL;
-    *out_file = NULL;
-    *err_file = NULL;
-    *pipe_index = -1;   
-
-    for (int i = 0; args[i] != NULL; i++) {
-        if (strcmp(args[i], "|") == 0) {
-            *pipe_index = i;    // store location of pipe if found
-            break;
-        }
-        else if (strcmp(args[i], "<") == 0) {
-            if (args[i+1]) {
-                *in_file = args[i+1];      // store input file
-                args[i] = NULL;            // remove symbol
-                args[i+1] = NULL;          // remove filename
-                i++;                       // skip filename in next iteration
-            }
-        }
-        else if (strcmp(args[i], ">") == 0) {
-            if (args[i+1]) {
-                *out_file = args[i+1];
-                args[i] = NULL;
-                args[i+1] = NULL;
-                i++;
-            }
-        }
-        else if (strcmp(args[i], "2>") == 0) {
-            if (args[i+1]) {
-                *err_file = args[i+1];
-                args[i] = NULL;
-                args[i+1] = NULL;
-                i++;
-            }
-        }
-    }
-
-    // compact args to remove all the null values left by removing redirection symbols 
-    // keep the last null
-    int j = 0;
-    for (int i = 0; i < MAX_ARGS && args[i] != NULL; i++) {
-        args[j++] = args[i];
-    }
-    // fill remainder w null
-    while (j < MAX_ARGS) {
-        args[j++] = NULL;
-    }
-}
-
-void parse_right_redirection(char **args, int pipe_index,
-                             char **right_in, char **right_out, char **right_err)
-{
-    *right_in = NULL;
-    *right_out = NULL;
-    *right_err = NULL;
-
-    // remove any <, >, 2> from the portion after the pipe
-    for (int i = pipe_index + 1; args[i] != NULL; i++) {
-        if (strcmp(args[i], "<") == 0 && args[i+1]) {
-            *right_in = args[i+1];
-            args[i] = NULL;
-            args[i+1] = NULL;
-            i++;
-        }
-        else if (strcmp(args[i], ">") == 0 && args[i+1]) {
-            *right_out = args[i+1];
-            args[i] = NULL;
-            args[i+1] = NULL;
-            i++;
-        }
-        else if (strcmp(args[i], "2>") == 0 && args[i+1]) {
-            *right_err = args[i+1];
-            args[i] = NULL;
-            args[i+1] = NULL;
-            i++;
-        }
-    }
-
-    // compact ONLY the portion after pipe_index+1
-    // so no overwrite the left side's tokens
-    int j = pipe_index + 1; 
-    for (int i = pipe_index + 1; i < MAX_ARGS && args[i] != NULL; i++) {
-        args[j++] = args[i];
-    }
-    while (j < MAX_ARGS) {
-        args[j++] = NULL;
-    }
-}
-
-
-
-
-void setup_redirections(const char *in_file, const char *out_file, const char *err_file){
-    // configure input/output/error redirection in child process before executing a command
-
-    // checks if input redirection is applied
-    if (in_file) {
-        int fd_in = open(in_file, O_RDONLY);    // open in read only mode
-
-        if (fd_in < 0) {    // unable to open
-            fprintf(stderr, "Error: cannot open input file '%s'\n", in_file);
-            _exit(1);   // prevent running incomplete command
-        }
-        dup2(fd_in, STDIN_FILENO);  // redirect STDIN to input file
-        close(fd_in);
-    }
-
-    // checks if output redirection is applied
-    if (out_file) {
-        int fd_out = open(out_file, O_WRONLY | O_CREAT | O_TRUNC,
-                          S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH); 
-        if (fd_out < 0) {
-            fprintf(stderr, "Error: cannot open output file '%s'\n", out_file);
-            _exit(1);  
-        }
-        dup2(fd_out, STDOUT_FILENO); 
-        close(fd_out);
-    }
-    
-    // checks if error redirection is applied
-    if (err_file) {
-        int fd_err = open(err_file, O_WRONLY | O_CREAT | O_TRUNC,
-                          S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
-        if (fd_err < 0) {
-            fprintf(stderr, "Error: cannot open error file '%s'\n", err_file);
-            _exit(1);
-        }
-        dup2(fd_err, STDERR_FILENO);
-        close(fd_err);
-    }
-}
-
-void run_command(char **args, const char *in_file, const char *out_file, const char *err_file, int background, const char *original_cmdline){
-    pid_t pid = fork();
-
-    if (pid < 0) {
-        perror("fork");
-        return;
-    }
-    else if (pid == 0) {
-        // child
-
-        setpgid(0,0);
-
-        signal(SIGINT, SIG_DFL); // let child be interrupted
-        signal(SIGTSTP, SIG_DFL);  // allow ctrl z
-
-        setup_redirections(in_file, out_file, err_file);
-
-        execvp(args[0], args);
-        // fprintf(stderr, "Command not found: %s\n", args[0]);    // execvp returns if unsuccessful 
-        _exit(127); // bash error code 127
-    }
-    else {
-        // parent
-
-        // set child's pgid
-        setpgid(pid, pid);
-
-        // add job to the table as running
-        int idx = add_job(pid, original_cmdline, RUNNING);
-
-        if(!background){
-            // in foreground
-
-            // give child terminal control
-            tcsetpgrp(STDIN_FILENO, pid);
-
-            // wait for child to finsih/stop
-            int status;
-            waitpid(pid, &status, WUNTRACED); // blocking wait
-
-            // after finishes/stops, restore terminal to shell
-            tcsetpgrp(STDIN_FILENO, shell_pgid);
-
-            // if child is stopped, store the job as stopped
-            if (WIFSTOPPED(status)) {
-                jobs[idx].state = STOPPED;
-            } else {
-                // exited or killed
-                remove_job(idx);
-            }
-        } else {
-            // background job
-            jobs[idx].is_bg = 1;
-        }
-
-        
-    }
-}
-
-void run_pipe(char **args, int pipe_index,
-    const char *left_in, const char *left_out, const char *left_err,
-    const char *right_in, const char *right_out, const char *right_err
-) {
-    // build left_args
-    char *left_args[MAX_ARGS];
-    memset(left_args, 0, sizeof(left_args));    // init to 0
-
-    int i;
-    for (i = 0; i < pipe_index; i++) {
-        left_args[i] = args[i];
-    }
-    left_args[i] = NULL;    // null terminate for execvp
-
-    // build right_args
-    char *right_args[MAX_ARGS];
-    memset(right_args, 0, sizeof(right_args));
-
-    int j = 0;
-    for (i = pipe_index + 1; args[i] != NULL; i++) {
-        right_args[j++] = args[i];
-    }
-    right_args[j] = NULL;
-
-    // create pipe
-    // pipefd[0] -> read end
-    // pipefd[1] -> write end
-    int pipefd[2];
-    if (pipe(pipefd) < 0) { // pipe failed
-        perror("pipe");
-        return;
-    }
-
-    pid_t pid_left = fork();
-    if (pid_left < 0) {
-        perror("fork");
-        return;
-    }
-    else if (pid_left == 0) {
-        // left child
-        signal(SIGINT, SIG_DFL); 
-
-        // if output redirection not specified, then connect pipe to stdout
-        if (!left_out) {
-            close(pipefd[0]);              // close read end
-            dup2(pipefd[1], STDOUT_FILENO); // redirect stdout to pipe write end
-            close(pipefd[1]);              // close write end after dup
-        } else {
-            // do not connect pipe to stdout
-            close(pipefd[0]);
-            close(pipefd[1]);
-        }
-
-        setup_redirections(left_in, left_out, left_err);
-
-        execvp(left_args[0], left_args);
-        fprintf(stderr, "Command not found: %s\n", left_args[0]);   // execvp failed
-        _exit(127);
-    }
-
-    pid_t pid_right = fork();
-    if (pid_right < 0) {
-        perror("fork");
-        return;
-    }
-    else if (pid_right == 0) {
-        // right child
-        signal(SIGINT, SIG_DFL);
-
-        // if input redirection not specified, connect pipe to stdin
-        if (!right_in) {
-            close(pipefd[1]);   // close write end
-            dup2(pipefd[0], STDIN_FILENO);  // redirect stdin to pipe write end
-            close(pipefd[0]);   // close read end after dup
-        } else {
-            // do not connect pipe to stdin
-            close(pipefd[0]);
-            close(pipefd[1]);
-        }
-
-        setup_redirections(right_in, right_out, right_err);
-
-        execvp(right_args[0], right_args);
-        fprintf(stderr, "Command not found: %s\n", right_args[0]);  // execvp failed
-        _exit(127);
-    }
-
-    // parent
-    close(pipefd[0]);
-    close(pipefd[1]);
-
-    // blocking wait for both children
-    waitpid(pid_left, NULL, 0);
-    waitpid(pid_right, NULL, 0);
-}
-
-
-static int check_background(char **args, char *original_cmdline) {
-    // check if last token is '&'
-    int i = 0;
-    while (args[i] != NULL) i++;
-    if (i > 0 && strcmp(args[i - 1], "&") == 0) {
-        args[i - 1] = NULL;  // remove '&'
-    } else {
-        return 0; // not background
-    }
-
-    // also want to remove '&' from the end of original commandline
-    // look from the end and remove
-    char *amp = strrchr(original_cmdline, '&');
-    if (amp) {
-        *amp = '\0'; // cut off the &
-        // remove trailing spaces or tabs
-        int end = strlen(original_cmdline) - 1;
-        while (end >= 0 && (original_cmdline[end] == ' ' || original_cmdline[end] == '\t')) {
-            original_cmdline[end] = '\0';
-            end--;
-        }
-    }
-
-    return 1; // background
-}
-
-
-
-
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "jobs.h"
+#include "spawn.h"
+#include "cmdhash.h"
+#include "events.h"
+#include "input.h"
+#include "arena.h"
+#include "parse.h"
+#include "builtins.h"
+#include "trace.h"
+#include "stats.h"
+#include "history.h"
+#include "expand.h"
+#include "placement.h"
+#include "rlimits.h"
+#include "vars.h"
+#include "code.h"
+#include "server.h"
+#include "fdtable.h"
+
+// here-doc/here-string data up to this size goes through a pipe (its default capacity)
+#define HERE_PIPE_MAX 65536
+
+int open_redirections(const command_t *cmd, int *fds);
+
+void close_redirections(int *fds, int n);
+
+pid_t run_command(const command_t *cmd, pid_t pgid, int fd_in, int fd_out, int background, const sigset_t *child_mask,
+                  const placement_t *placement, const rlimits_t *limits, int *failed_status);
+
+int run_pipeline(const pipeline_t *pl, struct rusage *usage);
+
+static int run_builtin(const command_t *cmd, builtin_fn_t fn);
+
+static int continued_line(char **line);
+
+// a terminal gets "> " for the lines a compound command or a here-doc goes on to
+static int continuation_prompt = 0;
+
+int main(int argc, char **argv) {
+
+    // yash              interactive if stdin is a terminal
+    // yash script [..]  run a script file
+    // yash -c 'cmds'    run a command string
+    // yash -i           force interactive
+    // yash --server SOCKET, yash --client SOCKET [-t] CMDS (server.h)
+    const char *script = NULL;
+    const char *command = NULL;
+    const char *server = NULL;
+    int force_interactive = 0;
+
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-' && argv[argi][1]; argi++) {
+        if (strcmp(argv[argi], "-c") == 0) {
+            if (argi + 1 >= argc) {
+                fprintf(stderr, "yash: -c: option requires an argument\n");
+                return 2;
+            }
+            command = argv[++argi];
+        } else if (strcmp(argv[argi], "-i") == 0) {
+            force_interactive = 1;
+        } else if (strcmp(argv[argi], "--server") == 0) {
+            if (argi + 1 >= argc) {
+                fprintf(stderr, "yash: --server: option requires an argument\n");
+                return 2;
+            }
+            server = argv[++argi];
+        } else if (strcmp(argv[argi], "--client") == 0) {
+            // nothing of the shell is needed to hand a line over
+            return client_main(argc - argi - 1, argv + argi + 1);
+        } else if (strcmp(argv[argi], "--") == 0) {
+            argi++;
+            break;
+        } else {
+            fprintf(stderr, "yash: %s: invalid option\n", argv[argi]);
+            return 2;
+        }
+    }
+    if (!command && argi < argc) {
+        script = argv[argi];
+    }
+    // $0 is the script, or the name after -c's command, and the rest are $1...
+    if (argi < argc) {
+        shell_name = argv[argi];
+        shell_args = argv + argi + 1;
+        shell_nargs = argc - argi - 1;
+    }
+
+    int interactive = !server && (force_interactive || (!command && !script && isatty(STDIN_FILENO)));
+
+    // what is open in 0-9 now is the script's, the shell's own fds go above
+    fdtable_init();
+
+    // the environment becomes the shell's exported variables, environ follows them from here on
+    vars_init();
+    jobs_init();
+
+    if (interactive) {
+        // ignore SIGTTOU and SIGTTIN so not suspended for calling tcsetpgrp
+        signal(SIGTTOU, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+
+        shell_pgid = getpid();
+        setpgid(shell_pgid, shell_pgid);
+        tcsetpgrp(STDIN_FILENO, shell_pgid); // terminal control to the shell
+        job_control = 1;
+    } else {
+        shell_pgid = getpgrp();
+    }
+
+    // after the process group is set, the spawn server joins it
+    spawn_init();
+
+    // SIGCHLD (and SIGTSTP/SIGINT when interactive) are read from a signalfd in
+    // the event loop, so ctrl-c won't kill yash itself and jobs only change state synchronously
+    if (events_init(interactive) < 0) {
+        return 1;
+    }
+
+    // YASH_TRACE=FILE, YASH_STATS=FILE
+    trace_init();
+    stats_init();
+
+    if (server) {
+        return server_run(server);
+    }
+
+    if (command) {
+        input_open_string(command);
+    } else if (script) {
+        if (input_open_file(script) < 0) {
+            fprintf(stderr, "yash: %s: %s\n", script, strerror(errno));
+            return 127;
+        }
+    } else {
+        input_init(STDIN_FILENO);
+    }
+
+    if (interactive) {
+        // shared history file, and the line editor on a capable terminal
+        history_init();
+        input_use_editor();
+        continuation_prompt = 1;
+    }
+
+    // every line's tree lives here until the next line
+    arena_t line_arena;
+    arena_init(&line_arena);
+
+    while (1) {
+        if (interactive) {
+            // prompt displayed immediately
+            input_prompt("# ");
+        }
+
+        // read input, children are reaped while waiting
+        char *input;
+        int got = input_getline(&input);
+        if (got == 0) {
+            // on ctrl d EOF
+            if (interactive) {
+                printf("\n");
+            }
+            break;
+        }
+        if (got < 0) {
+            // ctrl c at the prompt drops the line
+            printf("\n");
+            continue;
+        }
+
+        if (interactive) {
+            history_add(input);
+        }
+
+        arena_reset(&line_arena);
+        code_t *code;
+        function_def_t *defs;
+        long long t_parse = TRACE_START();
+        // a compound command or a here-doc reads on, input is not valid after this
+        char *label = trace_enabled ? strdup(input) : NULL;
+        int parsed = parse_line(&line_arena, input, continued_line, &code, &defs);
+        if (label) {
+            trace_complete(TRACE_PARSE, t_parse, trace_now(), 0, label);
+            free(label);
+        }
+        if (parsed < 0) {
+            shell_status = 2;
+            continue;
+        }
+
+        // PATH directories may have changed since the last line
+        cmdhash_expire();
+
+        if (code) {
+            code_run(code);
+        }
+        parse_release(defs);
+        if (code_exiting()) {
+            break;
+        }
+
+        // write out trace events between lines, not while commands start
+        trace_idle(0);
+    }
+
+    fflush(stdout);
+    trace_close();
+    stats_close();
+    return shell_status;
+}
+
+static int continued_line(char **line) {
+    if (continuation_prompt) {
+        input_prompt("> ");
+    }
+    return input_getline(line);
+}
+
+int run_string(const char *line) {
+    // a command substitution's text, in the forked child
+    // its lines are all there is, a here-doc's body is among them
+    arena_t arena;
+    arena_init(&arena);
+    code_t *code;
+    function_def_t *defs;
+    int status = 2;
+    if (parse_line(&arena, line, NULL, &code, &defs) == 0) {
+        status = code ? code_run(code) : 0;
+        parse_release(defs);
+    }
+    fflush(stdout);
+    arena_free(&arena);
+    return status;
+}
+
+static int run_nothing(char **args) {
+    // a command that expanded to no words, only its redirections happen
+    (void)args;
+    return 0;
+}
+
+static const char *command_name(const command_t *cmd) {
+    // for traces and messages, a compound command has no argv
+    if (cmd->body) {
+        return cmd->subshell ? "( )" : "{ }";
+    }
+    return cmd->argc ? cmd->argv[0] : "";
+}
+
+int execute_pipeline(arena_t *arena, const pipeline_t *pl, struct rusage *usage) {
+    // run one pipeline, returns its exit status
+    // usage gets what a foreground pipeline used
+    if (usage) {
+        memset(usage, 0, sizeof(*usage));
+    }
+
+    // command substitutions run now, in order, before anything is started
+    int status;
+    pl = expand_pipeline(arena, pl, &status);
+    if (!pl) {
+        return status;
+    }
+
+    // a lone foreground builtin runs in the shell, anywhere else it gets a child
+    // (so does one with 'cpus' or 'rlimit', the shell itself is never pinned or capped)
+    if (pl->ncmds == 1 && !pl->background && !pl->cpus && !pl->cmds[0].cpus && !pl->rlimit) {
+        const command_t *cmd = &pl->cmds[0];
+        if (cmd->body && !cmd->subshell) {
+            // a compound command's code runs in the shell, with its redirections
+            return run_builtin(cmd, NULL);
+        }
+        if (cmd->argc == 0 && !cmd->body) {
+            // only assignments (and redirections), they stay set in the shell
+            if (vars_assign(cmd->assigns, cmd->nassigns) < 0) {
+                return 1;
+            }
+            // the status is the last command substitution's, unless a redirection failed
+            int redirected = run_builtin(cmd, run_nothing);
+            return redirected ? redirected : status;
+        }
+        builtin_fn_t fn = cmd->argc ? find_builtin(cmd->argv[0]) : NULL;
+        if (fn) {
+            // NAME=value builtin sees the values only while it runs
+            vars_saved_t saved;
+            if (vars_push(cmd->assigns, cmd->nassigns, &saved) < 0) {
+                return 1;
+            }
+            status = run_builtin(cmd, fn);
+            vars_pop(&saved);
+            return status;
+        }
+    }
+
+    return run_pipeline(pl, usage);
+}
+
+static void print_time(const char *label, long sec, long usec) {
+    fprintf(stderr, "%s\t%ldm%ld.%03lds\n", label, sec / 60, sec % 60, usec / 1000);
+}
+
+int run_time(arena_t *arena, const pipeline_t *pl) {
+    // user runs 'time cmd ...'
+    // wall clock, plus user/sys of the pipeline's processes and of the shell itself
+    struct timespec start, end;
+    struct rusage self_start, self_end, children;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    getrusage(RUSAGE_SELF, &self_start);
+
+    int status = 0;
+    if (pl->ncmds > 0) {
+        status = execute_pipeline(arena, pl, &children);
+    } else {
+        memset(&children, 0, sizeof(children));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &self_end);
+
+    struct timeval real, user, sys;
+    real.tv_sec = end.tv_sec - start.tv_sec;
+    real.tv_usec = (end.tv_nsec - start.tv_nsec) / 1000;
+    if (real.tv_usec < 0) {
+        real.tv_sec--;
+        real.tv_usec += 1000000;
+    }
+    timersub(&self_end.ru_utime, &self_start.ru_utime, &user);
+    timeradd(&user, &children.ru_utime, &user);
+    timersub(&self_end.ru_stime, &self_start.ru_stime, &sys);
+    timeradd(&sys, &children.ru_stime, &sys);
+
+    fprintf(stderr, "\n");
+    print_time("real", real.tv_sec, real.tv_usec);
+    print_time("user", user.tv_sec, user.tv_usec);
+    print_time("sys", sys.tv_sec, sys.tv_usec);
+    return status;
+}
+
+static int open_here_data(const char *text, int newline) {
+    // a fd that reads back text (and a newline), all written by the shell up front so
+    // there is no writer process and no temp file: a pipe if it fits in the pipe's
+    // buffer, a sealed memfd otherwise
+    size_t len = strlen(text);
+    size_t total = len + (newline ? 1 : 0);
+    struct iovec iov[2] = { { (void *)text, len }, { "\n", newline ? 1 : 0 } };
+
+    if (total <= HERE_PIPE_MAX) {
+        int p[2];
+        if (pipe2(p, O_CLOEXEC | O_NONBLOCK) == 0) {
+            ssize_t n = total ? writev(p[1], iov, 2) : 0;
+            close(p[1]);
+            if (n == (ssize_t)total) {
+                fcntl(p[0], F_SETFL, 0);    // the reader blocks as on any pipe
+                return p[0];
+            }
+            close(p[0]);    // pipe buffer smaller than usual
+        }
+    }
+
+    int fd = memfd_create("yash-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        return -1;
+    }
+    if (writev(fd, iov, 2) != (ssize_t)total) {
+        close(fd);
+        errno = ENOSPC;
+        return -1;
+    }
+    // read-only from here on, whoever ends up holding it
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+static int dup_source(const redir_t *r) {
+    // the M of N>&M, -1 for N>&-, -2 if the target is neither
+    if (strcmp(r->target, "-") == 0) {
+        return -1;
+    }
+    char *end;
+    long m = strtol(r->target, &end, 10);
+    return (end == r->target || *end || m < 0 || m > INT_MAX) ? -2 : (int)m;
+}
+
+int open_redirections(const command_t *cmd, int *fds){
+    // open a command's redirection targets in the shell, close-on-exec, so errors are
+    // reported here and the child only has to dup2 them into place
+    // fds[i] is the fd opened for the i-th redirection, -1 for a dup or a close,
+    // which only happen where the redirections are applied
+    // a target opened at or below the highest fd the command names is moved up,
+    // so applying one redirection never lands on another's target
+    static const char *names[3] = { "input", "output", "error" };
+
+    int top = 0;
+    for (const redir_t *r = cmd->redirs; r; r = r->next) {
+        int src = r->kind == REDIR_DUP ? dup_source(r) : -1;
+        top = r->fd > top ? r->fd : top;
+        top = src > top ? src : top;
+    }
+
+    int i = 0;
+    for (const redir_t *r = cmd->redirs; r; r = r->next, i++) {
+        fds[i] = -1;
+        if (r->kind == REDIR_DUP) {
+            // M must be open in the script's fd table, unless an earlier redirection set it up
+            // or closed it; a pipe end or memfd the shell has in 0-9 doesn't count
+            int src = dup_source(r);
+            int earlier = 0;    // 1 opened, -1 closed by the last one before this
+            for (const redir_t *e = cmd->redirs; e != r; e = e->next) {
+                if (e->fd == src) {
+                    earlier = (e->kind == REDIR_DUP && dup_source(e) == -1) ? -1 : 1;
+                }
+            }
+            if (src == -2 || earlier < 0 ||
+                (src >= 0 && !earlier && (src > FD_SCRIPT_MAX || !(fd_script_mask & (1u << src))))) {
+                fprintf(stderr, "yash: %s: bad file descriptor\n", r->target);
+                close_redirections(fds, i);
+                return -1;
+            }
+            continue;
+        }
+        if (r->kind == REDIR_HEREDOC || r->kind == REDIR_HERESTRING) {
+            fds[i] = open_here_data(r->target, r->kind == REDIR_HERESTRING);
+            if (fds[i] < 0) {
+                perror("yash: here-document");
+                close_redirections(fds, i);
+                return -1;
+            }
+        } else if (r->kind == REDIR_IN) {
+            fds[i] = open(r->target, O_RDONLY | O_CLOEXEC);    // open in read only mode
+        } else {
+            fds[i] = open(r->target, O_WRONLY | O_CREAT | O_CLOEXEC | (r->kind == REDIR_APPEND ? O_APPEND : O_TRUNC),
+                          S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+        }
+        if (fds[i] < 0) {    // unable to open
+            if (r->fd <= 2) {
+                fprintf(stderr, "Error: cannot open %s file '%s'\n", names[r->fd], r->target);
+            } else {
+                fprintf(stderr, "Error: cannot open file '%s' for fd %d\n", r->target, r->fd);
+            }
+            close_redirections(fds, i);
+            return -1;  // prevent running incomplete command
+        }
+        if (fds[i] <= top) {
+            fds[i] = fd_shell(fds[i]);
+        }
+    }
+    return 0;
+}
+
+void close_redirections(int *fds, int n) {
+    for (int i = 0; i < n; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+}
+
+static int run_builtin(const command_t *cmd, builtin_fn_t fn) {
+    // run a builtin, or a compound command's code if fn is NULL, in the shell with
+    // its redirections applied to the shell's own fds, the originals are parked
+    // above 10 and put back afterwards, unless a lone 'exec' asked to keep them
+    // fds[i] is the opened target of redirection i, saved[i] the fd it replaced
+    int small[3 * 8];
+    int *fds = small;
+    if (cmd->nredirs > 8) {
+        fds = malloc(3 * cmd->nredirs * sizeof(int));
+        if (!fds) {
+            perror("malloc");
+            return 1;
+        }
+    }
+    int *saved = fds + cmd->nredirs;
+    int *targets = saved + cmd->nredirs;
+
+    long long t_redirect = TRACE_START();
+    int i = 0;
+    for (const redir_t *r = cmd->redirs; r; r = r->next) {
+        if (r->fd > FD_SCRIPT_MAX) {
+            // the shell's own fds live up there
+            fprintf(stderr, "yash: %d: bad file descriptor\n", r->fd);
+            i = -1;
+            break;
+        }
+    }
+    if (i < 0 || open_redirections(cmd, fds) < 0) {
+        if (fds != small) {
+            free(fds);
+        }
+        return 1;
+    }
+    if (trace_enabled && cmd->nredirs > 0) {
+        trace_complete(TRACE_REDIRECT, t_redirect, trace_now(), 0, command_name(cmd));
+    }
+
+    // whatever the shell buffered belongs to the old fds
+    fflush(stdout);
+
+    // in order, so 'cmd >out 2>&1' dups the new stdout
+    i = 0;
+    for (const redir_t *r = cmd->redirs; r; r = r->next, i++) {
+        int src = r->kind == REDIR_DUP ? dup_source(r) : fds[i];
+        targets[i] = r->fd;
+        saved[i] = fcntl(r->fd, F_DUPFD_CLOEXEC, FD_SHELL_MIN);   // -1 if r->fd wasn't open
+        if (src < 0) {
+            close(r->fd);
+            fd_script_closed(r->fd);
+        } else {
+            dup2(src, r->fd);
+            fd_script_opened(r->fd);
+        }
+    }
+
+    exec_keeps_redirections = 0;
+    int status = fn ? fn(cmd->argv) : code_run(cmd->body);
+    fflush(stdout);
+
+    if (exec_keeps_redirections) {
+        // 'exec 3>log': the script's fds stay as they are now
+        exec_keeps_redirections = 0;
+        for (i = 0; i < cmd->nredirs; i++) {
+            if (saved[i] >= 0) {
+                close(saved[i]);
+            }
+        }
+    } else {
+        // restore in reverse so a fd redirected twice ends up as it started
+        for (i = cmd->nredirs - 1; i >= 0; i--) {
+            if (saved[i] >= 0) {
+                dup2(saved[i], targets[i]);
+                close(saved[i]);
+                fd_script_opened(targets[i]);
+            } else {
+                close(targets[i]);
+                fd_script_closed(targets[i]);
+            }
+        }
+    }
+
+    close_redirections(fds, cmd->nredirs);
+    if (fds != small) {
+        free(fds);
+    }
+    return status;
+}
+
+// what run_body_child runs, set just before the fork
+static const code_t *child_body;
+
+static int run_body_child(char **args) {
+    // entry point in a forked child, for a compound command in a pipeline, in the
+    // background or in ( )
+    (void)args;
+    enter_subshell();
+    int status = code_run(child_body);
+    fflush(stdout);
+    return status;
+}
+
+static void trace_launch(pid_t pid, long long t_spawn, const spawn_timing_t *timing, const char *name) {
+    // spawn phases of one child, the fork path also shows the child's own setup and exec
+    if (timing->child_start) {
+        trace_complete(TRACE_SPAWN, t_spawn, timing->child_start, 0, name);
+        trace_complete(TRACE_CHILD_SETUP, timing->child_start, timing->setup_done, pid, name);
+        trace_complete(TRACE_EXEC, timing->setup_done, timing->exec_done, pid, name);
+    } else {
+        // posix_spawn returns after the exec, setup and exec are inside this one
+        trace_complete(TRACE_SPAWN, t_spawn, timing->exec_done, 0, name);
+    }
+}
+
+pid_t run_command(const command_t *cmd, pid_t pgid, int fd_in, int fd_out, int background, const sigset_t *child_mask,
+                  const placement_t *placement, const rlimits_t *limits, int *failed_status){
+    // launch one pipeline stage into process group pgid (0 starts a new group, -1 the shell's)
+    // fd_in/fd_out are pipe ends to use as stdin/stdout, -1 keeps the shell's
+    // placement, if set, pins the child and sets its memory policy, limits caps it
+    // on failure returns -1 and sets *failed_status to the exit status to report
+    int fds_small[8];
+    int *fds = fds_small;
+    if (cmd->nredirs > 8) {
+        fds = malloc(cmd->nredirs * sizeof(int));
+        if (!fds) {
+            perror("malloc");
+            *failed_status = 1;
+            return -1;
+        }
+    }
+    long long t_redirect = TRACE_START();
+    if (open_redirections(cmd, fds) < 0) {
+        if (fds != fds_small) {
+            free(fds);
+        }
+        *failed_status = 1;
+        return -1;
+    }
+    if (trace_enabled && cmd->nredirs > 0) {
+        trace_complete(TRACE_REDIRECT, t_redirect, trace_now(), 0, command_name(cmd));
+    }
+    if (cmd->argc == 0 && !cmd->body) {
+        // expanded to nothing, the redirections were all there was to do
+        close_redirections(fds, cmd->nredirs);
+        if (fds != fds_small) {
+            free(fds);
+        }
+        *failed_status = 0;
+        return -1;
+    }
+
+    spawn_req_t req;
+    spawn_req_init(&req, cmd->argv, pgid, !background, child_mask);
+    req.placement = placement;
+    req.limits = limits;
+    if (fd_in >= 0) {
+        spawn_add_dup(&req, fd_in, STDIN_FILENO);
+    }
+    if (fd_out >= 0) {
+        spawn_add_dup(&req, fd_out, STDOUT_FILENO);
+    }
+    // explicit redirections come after the pipe, so they override it
+    // a dup or close is done by the child in order: 'cmd 2>&1 | cat' sends stderr down the pipe
+    int i = 0;
+    for (const redir_t *r = cmd->redirs; r; r = r->next, i++) {
+        spawn_add_dup(&req, r->kind == REDIR_DUP ? dup_source(r) : fds[i], r->fd);
+    }
+
+    spawn_timing_t timing;
+    if (trace_enabled) {
+        req.timing = &timing;
+    }
+    long long t_spawn = 0;
+
+    // builtins run in the forked child, others exec straight from the remembered path
+    // prefix assignments are set around a builtin's fork, an exec gets them in its own envp
+    pid_t pid = -1;
+    int reported = 0;   // nothing to launch and the reason was already printed
+    if (cmd->body || find_builtin(cmd->argv[0])) {
+        req.builtin = cmd->body ? run_body_child : run_builtin_child;
+        child_body = cmd->body;
+        vars_saved_t saved;
+        if (vars_push(cmd->assigns, cmd->nassigns, &saved) < 0) {
+            reported = 1;
+            errno = ENOMEM;
+        } else {
+            t_spawn = trace_now();
+            pid = spawn_start(&req);
+            int err = errno;
+            vars_pop(&saved);
+            errno = err;
+        }
+    } else if (cmd->nassigns && !(req.envp = vars_envp_with(cmd->assigns, cmd->nassigns))) {
+        fprintf(stderr, "yash: %s: out of memory\n", cmd->argv[0]);
+        reported = 1;
+        errno = ENOMEM;
+    } else if (!spawn_args_fit(cmd->argv, req.envp)) {
+        reported = 1;
+        errno = E2BIG;
+    } else {
+        long long t_resolve = TRACE_START();
+        req.path = cmdhash_lookup(cmd->argv[0]);
+        if (trace_enabled) {
+            trace_complete(TRACE_RESOLVE, t_resolve, trace_now(), 0, cmd->argv[0]);
+        }
+    }
+    if (reported) {
+        // spawn_args_fit or the environment said why
+    } else if (!req.builtin && !req.path) {
+        errno = ENOENT;
+    } else if (!req.builtin) {
+        t_spawn = trace_now();
+        pid = spawn_start(&req);
+        if (pid < 0 && errno == ENOENT && req.path != cmd->argv[0]) {
+            // remembered binary went away, search once more
+            cmdhash_forget(cmd->argv[0]);
+            req.path = cmdhash_lookup(cmd->argv[0]);
+            if (req.path) {
+                t_spawn = trace_now();
+                pid = spawn_start(&req);
+            } else {
+                errno = ENOENT;
+            }
+        }
+    }
+    if (pid > 0) {
+        shell_stats.spawns++;
+        stats_latency(STATS_SPAWN, trace_now() - t_spawn);
+        if (trace_enabled) {
+            if (timing.child_start) {
+                stats_latency(STATS_EXEC, timing.exec_done - timing.setup_done);
+            }
+            trace_launch(pid, t_spawn, &timing, command_name(cmd));
+        }
+    }
+    if (pid < 0) {
+        stats_exec_failed(errno);
+        if (errno == ENOENT) {
+            fprintf(stderr, "Command not found: %s\n", cmd->argv[0]);
+            *failed_status = 127;
+        } else if (reported) {
+            *failed_status = 126;
+        } else {
+            fprintf(stderr, "yash: %s: %s\n", command_name(cmd), strerror(errno));
+            *failed_status = 126;
+        }
+    }
+    spawn_req_free(&req);
+    free((char **)req.envp);
+
+    // only close what was opened here, pipe ends belong to run_pipeline
+    close_redirections(fds, cmd->nredirs);
+    if (fds != fds_small) {
+        free(fds);
+    }
+    return pid;
+}
+
+static const char *stage_cpus(const pipeline_t *pl, int i) {
+    // a stage's own 'cpus' wins over the pipeline's
+    return pl->cmds[i].cpus ? pl->cmds[i].cpus : pl->cpus;
+}
+
+static placement_t *plan_placement(const pipeline_t *pl, int *failed) {
+    // placements for a pipeline with 'cpus' anywhere, NULL if it has none
+    // 'auto' stages are placed together, so neighbours end up on neighbouring cores
+    int any = 0, any_auto = 0;
+    for (int i = 0; i < pl->ncmds; i++) {
+        const char *spec = stage_cpus(pl, i);
+        any |= spec != NULL;
+        any_auto |= spec && strcmp(spec, "auto") == 0;
+    }
+    *failed = 0;
+    if (!any) {
+        return NULL;
+    }
+    placement_t *plan = malloc(pl->ncmds * sizeof(placement_t));
+    if (!plan) {
+        perror("malloc");
+        *failed = 1;
+        return NULL;
+    }
+    if (any_auto && placement_auto(pl->ncmds, plan) < 0) {
+        *failed = 1;
+    }
+    for (int i = 0; i < pl->ncmds && !*failed; i++) {
+        const char *spec = stage_cpus(pl, i);
+        if (spec && strcmp(spec, "auto") != 0 && placement_parse(spec, &plan[i]) < 0) {
+            *failed = 1;
+        }
+    }
+    if (*failed) {
+        free(plan);
+        return NULL;
+    }
+    return plan;
+}
+
+int run_pipeline(const pipeline_t *pl, struct rusage *usage) {
+    // returns the exit status of a foreground pipeline, 0 once a background one started
+    int nstages = pl->ncmds;
+    int background = pl->background;
+
+    // a bad 'rlimit' or 'cpus' list stops the pipeline before anything starts
+    rlimits_t limits;
+    if (pl->rlimit && rlimits_parse(pl->rlimit, &limits, "rlimit") < 0) {
+        return 2;
+    }
+    int failed;
+    placement_t *plan = plan_placement(pl, &failed);
+    if (failed) {
+        return 2;
+    }
+
+    // children write straight to the fds, anything the shell printed goes first
+    fflush(stdout);
+
+    if (background) {
+        // collect finished jobs before adding another, a script may never wait for them
+        events_poll();
+    }
+
+    // create every pipe up front so no stage waits on the shell between forks
+    // pipes[i] connects stage i to stage i+1
+    int (*pipes)[2] = NULL;
+    int npipes = 0;
+    if (nstages > 1) {
+        pipes = malloc((nstages - 1) * sizeof(*pipes));
+        if (!pipes) {
+            perror("malloc");
+            return 1;
+        }
+        for (; npipes < nstages - 1; npipes++) {
+            if (pipe2(pipes[npipes], O_CLOEXEC) < 0) { // pipe failed
+                perror("pipe");
+                break;
+            }
+        }
+    }
+
+    // children are only reaped from the event loop, so nothing can exit
+    // unnoticed before it is in the job table
+    job_t *job = NULL;
+    if (npipes == nstages - 1) {
+        // add job to the table as running, stages are attached as they launch
+        job = add_job(pl->text, RUNNING);
+        if (!job) {
+            perror("yash: add_job");
+        } else {
+            shell_stats.pipelines++;
+        }
+    }
+
+    // without job control everything stays in the shell's process group
+    // and a background job must not read the shell's input
+    int no_stdin = -1;
+    if (background && !job_control) {
+        no_stdin = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    int status = 1;
+    int launch_status = 0;  // why the last stage failed to start, if it did
+    for (int i = 0; job && i < nstages; i++) {
+        int fd_in = (i > 0) ? pipes[i-1][0] : no_stdin;
+        int fd_out = (i < nstages - 1) ? pipes[i][1] : -1;
+
+        // the first stage launched leads the process group
+        pid_t pgid = job_control ? job->pgid : -1;
+        const placement_t *placement = (plan && stage_cpus(pl, i)) ? &plan[i] : NULL;
+        pid_t pid = run_command(&pl->cmds[i], pgid, fd_in, fd_out, background || !job_control,
+                                events_child_mask(), placement, pl->rlimit ? &limits : NULL, &launch_status);
+        if (pid < 0) {
+            continue;   // the other stages still run and see EOF/EPIPE
+        }
+        launch_status = 0;
+        if (add_job_process(job, pid) == 0 && placement) {
+            process_t *proc = &job->procs[job->nprocs - 1];
+            placement_format(placement, proc->placement, sizeof(proc->placement));
+        }
+
+        if (trace_enabled) {
+            // one track per stage
+            char track[64];
+            snprintf(track, sizeof(track), "[%d] stage %d: %s", job->job_id, i + 1, command_name(&pl->cmds[i]));
+            trace_name_track(pid, track);
+        }
+    }
+    if (no_stdin >= 0) {
+        close(no_stdin);
+    }
+
+    // parent keeps no pipe ends
+    for (int i = 0; i < npipes; i++) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+    free(pipes);
+    free(plan);
+
+    if (job) {
+        if (job->nprocs == 0) {
+            remove_job(job);
+            status = launch_status;
+        } else {
+            watch_job(job);
+            if (!background) {
+                status = wait_fg_job(job, usage);
+            } else {
+                job->is_bg = 1;
+                shell_last_bg = job->procs[job->nprocs - 1].pid;
+                status = 0;
+            }
+            if (launch_status) {
+                status = launch_status;
+            }
+        }
+    }
+    return status;
+}
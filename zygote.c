@@ -0,0 +1,443 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include "zygote.h"
+#include "fdtable.h"
+
+extern char **environ;
+
+#define ZYGOTE_MAX_DUPS 64
+#define ZYGOTE_MAX_MSG (128 * 1024)     // fits a unix seqpacket at the default buffer size
+#define ZYGOTE_FD_BASE 64               // received fds are kept above anything a child dups onto
+
+// one request, followed in the same packet by path (if has_path), argv and envp
+// as NUL terminated strings
+// fds ride along with SCM_RIGHTS: cwd, the script's fds 0-9 that are open (fd_mask),
+// then one per dup the child can't do from its own fds (sources)
+typedef struct {
+    int32_t pgid;
+    int32_t foreground;
+    int32_t has_path;
+    int32_t argc;
+    int32_t envc;
+    int32_t fd_mask;
+    int32_t ndups;
+    int32_t targets[ZYGOTE_MAX_DUPS];
+    int32_t sources[ZYGOTE_MAX_DUPS];  // a fd of the child's, or one of these
+    sigset_t sigmask;
+} zygote_req_t;
+
+typedef struct {
+    int32_t pid;
+    int32_t err;            // errno of a failed exec, the pid is then a zombie of the shell's
+} zygote_reply_t;
+
+#define ZYGOTE_DUP_SENT -1     // the next received fd
+#define ZYGOTE_DUP_CLOSE -2
+
+#define ZYGOTE_MAX_FDS (1 + FD_SCRIPT_MAX + 1 + ZYGOTE_MAX_DUPS)
+
+static int zygote_fd = -1;
+static pid_t zygote_pid = -1;
+
+// signals the shell handles or ignores, children get them back at default
+static const int default_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE };
+
+#define NUM_DEFAULT_SIGNALS (int)(sizeof(default_signals) / sizeof(default_signals[0]))
+
+// what the cloned child needs, it shares our memory until it execs
+typedef struct {
+    const zygote_req_t *zr;
+    const int *fds;
+    const char *path;
+    char **argv;
+    char **envp;
+    int err;                // set by the child if the exec failed
+} zygote_child_t;
+
+#define ZYGOTE_STACK_SIZE (256 * 1024)
+
+static int zygote_child(void *arg) {
+    // the same setup as spawn_fork, only async-signal-safe calls from here
+    zygote_child_t *c = arg;
+    const zygote_req_t *zr = c->zr;
+    fchdir(c->fds[0]);
+    int k = 1;
+    for (int fd = 0; fd <= FD_SCRIPT_MAX; fd++) {
+        if (zr->fd_mask & (1 << fd)) {
+            dup2(c->fds[k++], fd);
+        } else {
+            close(fd);
+        }
+    }
+
+    if (zr->pgid >= 0) {
+        setpgid(0, zr->pgid);
+    }
+    // the shell's stdin is in place, take the terminal before exec
+    if (zr->foreground) {
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+    }
+
+    for (int i = 0; i < NUM_DEFAULT_SIGNALS; i++) {
+        signal(default_signals[i], SIG_DFL);
+    }
+    sigprocmask(SIG_SETMASK, &zr->sigmask, NULL);
+
+    for (int i = 0; i < zr->ndups; i++) {
+        if (zr->sources[i] == ZYGOTE_DUP_CLOSE) {
+            close(zr->targets[i]);
+        } else if (zr->sources[i] == ZYGOTE_DUP_SENT) {
+            dup2(c->fds[k++], zr->targets[i]);
+        } else if (zr->sources[i] != zr->targets[i]) {
+            dup2(zr->sources[i], zr->targets[i]);
+        }
+    }
+
+    if (c->path) {
+        execve(c->path, c->argv, c->envp);
+    } else {
+        execvpe(c->argv[0], c->argv, c->envp);
+    }
+    c->err = errno;
+    _exit(127);
+}
+
+static void launch(int sock, const zygote_req_t *zr, int *fds, int nfds, char *strings, size_t len) {
+    // clone one child for the request and report its pid, or why it failed to exec
+    static char *stack = NULL;
+    zygote_reply_t reply = { -1, 0 };
+    int expect = 1 + __builtin_popcount(zr->fd_mask);
+    for (int i = 0; i < zr->ndups && i < ZYGOTE_MAX_DUPS; i++) {
+        expect += zr->sources[i] == ZYGOTE_DUP_SENT;
+    }
+    char **argv = calloc(zr->argc + zr->envc + 2, sizeof(char *));
+    if (!stack) {
+        stack = malloc(ZYGOTE_STACK_SIZE);
+    }
+    if (nfds != expect || zr->argc < 1 || !argv || !stack) {
+        reply.err = nfds != expect ? EBADF : zr->argc < 1 ? EINVAL : ENOMEM;
+        free(argv);
+        send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
+        return;
+    }
+
+    zygote_child_t c = { zr, fds, NULL, argv, argv + zr->argc + 1, 0 };
+    char *p = strings, *end = strings + len;
+    if (zr->has_path) {
+        c.path = p;
+        p += strlen(p) + 1;
+    }
+    for (int i = 0; i < zr->argc + zr->envc && p < end; i++) {
+        argv[i < zr->argc ? i : i + 1] = p;     // envp starts past argv's NULL
+        p += strlen(p) + 1;
+    }
+
+    // CLONE_PARENT: the child belongs to the shell, not to us
+    // CLONE_VM|CLONE_VFORK: like posix_spawn, no page tables to copy and we
+    // resume once it has exec'd or given up
+    pid_t pid = clone(zygote_child, stack + ZYGOTE_STACK_SIZE,
+                      CLONE_PARENT | CLONE_VM | CLONE_VFORK | SIGCHLD, &c);
+    if (pid < 0) {
+        reply.err = errno;
+    } else {
+        reply.pid = pid;
+        reply.err = c.err;
+    }
+    free(argv);
+    send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
+}
+
+static void zygote_main(int sock) {
+    // the helper: one request in, one child out, until the shell goes away
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    prctl(PR_SET_NAME, "yash-zygote");
+    for (int i = 0; i < NUM_DEFAULT_SIGNALS; i++) {
+        if (default_signals[i] != SIGCHLD) {
+            signal(default_signals[i], SIG_IGN);     // ctrl-c at the prompt is for the shell
+        }
+    }
+
+    // don't hold the shell's terminal or pipes open, every request brings its own
+    int null_fd = open("/dev/null", O_RDWR);
+    for (int fd = 0; fd <= STDERR_FILENO && null_fd >= 0; fd++) {
+        dup2(null_fd, fd);
+    }
+    if (null_fd > STDERR_FILENO) {
+        close(null_fd);
+    }
+
+    char *buf = malloc(sizeof(zygote_req_t) + ZYGOTE_MAX_MSG);
+    if (!buf) {
+        _exit(1);
+    }
+    union {
+        struct cmsghdr hdr;
+        char space[CMSG_SPACE(ZYGOTE_MAX_FDS * sizeof(int))];
+    } control;
+
+    while (1) {
+        struct iovec iov = { buf, sizeof(zygote_req_t) + ZYGOTE_MAX_MSG };
+        struct msghdr msg = {
+            .msg_iov = &iov, .msg_iovlen = 1,
+            .msg_control = control.space, .msg_controllen = sizeof(control.space)
+        };
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            _exit(0);   // the shell exited
+        }
+
+        int fds[ZYGOTE_MAX_FDS];
+        int nfds = 0;
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i = 0; i < count && nfds < ZYGOTE_MAX_FDS; i++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+                // move it up out of the way of the child's dup2s
+                int high = fcntl(fd, F_DUPFD_CLOEXEC, ZYGOTE_FD_BASE);
+                if (high >= 0) {
+                    close(fd);
+                    fd = high;
+                }
+                fds[nfds++] = fd;
+            }
+        }
+
+        zygote_req_t zr;
+        if ((size_t)n < sizeof(zr) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+            zygote_reply_t reply = { -1, EMSGSIZE };
+            send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
+        } else {
+            memcpy(&zr, buf, sizeof(zr));
+            buf[n - 1] = '\0';
+            launch(sock, &zr, fds, nfds, buf + sizeof(zr), n - sizeof(zr));
+        }
+        for (int i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+    }
+}
+
+int zygote_start(void) {
+    // fork the helper, call early while the shell is still small
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        return -1;
+    }
+    int size = sizeof(zygote_req_t) + ZYGOTE_MAX_MSG + 4096;
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        // nothing else the shell had open is any use here
+        int sock = STDERR_FILENO + 1;
+        if (sv[1] != sock) {
+            dup3(sv[1], sock, O_CLOEXEC);
+            close(sv[1]);
+        }
+        close_range(sock + 1, ~0U, 0);
+        zygote_main(sock);
+    }
+    close(sv[1]);
+    zygote_fd = fd_shell(sv[0]);
+    zygote_pid = pid;
+    return 0;
+}
+
+int zygote_running(void) {
+    return zygote_fd >= 0;
+}
+
+int zygote_can_spawn(const spawn_req_t *req) {
+    // builtins need the shell's own memory, so they keep the fork path
+    return zygote_fd >= 0 && !req->builtin && req->ndups <= ZYGOTE_MAX_DUPS;
+}
+
+static void zygote_lost(void) {
+    // the helper died, the shell goes back to spawning directly
+    fprintf(stderr, "yash: spawn server exited, spawning directly\n");
+    close(zygote_fd);
+    zygote_fd = -1;     // reaped with the jobs, wait4(-1) sees it too
+}
+
+pid_t zygote_spawn(const spawn_req_t *req) {
+    // launch through the helper, returns the pid or -1 with errno set
+    // EMSGSIZE/EPIPE mean the caller should spawn directly
+    static char *buf = NULL;
+    static size_t cap = 0;
+
+    zygote_req_t zr;
+    memset(&zr, 0, sizeof(zr));
+    zr.pgid = req->pgid;
+    zr.foreground = req->foreground;
+    zr.has_path = req->path != NULL;
+    zr.ndups = req->ndups;
+    if (req->sigmask) {
+        zr.sigmask = *req->sigmask;
+    } else {
+        sigemptyset(&zr.sigmask);
+    }
+
+    // strings: path, argv, envp
+    char *const *envp = req->envp ? req->envp : environ;
+    size_t len = req->path ? strlen(req->path) + 1 : 0;
+    for (zr.argc = 0; req->argv[zr.argc]; zr.argc++) {
+        len += strlen(req->argv[zr.argc]) + 1;
+    }
+    for (zr.envc = 0; envp[zr.envc]; zr.envc++) {
+        len += strlen(envp[zr.envc]) + 1;
+    }
+    if (len > ZYGOTE_MAX_MSG) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (len > cap) {
+        char *grown = realloc(buf, len);
+        if (!grown) {
+            return -1;
+        }
+        buf = grown;
+        cap = len;
+    }
+    char *p = buf;
+    if (req->path) {
+        p = stpcpy(p, req->path) + 1;
+    }
+    for (int i = 0; i < zr.argc; i++) {
+        p = stpcpy(p, req->argv[i]) + 1;
+    }
+    for (int i = 0; i < zr.envc; i++) {
+        p = stpcpy(p, envp[i]) + 1;
+    }
+
+    // the helper's cwd and fds are from startup, send the shell's current ones
+    int fds[ZYGOTE_MAX_FDS];
+    int nfds = 0;
+    int cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (cwd < 0) {
+        return -1;
+    }
+    fds[nfds++] = cwd;
+    zr.fd_mask = fd_script_mask;
+    for (int fd = 0; fd <= FD_SCRIPT_MAX; fd++) {
+        if (zr.fd_mask & (1 << fd)) {
+            fds[nfds++] = fd;
+        }
+    }
+    // a dup from a script fd, or from one an earlier dup set up, is done by the child
+    unsigned child_fds = zr.fd_mask;
+    for (int i = 0; i < req->ndups; i++) {
+        int src = req->dups[i].src_fd;
+        int fd = req->dups[i].fd;
+        zr.targets[i] = fd;
+        if (src < 0) {
+            zr.sources[i] = ZYGOTE_DUP_CLOSE;
+        } else if (src <= FD_SCRIPT_MAX && (child_fds & (1u << src))) {
+            zr.sources[i] = src;
+        } else {
+            zr.sources[i] = ZYGOTE_DUP_SENT;
+            fds[nfds++] = src;
+        }
+        if (fd <= FD_SCRIPT_MAX) {
+            child_fds = src < 0 ? child_fds & ~(1u << fd) : child_fds | (1u << fd);
+        }
+    }
+
+    union {
+        struct cmsghdr hdr;
+        char space[CMSG_SPACE(ZYGOTE_MAX_FDS * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov[2] = { { &zr, sizeof(zr) }, { buf, len } };
+    struct msghdr msg = {
+        .msg_iov = iov, .msg_iovlen = 2,
+        .msg_control = control.space, .msg_controllen = CMSG_SPACE(nfds * sizeof(int))
+    };
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+    memcpy(CMSG_DATA(c), fds, nfds * sizeof(int));
+
+    ssize_t n;
+    do {
+        n = sendmsg(zygote_fd, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    int err = errno;
+    close(cwd);
+    if (n < 0) {
+        if (err == EPIPE || err == ECONNRESET) {
+            zygote_lost();
+            err = EPIPE;
+        }
+        errno = err;
+        return -1;
+    }
+
+    zygote_reply_t reply;
+    do {
+        n = recv(zygote_fd, &reply, sizeof(reply), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n != sizeof(reply)) {
+        zygote_lost();
+        errno = EPIPE;
+        return -1;
+    }
+
+    // parent's half of the pgid handshake, harmless once the child has exec'd
+    if (reply.pid > 0 && req->pgid >= 0) {
+        setpgid(reply.pid, req->pgid ? req->pgid : reply.pid);
+    }
+    if (reply.err) {
+        // the failed child is ours to reap, the SIGCHLD handler will find no job for it
+        errno = reply.err;
+        return -1;
+    }
+    if (req->timing) {
+        // like posix_spawn, only the finished exec is seen from here
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        req->timing->child_start = 0;
+        req->timing->setup_done = 0;
+        req->timing->exec_done = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+    return reply.pid;
+}
+
+void zygote_setrlimit(int resource, const struct rlimit *rl) {
+    // the helper's children inherit its limits, so 'ulimit' has to reach it too
+    if (zygote_fd >= 0 && prlimit(zygote_pid, resource, rl, NULL) < 0) {
+        fprintf(stderr, "yash: spawn server: %s\n", strerror(errno));
+    }
+}
+
+void zygote_forget(void) {
+    // in a forked builtin child: the helper's children would be the shell's, not ours
+    // the socket went with the child's other close-on-exec fds, and its number may
+    // already be reused by the child's own signalfd, so it is only forgotten
+    zygote_fd = -1;
+}
@@ -0,0 +1,21 @@
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include "spawn.h"
+
+// spawn server: a small helper forked at startup, before the shell grows,
+// that launches commands for it (YASH_SPAWN=zygote)
+// requests go over a socketpair, fds (cwd, stdio, redirections) with SCM_RIGHTS
+// children are cloned with CLONE_PARENT, so they are the shell's own children
+// and wait4, SIGCHLD, pidfds and setpgid work exactly as for a direct spawn
+
+int zygote_start(void);
+int zygote_running(void);
+int zygote_can_spawn(const spawn_req_t *req);
+pid_t zygote_spawn(const spawn_req_t *req);
+void zygote_setrlimit(int resource, const struct rlimit *rl);
+void zygote_forget(void);
+
+#endif